@@ -7,30 +7,109 @@
 
 #include <opencv2/opencv.hpp>
 #include <map>
+#include <mutex>
 #include "islay/InterThreadMessenger.hpp"
+#include "islay/QueueMessenger.hpp"
+#include "islay/MessengerRegistry.hpp"
+#include "islay/FramePool.h"
+#include "islay/ShmImageChannel.h"
+
+/**
+ * @brief Color map applied by the GUI to single-channel images
+ */
+enum class COLORMAP {GRAY = 0, JET = 1, TURBO = 2};
+
+/**
+ * @brief Color filter array of a raw single-channel image, by its top-left 2x2 pixels
+ *   (OpenCV names the same layouts after the second row: RGGB is cv::COLOR_BayerBG2BGR.)
+ */
+enum class BAYER_PATTERN {NONE = 0, RGGB = 1, BGGR = 2, GRBG = 3, GBRG = 4};
+
+/**
+ * @brief How the GUI maps pixel values to colors. Applied on the GPU where available.
+ *   Values are in the unit of the pixel type, e.g. millimeters of a CV_16U depth map.
+ */
+struct ImageDisplayMapping {
+    double minValue = 0;   // Shown as black (the first color of the colormap)
+    double maxValue = -1;  // Shown as white (the last color). Below minValue: the full range of the type (255, 65535, 1.0)
+    bool autoRange = false; // Use the min and max of each frame instead
+    COLORMAP colormap = COLORMAP::GRAY;
+    BAYER_PATTERN bayer = BAYER_PATTERN::NONE;
+};
 
 struct OcvImageMsg : public MsgData {
     cv::Mat img;
+    ImageDisplayMapping mapping; // Set it with each message: buffers are reused
 };
 
-struct OcvImageMessengerCollection{
-    std::map<std::string, std::shared_ptr<InterThreadMessenger<OcvImageMsg>>> pool;
+/**
+ * Latest-value image channel. Lock-free: each channel has one sending thread at a time, and one receiver
+ * (the GUI or HeadlessRunner).
+ */
+using OcvImageMessenger = InterThreadMessenger<OcvImageMsg, MESSENGER_MODE::TRIPLE_BUFFER>;
 
-    std::shared_ptr<InterThreadMessenger<OcvImageMsg>> setup(std::string name){
-        bool hasMsg;
-        pool.count(name) == 0? hasMsg=false: hasMsg=true;
-        if(!hasMsg)
-            pool[name] = std::make_shared<InterThreadMessenger<OcvImageMsg>>();
-        return pool[name];
+/**
+ * Latest-value image channels shown in the GUI. setup() may be called from any worker thread
+ * while the GUI iterates snapshot(). See MessengerRegistry.
+ */
+struct OcvImageMessengerCollection : public MessengerRegistry<OcvImageMessenger> {
+    /**
+     * Draw an image buffer from the frame pool. Fill it and pass it to a message without copy;
+     * it returns to the pool once the GUI has released it. See FramePool.
+     */
+    cv::Mat acquireFrame(cv::Size size, int type){
+        return FramePool::get_instance().acquire(size, type);
     }
 
-    void clear(){
-        pool.clear();
+    /**
+     * Optional shared memory transport of a channel, for viewers or recorders in other processes
+     * (ShmImageReader). Fill writer->acquire() and publish() it without copy, alongside or instead of
+     * the in-process messenger. Returns the existing writer if its slots are large enough; otherwise the
+     * channel is replaced and marked closed, so that its readers reopen it. Returns nullptr if the channel
+     * is published by another live process.
+     */
+    std::shared_ptr<ShmImageWriter> setupSharedMemory(const std::string& name, size_t slotBytes, uint32_t slotCount = 4){
+        std::lock_guard<std::mutex> lock(sharedMemoryMutex);
+        auto& writer = sharedMemoryWriters[name];
+        if (writer && writer->getSlotBytes() >= slotBytes) return writer;
+        writer = std::make_shared<ShmImageWriter>();
+        if (!writer->open(name, slotBytes, slotCount)) writer.reset();
+        return writer;
     }
 
-    bool close(){
-        for (auto& msg: pool){ msg.second->close(); }
-        return true;
+    /**
+     * Release the shared memory channels. Each is closed once the workers holding its writer release it.
+     */
+    void closeSharedMemory(){
+        std::lock_guard<std::mutex> lock(sharedMemoryMutex);
+        sharedMemoryWriters.clear();
+    }
+
+private:
+    std::mutex sharedMemoryMutex;
+    std::map<std::string, std::shared_ptr<ShmImageWriter>> sharedMemoryWriters;
+};
+
+/**
+ * Image channels with queue semantics, for consumers that must see every frame (recording, logging, tracking).
+ * The GUI does not consume them: their consumer is another worker, or the sink of HeadlessRunner. A queue
+ * without consumer fills up and then applies its OVERFLOW_POLICY; BLOCK producers wait until close().
+ */
+struct OcvImageQueueCollection : public MessengerRegistry<QueueMessenger<OcvImageMsg>> {
+    /**
+     * Set up a queue with a name. Capacity and policy are used only when the queue is newly created.
+     */
+    Handle setup(const std::string& name, size_t capacity = 16, OVERFLOW_POLICY policy = OVERFLOW_POLICY::BLOCK){
+        return MessengerRegistry::setup(name, capacity, policy);
+    }
+
+    /**
+     * Number of dropped messages of each queue
+     */
+    std::map<std::string, unsigned long long> dropCounts(){
+        std::map<std::string, unsigned long long> counts;
+        for (auto& [name, queue]: *snapshot()){ counts[name] = queue->getDropCount(); }
+        return counts;
     }
 };
 
@@ -41,8 +120,15 @@ public:
      */
     OcvImageMessengerCollection ocvImageMsgCollection;
 
+    /**
+     * Image Queue Collection
+     */
+    OcvImageQueueCollection ocvImageQueueCollection;
+
     void close(){
         ocvImageMsgCollection.close();
+        ocvImageMsgCollection.closeSharedMemory();
+        ocvImageQueueCollection.close();
     };
 };
 
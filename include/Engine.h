@@ -5,22 +5,39 @@
 #ifndef ISLAY_ENGINE_H
 #define ISLAY_ENGINE_H
 
+#include <islay/Config.h>
 #include <islay/EngineBase.h>
 
 class Engine : public EngineBase{
 public:
-    Engine(AppMsgPtr _appMsg): EngineBase(std::move(_appMsg)){};
+    /**
+     * The PUs reserved for TaskScheduler threads come from TASK_SCHEDULER_THREADS of the config (0: half of the PUs)
+     */
+    Engine(AppMsgPtr _appMsg): EngineBase(std::move(_appMsg), taskSchedulerThreads()){};
     ~Engine(){
         reset();
     }
     bool run() override;
     bool reset() override {
-        for(auto& [name, worker]: workers) worker.reset();
+        for(auto& [name, worker]: workers) worker->reset(); // Wait for running workers
         return true;
     };
 
     bool runWorkerSample();
     bool runWorkerSampleWithCpuBinding();
+    bool runPipelineSample();
+
+    /**
+     * @brief Launchers by name, for running workers without the GUI (see headless_main.cpp)
+     */
+    std::map<std::string, std::function<bool()>> getLaunchers();
+
+private:
+    static unsigned int taskSchedulerThreads(){
+        auto config = Config::get_instance().snapshot();
+        if (!config->hasParam("TASK_SCHEDULER_THREADS")) return 0;
+        return (unsigned int) std::max(0, config->readIntParam("TASK_SCHEDULER_THREADS"));
+    }
 
 };
 
@@ -6,11 +6,17 @@
 #define ISLAY_WORKERSAMPLE_H
 
 #include <islay/Worker.h>
+#include <islay/Pipeline.h>
 
 /** \brief Sample class of worker with application messenger
  *
  */
 class WorkerSample : public WorkerBase {
+    // Config parameters, bound once per worker
+    Param<int> imageWidth = Config::get_instance().param<int>("IMAGE_WIDTH");
+    Param<int> imageHeight = Config::get_instance().param<int>("IMAGE_HEIGHT");
+    Param<std::string> imgPath = Config::get_instance().param<std::string>("IMG_PATH");
+    Param<std::string> imgName = Config::get_instance().param<std::string>("IMG_NAME");
 public:
     explicit WorkerSample (std::weak_ptr<WorkerManager> wm, AppMsgPtr appMsg):
         WorkerBase(wm,appMsg){};
@@ -21,10 +27,43 @@ public:
  *
  */
 class WorkerSampleWithCpuBinding : public WorkerBase {
+    Param<int> imageWidth = Config::get_instance().param<int>("IMAGE_WIDTH");
+    Param<int> imageHeight = Config::get_instance().param<int>("IMAGE_HEIGHT");
+    Param<std::string> imgPath = Config::get_instance().param<std::string>("IMG_PATH");
 public:
     explicit WorkerSampleWithCpuBinding (std::weak_ptr<WorkerManager> wm, AppMsgPtr appMsg):
         WorkerBase(wm, appMsg){};
     bool run(const std::shared_ptr<void> data);
 };
 
+/** \brief Sample pipeline: LenaSource -> BlurStage -> DisplayStage
+ *
+ */
+class LenaSource : public Stage {
+    OutPort<cv::Mat> out{this, "out"};
+    cv::Mat lena;
+    Param<std::string> imgPath = Config::get_instance().param<std::string>("IMG_PATH");
+public:
+    explicit LenaSource (std::weak_ptr<WorkerManager> wm, AppMsgPtr appMsg):
+        Stage(wm, appMsg){};
+    bool process() override;
+};
+
+class BlurStage : public Stage {
+    InPort<cv::Mat> in{this, "in"};
+    OutPort<cv::Mat> out{this, "out"};
+public:
+    explicit BlurStage (std::weak_ptr<WorkerManager> wm, AppMsgPtr appMsg):
+        Stage(wm, appMsg){};
+    bool process() override;
+};
+
+class DisplayStage : public Stage {
+    InPort<cv::Mat> in{this, "in"};
+public:
+    explicit DisplayStage (std::weak_ptr<WorkerManager> wm, AppMsgPtr appMsg):
+        Stage(wm, appMsg){};
+    bool process() override;
+};
+
 #endif //ISLAY_WORKERSAMPLE_H
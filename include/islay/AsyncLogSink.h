@@ -0,0 +1,282 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_ASYNCLOGSINK_H
+#define ISLAY_ASYNCLOGSINK_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/sink.h>
+
+#include "ByteRing.h"
+
+/**
+ * @brief Ring of the log messages of a thread: a Header and the text per record
+ */
+class LogRing {
+public:
+    static constexpr size_t CAPACITY = 1 << 17;       // Bytes
+    static constexpr size_t MAX_TEXT = CAPACITY / 8;  // Longer messages are truncated
+
+    struct Header {
+        int64_t timeNs;       // system_clock
+        const char* file;     // spdlog::source_loc, string literals
+        const char* function;
+        int line;
+        uint32_t length;      // Of the text
+        int level;
+    };
+
+    explicit LogRing(size_t _threadId) : threadId(_threadId) {};
+
+    /**
+     * @brief Copy a message into the ring (producer). False if the ring is full: the message is dropped.
+     */
+    bool push(const spdlog::details::log_msg& msg){
+        auto length = (uint32_t) std::min(msg.payload.size(), MAX_TEXT);
+        char* p = ring.reserve((uint32_t) sizeof(Header) + length);
+        if (p == nullptr) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Header header{std::chrono::duration_cast<std::chrono::nanoseconds>(msg.time.time_since_epoch()).count(),
+                      msg.source.filename, msg.source.funcname, msg.source.line, length, (int) msg.level};
+        std::memcpy(p, &header, sizeof(Header));
+        std::memcpy(p + sizeof(Header), msg.payload.data(), length);
+        ring.commit();
+        return true;
+    }
+
+    /**
+     * @brief Call f(header, text) on the pending records (consumer). The text is valid only during the call.
+     */
+    template<class F>
+    size_t drain(F&& f){
+        return ring.drain([&](const char* p, uint32_t) {
+            Header header;
+            std::memcpy(&header, p, sizeof(Header));
+            f(header, spdlog::string_view_t(p + sizeof(Header), header.length));
+        });
+    }
+
+    bool empty() const { return ring.empty(); }
+
+    const size_t threadId;
+    std::atomic<unsigned long long> dropped{0};
+    unsigned long long droppedReported = 0; // Consumer side
+    std::atomic<bool> closed{false};        // Set when the thread exits; the ring is removed once drained
+
+private:
+    ByteRing ring{CAPACITY};
+};
+
+/**
+ * @brief Front sink of the asynchronous logging mode (see Logger::startAsync())
+ *   log() only copies the formatted message into the ring of the calling thread, without lock nor
+ *   system call. A flusher thread drains the rings every FLUSH_INTERVAL (or on flush()), orders each
+ *   batch by time and passes it to the back sinks (file, console, LogStore). A thread that logs faster
+ *   than the flusher drains loses messages rather than waiting; the losses are logged.
+ */
+class AsyncLogSink : public spdlog::sinks::sink {
+public:
+    static constexpr std::chrono::milliseconds FLUSH_INTERVAL{5};
+
+    AsyncLogSink() = default;
+    AsyncLogSink(const AsyncLogSink&) = delete;
+    AsyncLogSink& operator=(const AsyncLogSink&) = delete;
+
+    ~AsyncLogSink() override { stop(); }
+
+    /**
+     * @brief Start the flusher thread
+     * @param onStart Called first in the flusher thread, e.g. to bind it to a PU
+     * @param onExit Called last in the flusher thread
+     */
+    void start(std::function<void()> onStart = nullptr, std::function<void()> onExit = nullptr){
+        std::lock_guard<std::mutex> lock(mtx);
+        if (flusher.joinable()) return;
+        stopRequested = false;
+        flusher = std::thread([this, onStart, onExit] {
+            if (onStart) onStart();
+            loop();
+            if (onExit) onExit();
+        });
+    }
+
+    /**
+     * @brief Drain the rings and stop the flusher thread
+     */
+    void stop(){
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!flusher.joinable()) return;
+            stopRequested = true;
+        }
+        wakeCv.notify_all();
+        flusher.join();
+        drainOnce(); // Messages of threads that still held the previous logger
+    }
+
+    bool isRunning(){
+        std::lock_guard<std::mutex> lock(mtx);
+        return flusher.joinable();
+    }
+
+    void setBackSinks(std::vector<spdlog::sink_ptr> sinks){
+        std::lock_guard<std::mutex> lock(backMtx);
+        backSinks = std::move(sinks);
+    }
+
+    unsigned long long getDropCount(){
+        std::lock_guard<std::mutex> lock(ringsMtx);
+        unsigned long long total = droppedOfClosedRings;
+        for (auto& r: rings) total += r->dropped.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    void log(const spdlog::details::log_msg& msg) override {
+        ring(msg.thread_id).push(msg);
+    }
+
+    /**
+     * @brief Wait until the messages logged so far have reached the back sinks, and flush them
+     */
+    void flush() override {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (!flusher.joinable()) {
+            lock.unlock();
+            drainOnce();
+            return;
+        }
+        unsigned long long target = started + 1;
+        requested = std::max(requested, target);
+        wakeCv.notify_all();
+        drainedCv.wait(lock, [&] { return finished >= target || !flusher.joinable() || stopRequested; });
+    }
+
+    // The back sinks format the messages
+    void set_pattern(const std::string&) override {}
+    void set_formatter(std::unique_ptr<spdlog::formatter>) override {}
+
+private:
+    LogRing& ring(size_t threadId){
+        struct Local {
+            AsyncLogSink* owner = nullptr;
+            std::shared_ptr<LogRing> ring;
+            ~Local(){ if (ring) ring->closed.store(true, std::memory_order_release); }
+        };
+        thread_local Local local;
+        if (local.owner != this) {
+            auto r = std::make_shared<LogRing>(threadId);
+            {
+                std::lock_guard<std::mutex> lock(ringsMtx);
+                rings.push_back(r);
+            }
+            if (local.ring) local.ring->closed.store(true, std::memory_order_release);
+            local.owner = this;
+            local.ring = r;
+        }
+        return *local.ring;
+    }
+
+    void loop(){
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true) {
+            bool stopping = stopRequested;
+            started++;
+            lock.unlock();
+            drainOnce();
+            lock.lock();
+            finished = started;
+            drainedCv.notify_all();
+            if (stopping) break;
+            wakeCv.wait_for(lock, FLUSH_INTERVAL, [this] { return stopRequested || requested > started; });
+        }
+    }
+
+    struct Pending {
+        LogRing::Header header;
+        size_t threadId;
+        std::string text;
+    };
+
+    void drainOnce(){
+        std::lock_guard<std::mutex> drainLock(drainMtx);
+        std::vector<std::shared_ptr<LogRing>> current;
+        {
+            std::lock_guard<std::mutex> lock(ringsMtx);
+            current = rings;
+        }
+        pending.clear();
+        for (auto& r: current) {
+            bool closed = r->closed.load(std::memory_order_acquire); // Before draining: no push after it
+            r->drain([&](const LogRing::Header& h, spdlog::string_view_t text) {
+                pending.push_back(Pending{h, r->threadId, std::string(text.data(), text.size())});
+            });
+            unsigned long long dropped = r->dropped.load(std::memory_order_relaxed);
+            if (dropped != r->droppedReported) {
+                LogRing::Header h{};
+                h.timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
+                h.level = (int) spdlog::level::warn;
+                pending.push_back(Pending{h, r->threadId, fmt::format(
+                        "{} log messages dropped: the thread logged faster than they were written",
+                        dropped - r->droppedReported)});
+                r->droppedReported = dropped;
+            }
+            if (closed && r->empty()) {
+                std::lock_guard<std::mutex> lock(ringsMtx);
+                droppedOfClosedRings += dropped;
+                rings.erase(std::remove(rings.begin(), rings.end(), r), rings.end());
+            }
+        }
+        if (pending.empty()) return;
+
+        std::stable_sort(pending.begin(), pending.end(), [](const Pending& a, const Pending& b) {
+            return a.header.timeNs < b.header.timeNs;
+        });
+        std::lock_guard<std::mutex> lock(backMtx);
+        for (auto& p: pending) {
+            spdlog::source_loc source(p.header.file, p.header.line, p.header.function);
+            spdlog::log_clock::time_point time{std::chrono::duration_cast<spdlog::log_clock::duration>(
+                    std::chrono::nanoseconds(p.header.timeNs))};
+            spdlog::details::log_msg msg(time, source, "LOGGER", (spdlog::level::level_enum) p.header.level,
+                                         spdlog::string_view_t(p.text.data(), p.text.size()));
+            msg.thread_id = p.threadId;
+            for (auto& sink: backSinks) {
+                if (sink->should_log(msg.level)) sink->log(msg);
+            }
+        }
+        for (auto& sink: backSinks) sink->flush();
+    }
+
+    std::mutex mtx; // Guards the flusher state below
+    std::thread flusher;
+    bool stopRequested = false;
+    unsigned long long started = 0, finished = 0, requested = 0; // Drains of the flusher
+    std::condition_variable wakeCv, drainedCv;
+
+    std::mutex ringsMtx; // Guards rings
+    std::vector<std::shared_ptr<LogRing>> rings;
+    unsigned long long droppedOfClosedRings = 0;
+
+    std::mutex drainMtx; // One drain at a time; guards pending
+    std::vector<Pending> pending;
+
+    std::mutex backMtx; // Guards backSinks
+    std::vector<spdlog::sink_ptr> backSinks;
+};
+
+#endif //ISLAY_ASYNCLOGSINK_H
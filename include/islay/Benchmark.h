@@ -0,0 +1,339 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_BENCHMARK_H
+#define ISLAY_BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+#include "Logger.h"
+#include "PUBinder.h"
+
+/**
+ * @brief How long and how precisely BenchmarkRunner measures a benchmark
+ */
+struct BenchmarkConfig {
+    double warmupSeconds = 0.1;
+    size_t minSamples = 10;
+    size_t maxSamples = 1000;
+    double maxSeconds = 2.0;           // Per benchmark, unless minSamples are not reached yet
+    double targetRelativeCI = 0.01;    // Stop once the 95 % confidence interval of the mean is within +-1 %
+    double minSampleSeconds = 20e-6;   // Iterations are batched so that a sample is long enough for the clock
+    bool pin = true;                   // Bind the benchmarking thread to a PU through PUBinder
+};
+
+/**
+ * @brief Statistics of a benchmark. Durations are nanoseconds per iteration.
+ */
+struct BenchmarkResult {
+    std::string group;                 // Benchmarks of a group are compared side by side
+    std::string name;
+    size_t samples = 0;
+    unsigned long long iterationsPerSample = 0;
+    double mean = 0, stddev = 0, ci95 = 0;
+    double min = 0, median = 0, p99 = 0, max = 0;
+    double cycles = -1;                // Median CPU cycles per iteration. -1 if perf_event_open is unavailable
+    int pu = -1;                       // PU the benchmark ran on. -1 if not pinned
+    std::vector<double> sampleNs;
+};
+
+/**
+ * @brief CPU cycles of the calling thread in user space, through perf_event_open (Linux only)
+ *   Unavailable (isValid() false) on other systems, in containers without perf access, or when
+ *   /proc/sys/kernel/perf_event_paranoid forbids it.
+ */
+class CycleCounter {
+public:
+    CycleCounter(){
+#if defined(__linux__)
+        perf_event_attr pe{};
+        pe.type = PERF_TYPE_HARDWARE;
+        pe.size = sizeof(pe);
+        pe.config = PERF_COUNT_HW_CPU_CYCLES;
+        pe.exclude_kernel = 1;
+        pe.exclude_hv = 1;
+        fd = (int) syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0); // This thread, any CPU
+#endif
+    }
+
+    CycleCounter(const CycleCounter&) = delete;
+    CycleCounter& operator=(const CycleCounter&) = delete;
+
+    ~CycleCounter(){
+#if defined(__linux__)
+        if (fd != -1) close(fd);
+#endif
+    }
+
+    bool isValid() const { return fd != -1; }
+
+    uint64_t read() const {
+        uint64_t count = 0;
+#if defined(__linux__)
+        if (fd != -1 && ::read(fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+#endif
+        return count;
+    }
+
+private:
+    int fd = -1;
+};
+
+/**
+ * @brief Statistical micro-benchmark runner, the repeated counterpart of Util::Bench::bench
+ *
+ *   BenchmarkRunner runner(engine->getPUBinder());
+ *   runner.run("blur", "serial", [&]{ cv::GaussianBlur(src, dst, cv::Size(17, 17), 10); });
+ *   runner.run("blur", "parallel", [&]{ ... });
+ *   runner.exportJson(resultDirectory + "/bench.json");
+ *
+ * A benchmark is warmed up, then sampled until the confidence interval of the mean is narrow enough
+ * or its time is up. Each sample times a batch of iterations. Use doNotOptimize() on values the
+ * compiler could otherwise discard. Results may be read from another thread while benchmarks run.
+ */
+class BenchmarkRunner {
+public:
+    explicit BenchmarkRunner(std::weak_ptr<PUBinder> _puBinder = std::weak_ptr<PUBinder>(),
+                             BenchmarkConfig _config = BenchmarkConfig())
+            : puBinder(std::move(_puBinder)), config(_config) {};
+
+    BenchmarkRunner(const BenchmarkRunner&) = delete;
+    BenchmarkRunner& operator=(const BenchmarkRunner&) = delete;
+
+    ~BenchmarkRunner(){
+        if (auto binder = puBinder.lock()) {
+            for (auto& p: pinned) binder->unbind(p.second);
+        }
+    }
+
+    void setConfig(const BenchmarkConfig& _config){ config = _config; }
+
+    const BenchmarkConfig& getConfig() const { return config; }
+
+    template<class T>
+    static void doNotOptimize(const T& value){
+#if defined(__GNUC__)
+        asm volatile("" : : "r,m"(value) : "memory");
+#else
+        static volatile const void* sink;
+        sink = &value;
+#endif
+    }
+
+    /**
+     * @brief Measure fn() and keep the result
+     */
+    template<class F>
+    BenchmarkResult run(const std::string& group, const std::string& name, F&& fn){
+        BenchmarkResult result;
+        result.group = group;
+        result.name = name;
+        result.pu = pin();
+
+        using clock = std::chrono::steady_clock;
+        auto seconds = [](clock::duration d){ return std::chrono::duration<double>(d).count(); };
+
+        // Warm up caches, branch predictors and clock frequency, and size the batches
+        unsigned long long warmupIterations = 0;
+        auto warmupStart = clock::now();
+        do {
+            fn();
+            warmupIterations++;
+        } while (seconds(clock::now() - warmupStart) < config.warmupSeconds);
+        double iterationSeconds = seconds(clock::now() - warmupStart) / warmupIterations;
+        unsigned long long batch = std::max<unsigned long long>(
+                1, (unsigned long long) std::ceil(config.minSampleSeconds / std::max(iterationSeconds, 1e-12)));
+        result.iterationsPerSample = batch;
+
+        CycleCounter cycleCounter;
+        std::vector<double> cycles;
+        auto start = clock::now();
+        while (result.sampleNs.size() < config.maxSamples) {
+            uint64_t c0 = cycleCounter.read();
+            auto t0 = clock::now();
+            for (unsigned long long i = 0; i < batch; i++) fn();
+            auto t1 = clock::now();
+            uint64_t c1 = cycleCounter.read();
+            result.sampleNs.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count() / batch);
+            if (cycleCounter.isValid()) cycles.push_back((double) (c1 - c0) / batch);
+
+            size_t n = result.sampleNs.size();
+            if (n < config.minSamples) continue;
+            summarize(result);
+            if (result.ci95 <= config.targetRelativeCI * result.mean) break;
+            if (seconds(clock::now() - start) >= config.maxSeconds) break;
+        }
+        summarize(result);
+        if (!cycles.empty()) result.cycles = percentile(cycles, 0.5);
+
+        SPDLOG_INFO("{}/{}: median {:.1f} ns, mean {:.1f} +- {:.1f} ns, p99 {:.1f} ns{} ({} samples x {})",
+                    group, name, result.median, result.mean, result.ci95, result.p99,
+                    result.cycles >= 0 ? fmt::format(", {:.0f} cycles", result.cycles) : "",
+                    result.samples, batch);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            results.push_back(result);
+        }
+        return result;
+    }
+
+    std::vector<BenchmarkResult> getResults() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return results;
+    }
+
+    void clearResults(){
+        std::lock_guard<std::mutex> lock(mtx);
+        results.clear();
+    }
+
+    bool exportJson(const std::string& path) const {
+        rapidjson::StringBuffer buffer;
+        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("config");
+        writer.StartObject();
+        writer.Key("warmupSeconds"); writer.Double(config.warmupSeconds);
+        writer.Key("minSamples"); writer.Uint64(config.minSamples);
+        writer.Key("maxSamples"); writer.Uint64(config.maxSamples);
+        writer.Key("maxSeconds"); writer.Double(config.maxSeconds);
+        writer.Key("targetRelativeCI"); writer.Double(config.targetRelativeCI);
+        writer.EndObject();
+        writer.Key("results");
+        writer.StartArray();
+        for (auto& r: getResults()) {
+            writer.StartObject();
+            writer.Key("group"); writer.String(r.group.c_str());
+            writer.Key("name"); writer.String(r.name.c_str());
+            writer.Key("samples"); writer.Uint64(r.samples);
+            writer.Key("iterationsPerSample"); writer.Uint64(r.iterationsPerSample);
+            writer.Key("mean_ns"); writer.Double(r.mean);
+            writer.Key("stddev_ns"); writer.Double(r.stddev);
+            writer.Key("ci95_ns"); writer.Double(r.ci95);
+            writer.Key("min_ns"); writer.Double(r.min);
+            writer.Key("median_ns"); writer.Double(r.median);
+            writer.Key("p99_ns"); writer.Double(r.p99);
+            writer.Key("max_ns"); writer.Double(r.max);
+            writer.Key("cycles"); writer.Double(r.cycles);
+            writer.Key("pu"); writer.Int(r.pu);
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.EndObject();
+        return write(path, buffer.GetString());
+    }
+
+    bool exportCsv(const std::string& path) const {
+        std::ostringstream os;
+        os << "group,name,samples,iterations_per_sample,mean_ns,stddev_ns,ci95_ns,min_ns,median_ns,p99_ns,max_ns,cycles,pu\n";
+        for (auto& r: getResults()) {
+            os << csvField(r.group) << "," << csvField(r.name) << "," << r.samples << "," << r.iterationsPerSample << ","
+               << r.mean << "," << r.stddev << "," << r.ci95 << "," << r.min << "," << r.median << ","
+               << r.p99 << "," << r.max << "," << r.cycles << "," << r.pu << "\n";
+        }
+        return write(path, os.str());
+    }
+
+private:
+    /// Bind the calling thread once. Returns its PU, -1 if not pinned.
+    int pin(){
+        if (!config.pin) return -1;
+        auto binder = puBinder.lock();
+        if (!binder) return -1;
+        std::lock_guard<std::mutex> lock(mtx);
+        auto id = std::this_thread::get_id();
+        for (auto& p: pinned) {
+            if (p.first == id) return binder->getPuIfBinded(p.second);
+        }
+        std::string threadName = "Benchmark#" + std::to_string(pinned.size());
+#if WIN32
+        std::thread::native_handle_type self = GetCurrentThread();
+#else
+        std::thread::native_handle_type self = pthread_self();
+#endif
+        int pu = binder->bindThread(threadName, self, id);
+        if (pu == -1) {
+            SPDLOG_WARN("Benchmarks run without CPU binding: no vacant PU");
+            return -1;
+        }
+        pinned.emplace_back(id, threadName);
+        return pu;
+    }
+
+    static double percentile(std::vector<double> v, double q){
+        std::sort(v.begin(), v.end());
+        double pos = q * (v.size() - 1);
+        size_t i = (size_t) pos;
+        return i + 1 < v.size() ? v[i] + (v[i + 1] - v[i]) * (pos - i) : v[i];
+    }
+
+    static void summarize(BenchmarkResult& r){
+        const auto& s = r.sampleNs;
+        r.samples = s.size();
+        if (s.empty()) return;
+        double sum = 0;
+        for (double x: s) sum += x;
+        r.mean = sum / s.size();
+        double var = 0;
+        for (double x: s) var += (x - r.mean) * (x - r.mean);
+        r.stddev = s.size() > 1 ? std::sqrt(var / (s.size() - 1)) : 0;
+        // Two-sided 95 % quantiles of Student's t distribution
+        static const double t95[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                     2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                     2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+        size_t dof = s.size() - 1;
+        double t = dof == 0 ? 0 : dof <= 30 ? t95[dof - 1] : 1.960;
+        r.ci95 = t * r.stddev / std::sqrt((double) s.size());
+        r.min = *std::min_element(s.begin(), s.end());
+        r.max = *std::max_element(s.begin(), s.end());
+        r.median = percentile(s, 0.5);
+        r.p99 = percentile(s, 0.99);
+    }
+
+    static std::string csvField(const std::string& s){
+        if (s.find_first_of(",\"") == std::string::npos) return s;
+        std::string r = "\"";
+        for (char c: s) r += c == '"' ? std::string("\"\"") : std::string(1, c);
+        return r + "\"";
+    }
+
+    static bool write(const std::string& path, const std::string& content){
+        std::ofstream ofs(path);
+        if (!ofs) {
+            SPDLOG_ERROR("Cannot write {}", path);
+            return false;
+        }
+        ofs << content;
+        SPDLOG_INFO("Benchmark results saved: {}", path);
+        return true;
+    }
+
+    std::weak_ptr<PUBinder> puBinder;
+    BenchmarkConfig config;
+    mutable std::mutex mtx; // Guards results and pinned
+    std::vector<BenchmarkResult> results;
+    std::vector<std::pair<std::thread::id, std::string>> pinned;
+};
+
+#endif //ISLAY_BENCHMARK_H
@@ -0,0 +1,77 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_BENCHMARKVIEW_H
+#define ISLAY_BENCHMARKVIEW_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <imgui.h>
+#include <implot.h>
+
+#include "Benchmark.h"
+
+/**
+ * @brief Compare the results of the benchmarks of each group with ImPlot
+ *   Bars are medians, error bars span min to p99, in microseconds. Call in an ImGui window; results
+ *   may still be growing (BenchmarkRunner::getResults() from the benchmarking thread).
+ */
+inline void DrawBenchmarkResults(const std::vector<BenchmarkResult>& results){
+    std::map<std::string, std::vector<const BenchmarkResult*>> groups;
+    std::vector<std::string> order;
+    for (auto& r: results) {
+        if (groups.count(r.group) == 0) order.push_back(r.group);
+        groups[r.group].push_back(&r);
+    }
+    if (order.empty()) {
+        ImGui::TextUnformatted("No results yet");
+        return;
+    }
+
+    for (auto& group: order) {
+        auto& members = groups[group];
+        int n = (int) members.size();
+        std::vector<double> xs(n), medians(n), below(n), above(n);
+        std::vector<const char*> labels(n);
+        for (int i = 0; i < n; i++) {
+            xs[i] = i;
+            medians[i] = members[i]->median * 1e-3;
+            below[i] = (members[i]->median - members[i]->min) * 1e-3;
+            above[i] = (members[i]->p99 - members[i]->median) * 1e-3;
+            labels[i] = members[i]->name.c_str();
+        }
+        if (ImPlot::BeginPlot(group.c_str(), ImVec2(-1, 60.0f + 40.0f * n))) {
+            // Horizontal bars so that long names fit
+            ImPlot::SetupAxes("median [us]", nullptr, ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit);
+            ImPlot::SetupAxisTicks(ImAxis_Y1, xs.data(), n, labels.data());
+            ImPlot::PlotBars("median", medians.data(), n, 0.6, 0, ImPlotBarsFlags_Horizontal);
+            ImPlot::PlotErrorBars("min - p99", medians.data(), xs.data(), below.data(), above.data(), n,
+                                  ImPlotErrorBarsFlags_Horizontal);
+            ImPlot::EndPlot();
+        }
+        if (ImGui::BeginTable(group.c_str(), 6, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit)) {
+            ImGui::TableSetupColumn("Benchmark");
+            ImGui::TableSetupColumn("Median [us]");
+            ImGui::TableSetupColumn("Mean +- CI95 [us]");
+            ImGui::TableSetupColumn("p99 [us]");
+            ImGui::TableSetupColumn("Cycles");
+            ImGui::TableSetupColumn("PU");
+            ImGui::TableHeadersRow();
+            for (auto* r: members) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn(); ImGui::TextUnformatted(r->name.c_str());
+                ImGui::TableNextColumn(); ImGui::Text("%.3f", r->median * 1e-3);
+                ImGui::TableNextColumn(); ImGui::Text("%.3f +- %.3f", r->mean * 1e-3, r->ci95 * 1e-3);
+                ImGui::TableNextColumn(); ImGui::Text("%.3f", r->p99 * 1e-3);
+                ImGui::TableNextColumn(); if (r->cycles >= 0) ImGui::Text("%.0f", r->cycles); else ImGui::TextUnformatted("-");
+                ImGui::TableNextColumn(); ImGui::Text("%d", r->pu);
+            }
+            ImGui::EndTable();
+        }
+    }
+}
+
+#endif //ISLAY_BENCHMARKVIEW_H
@@ -0,0 +1,420 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_BINARYLOG_H
+#define ISLAY_BINARYLOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "ByteRing.h"
+
+/**
+ * @brief Layout of the binary log files (native byte order), read by BinaryLogReader and islay_binlog
+ *
+ *   File:   FileHeader, then records
+ *   Record: uint8 type, uint32 length of the payload, payload
+ *     SITE:    uint32 site, int32 level, int32 line, uint32 file length, file, uint32 format length, format
+ *     THREAD:  uint32 thread, uint32 name length, name
+ *     EVENT:   uint32 thread, uint32 site, int64 time (ns since the epoch, system_clock), uint8 argument count,
+ *              arguments: uint8 tag ('i' int64, 'u' uint64, 'f' double, 'b' uint8, 's' uint32 length + bytes)
+ *     DROPPED: uint32 thread, uint64 events dropped since the last DROPPED record of the thread
+ *
+ * A site is written before the first event that refers to it.
+ */
+namespace BinaryLogFormat {
+constexpr char MAGIC[8] = {'I', 'S', 'L', 'A', 'Y', 'B', 'L', 'G'};
+constexpr uint32_t VERSION = 1;
+enum RECORD_TYPE : uint8_t {SITE = 1, THREAD = 2, EVENT = 3, DROPPED = 4};
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    int64_t startTimeNs;
+};
+
+inline int64_t nowNs(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+}
+
+/**
+ * @brief A call site of ISLAY_BLOG: its format string is written once, events refer to it by id
+ */
+struct BinaryLogSite {
+    const char* format;
+    const char* file;
+    int line;
+    int level; // spdlog::level::level_enum
+    mutable std::atomic<uint32_t> id{0};
+};
+
+/**
+ * @brief Binary log of events for hot paths: no formatting, the arguments are stored as they are
+ *
+ *   BinaryLog::get_instance().open(resultDirectory + "/log.bin");
+ *   ISLAY_BLOG_DEBUG("frame {} blurred with k={} in {:.3f} ms", frame, k, ms); // fmt syntax, formatted by islay_binlog
+ *
+ * An event costs a clock read and a copy of its arguments into the ring of the calling thread. A writer
+ * thread streams the rings to the file every FLUSH_INTERVAL; events of a thread that outruns it are
+ * dropped and counted in the file. Arguments are integers, floating point numbers, bools and strings.
+ * Convert the file to text or CSV with islay_binlog (BinaryLogReader).
+ */
+class BinaryLog {
+public:
+    static constexpr size_t RING_CAPACITY = 1 << 18;
+    static constexpr std::chrono::milliseconds FLUSH_INTERVAL{10};
+
+    static BinaryLog& get_instance(){
+        // Never destroyed: threads may log during static destruction
+        static BinaryLog* instance = new BinaryLog();
+        return *instance;
+    }
+
+    /**
+     * @brief Start writing a new file. false if it cannot be created.
+     */
+    bool open(const std::string& path){
+        close();
+        std::lock_guard<std::mutex> lock(fileMtx);
+        file = fopen(path.c_str(), "wb");
+        if (file == nullptr) return false;
+        setvbuf(file, nullptr, _IOFBF, 1 << 20);
+        BinaryLogFormat::FileHeader header{};
+        std::memcpy(header.magic, BinaryLogFormat::MAGIC, sizeof(header.magic));
+        header.version = BinaryLogFormat::VERSION;
+        header.startTimeNs = BinaryLogFormat::nowNs();
+        fwrite(&header, sizeof(header), 1, file);
+        {
+            // Definitions are written again in each file
+            std::lock_guard<std::mutex> registryLock(registryMtx);
+            sitesWritten = 0;
+            for (auto& n: threadNames) n.written = false;
+        }
+        stopRequested = false;
+        writer = std::thread([this] { loop(); });
+        opened.store(true, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Write the pending events and close the file
+     */
+    void close(){
+        std::thread w;
+        {
+            std::lock_guard<std::mutex> lock(fileMtx);
+            if (!writer.joinable()) return;
+            opened.store(false, std::memory_order_release);
+            stopRequested = true;
+            w = std::move(writer);
+        }
+        wakeCv.notify_all();
+        w.join();
+        std::lock_guard<std::mutex> lock(fileMtx);
+        writeOnce();
+        fclose(file);
+        file = nullptr;
+    }
+
+    bool isOpen() const { return opened.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Wait until the events logged so far are in the file
+     */
+    void flush(){
+        std::unique_lock<std::mutex> lock(fileMtx);
+        if (!writer.joinable()) return;
+        unsigned long long target = started + 1;
+        requested = std::max(requested, target);
+        wakeCv.notify_all();
+        writtenCv.wait(lock, [&] { return finished >= target || stopRequested; });
+    }
+
+    /**
+     * @brief Name the events of the calling thread, e.g. after the worker it runs
+     */
+    void setThreadName(const std::string& name){
+        Thread& t = thread();
+        std::lock_guard<std::mutex> lock(registryMtx);
+        threadNames.push_back(ThreadName{t.id, name, false});
+    }
+
+    template<class... Args>
+    void log(const BinaryLogSite& site, const Args&... args){
+        static_assert(sizeof...(Args) < 256, "Too many arguments");
+        uint32_t id = site.id.load(std::memory_order_acquire);
+        if (id == 0) id = registerSite(site);
+        Thread& t = thread();
+        size_t size = sizeof(uint32_t) + sizeof(int64_t) + 1 + (argSize(args) + ... + 0);
+        char* p = size <= UINT32_MAX ? t.ring.reserve((uint32_t) size) : nullptr;
+        if (p == nullptr) {
+            t.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        put(p, id);
+        put(p, BinaryLogFormat::nowNs());
+        put(p, (uint8_t) sizeof...(Args));
+        (putArg(p, args), ...);
+        t.ring.commit();
+    }
+
+    unsigned long long getDropCount(){
+        std::lock_guard<std::mutex> lock(registryMtx);
+        unsigned long long total = droppedOfClosedThreads;
+        for (auto& t: threads) total += t->dropped.load(std::memory_order_relaxed);
+        return total;
+    }
+
+private:
+    struct Thread {
+        explicit Thread(uint32_t _id) : id(_id) {};
+        const uint32_t id;
+        ByteRing ring{RING_CAPACITY};
+        std::atomic<unsigned long long> dropped{0};
+        unsigned long long droppedWritten = 0; // Writer side
+        std::atomic<bool> closed{false};
+    };
+
+    struct SiteDefinition {
+        uint32_t id;
+        int level;
+        int line;
+        std::string file;
+        std::string format;
+    };
+
+    struct ThreadName {
+        uint32_t thread;
+        std::string name;
+        bool written;
+    };
+
+    BinaryLog() = default;
+
+    Thread& thread(){
+        struct Local {
+            std::shared_ptr<Thread> thread;
+            ~Local(){ if (thread) thread->closed.store(true, std::memory_order_release); }
+        };
+        thread_local Local local;
+        if (!local.thread) {
+            std::lock_guard<std::mutex> lock(registryMtx);
+            local.thread = std::make_shared<Thread>(++lastThread);
+            threads.push_back(local.thread); // Kept until the writer has drained it
+        }
+        return *local.thread;
+    }
+
+    uint32_t registerSite(const BinaryLogSite& site){
+        std::lock_guard<std::mutex> lock(registryMtx);
+        uint32_t id = site.id.load(std::memory_order_relaxed);
+        if (id != 0) return id;
+        id = (uint32_t) sites.size() + 1;
+        sites.push_back(SiteDefinition{id, site.level, site.line, site.file, site.format});
+        site.id.store(id, std::memory_order_release);
+        return id;
+    }
+
+    template<class T>
+    static void put(char*& p, const T& v){
+        std::memcpy(p, &v, sizeof(T));
+        p += sizeof(T);
+    }
+
+    template<class T>
+    static size_t argSize(const T& v){
+        if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+            return 1 + sizeof(uint32_t) + std::string_view(v).size();
+        } else {
+            static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>,
+                          "Binary log arguments are numbers, bools and strings");
+            return 1 + (std::is_same_v<T, bool> ? 1 : 8);
+        }
+    }
+
+    template<class T>
+    static void putArg(char*& p, const T& v){
+        if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+            std::string_view s(v);
+            put(p, 's');
+            put(p, (uint32_t) s.size());
+            std::memcpy(p, s.data(), s.size());
+            p += s.size();
+        } else if constexpr (std::is_same_v<T, bool>) {
+            put(p, 'b');
+            put(p, (uint8_t) v);
+        } else if constexpr (std::is_floating_point_v<T>) {
+            put(p, 'f');
+            put(p, (double) v);
+        } else if constexpr (std::is_enum_v<T> || std::is_signed_v<T>) {
+            put(p, 'i');
+            put(p, (int64_t) v);
+        } else {
+            put(p, 'u');
+            put(p, (uint64_t) v);
+        }
+    }
+
+    void loop(){
+        std::unique_lock<std::mutex> lock(fileMtx);
+        while (true) {
+            bool stopping = stopRequested;
+            started++;
+            writeOnce();
+            finished = started;
+            writtenCv.notify_all();
+            if (stopping) break;
+            wakeCv.wait_for(lock, FLUSH_INTERVAL, [this] { return stopRequested || requested > started; });
+        }
+    }
+
+    static void writeRecord(std::string& out, uint8_t type, const std::string& payload){
+        auto length = (uint32_t) payload.size();
+        out += (char) type;
+        out.append((const char*) &length, sizeof(length));
+        out += payload;
+    }
+
+    template<class T>
+    static void append(std::string& out, const T& v){
+        out.append((const char*) &v, sizeof(T));
+    }
+
+    static void appendString(std::string& out, const std::string& s){
+        append(out, (uint32_t) s.size());
+        out += s;
+    }
+
+    /// Drain the rings into the file. Called with fileMtx held.
+    void writeOnce(){
+        std::vector<std::shared_ptr<Thread>> current;
+        {
+            std::lock_guard<std::mutex> lock(registryMtx);
+            current = threads;
+        }
+        // Events of all threads, ordered by time within the batch
+        events.clear();
+        eventBytes.clear();
+        std::string dropped;
+        for (auto& t: current) {
+            bool closed = t->closed.load(std::memory_order_acquire); // Before draining: no event after it
+            t->ring.drain([&](const char* p, uint32_t length) {
+                int64_t time;
+                std::memcpy(&time, p + sizeof(uint32_t), sizeof(time));
+                events.push_back(Event{time, t->id, eventBytes.size(), length});
+                eventBytes.append(p, length);
+            });
+            unsigned long long d = t->dropped.load(std::memory_order_relaxed);
+            if (d != t->droppedWritten) {
+                std::string payload;
+                append(payload, t->id);
+                append(payload, (uint64_t) (d - t->droppedWritten));
+                writeRecord(dropped, BinaryLogFormat::DROPPED, payload);
+                t->droppedWritten = d;
+            }
+            if (closed && t->ring.empty()) {
+                std::lock_guard<std::mutex> lock(registryMtx);
+                droppedOfClosedThreads += d;
+                threads.erase(std::remove(threads.begin(), threads.end(), t), threads.end());
+            }
+        }
+        std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.time < b.time; });
+
+        // Definitions first: every event drained above has its site registered already
+        std::string out;
+        {
+            std::lock_guard<std::mutex> lock(registryMtx);
+            for (; sitesWritten < sites.size(); sitesWritten++) {
+                auto& s = sites[sitesWritten];
+                std::string payload;
+                append(payload, s.id);
+                append(payload, (int32_t) s.level);
+                append(payload, (int32_t) s.line);
+                appendString(payload, s.file);
+                appendString(payload, s.format);
+                writeRecord(out, BinaryLogFormat::SITE, payload);
+            }
+            for (auto& n: threadNames) {
+                if (n.written) continue;
+                std::string payload;
+                append(payload, n.thread);
+                appendString(payload, n.name);
+                writeRecord(out, BinaryLogFormat::THREAD, payload);
+                n.written = true;
+            }
+            // Only the latest name of each thread is needed by the next files
+            std::vector<ThreadName> latest;
+            for (auto it = threadNames.rbegin(); it != threadNames.rend(); ++it) {
+                if (std::none_of(latest.begin(), latest.end(), [&](const ThreadName& n) { return n.thread == it->thread; }))
+                    latest.push_back(*it);
+            }
+            threadNames.assign(latest.rbegin(), latest.rend());
+        }
+        out += dropped;
+        for (auto& e: events) {
+            auto length = (uint32_t) (sizeof(uint32_t) + e.length);
+            out += (char) BinaryLogFormat::EVENT;
+            append(out, length);
+            append(out, e.thread);
+            out.append(eventBytes, e.offset, e.length);
+        }
+        if (!out.empty() && file != nullptr) {
+            fwrite(out.data(), 1, out.size(), file);
+            fflush(file);
+        }
+    }
+
+    struct Event {
+        int64_t time;
+        uint32_t thread;
+        size_t offset; // In eventBytes
+        uint32_t length;
+    };
+
+    std::atomic<bool> opened{false};
+
+    std::mutex fileMtx; // Guards the file and the writer state below
+    FILE* file = nullptr;
+    std::thread writer;
+    bool stopRequested = false;
+    unsigned long long started = 0, finished = 0, requested = 0; // Writes of the writer thread
+    std::condition_variable wakeCv, writtenCv;
+    std::vector<Event> events;
+    std::string eventBytes;
+
+    std::mutex registryMtx; // Guards the threads, sites and thread names
+    std::vector<std::shared_ptr<Thread>> threads;
+    uint32_t lastThread = 0;
+    unsigned long long droppedOfClosedThreads = 0;
+    std::vector<SiteDefinition> sites;
+    size_t sitesWritten = 0;
+    std::vector<ThreadName> threadNames;
+};
+
+#define ISLAY_BLOG(level, format, ...) do { \
+        static const BinaryLogSite islayBlogSite{format, __FILE__, __LINE__, (int) (level)}; \
+        if (BinaryLog::get_instance().isOpen()) BinaryLog::get_instance().log(islayBlogSite, ##__VA_ARGS__); \
+    } while (0)
+#define ISLAY_BLOG_TRACE(format, ...) ISLAY_BLOG(0, format, ##__VA_ARGS__)
+#define ISLAY_BLOG_DEBUG(format, ...) ISLAY_BLOG(1, format, ##__VA_ARGS__)
+#define ISLAY_BLOG_INFO(format, ...) ISLAY_BLOG(2, format, ##__VA_ARGS__)
+#define ISLAY_BLOG_WARN(format, ...) ISLAY_BLOG(3, format, ##__VA_ARGS__)
+#define ISLAY_BLOG_ERROR(format, ...) ISLAY_BLOG(4, format, ##__VA_ARGS__)
+
+#endif //ISLAY_BINARYLOG_H
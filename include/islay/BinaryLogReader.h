@@ -0,0 +1,220 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_BINARYLOGREADER_H
+#define ISLAY_BINARYLOGREADER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+#if defined(SPDLOG_FMT_EXTERNAL)
+#include <fmt/args.h>
+#else
+#include <spdlog/fmt/bundled/args.h>
+#endif
+
+#include "BinaryLog.h"
+
+/**
+ * @brief Streaming reader of the files of BinaryLog
+ *
+ *   BinaryLogReader reader;
+ *   if (reader.open("log.bin")) {
+ *       BinaryLogReader::Event e;
+ *       while (reader.next(e)) std::cout << reader.format(e) << std::endl;
+ *   }
+ */
+class BinaryLogReader {
+public:
+    using Arg = std::variant<int64_t, uint64_t, double, bool, std::string>;
+
+    struct Site {
+        int level = 2;
+        int line = 0;
+        std::string file;
+        std::string format;
+    };
+
+    struct Event {
+        uint32_t site = 0;     // 0 for a DROPPED record
+        uint32_t thread = 0;
+        int64_t timeNs = 0;    // ns since the epoch. The time of the previous event for a DROPPED record
+        uint64_t dropped = 0;  // Events of the thread dropped by the writer (DROPPED record)
+        std::vector<Arg> args;
+    };
+
+    ~BinaryLogReader(){ close(); }
+
+    bool open(const std::string& path){
+        close();
+        file = fopen(path.c_str(), "rb");
+        if (file == nullptr) return false;
+        setvbuf(file, nullptr, _IOFBF, 1 << 20);
+        BinaryLogFormat::FileHeader header{};
+        if (fread(&header, sizeof(header), 1, file) != 1 ||
+            std::memcmp(header.magic, BinaryLogFormat::MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != BinaryLogFormat::VERSION) {
+            close();
+            return false;
+        }
+        // The file size bounds the record lengths, so that a corrupt length does not allocate gigabytes
+        if (fseek(file, 0, SEEK_END) != 0 || (fileSize = ftell(file)) < 0 ||
+            fseek(file, sizeof(header), SEEK_SET) != 0) {
+            close();
+            return false;
+        }
+        offset = sizeof(header);
+        startTimeNs = header.startTimeNs;
+        sites.clear();
+        threadNames.clear();
+        lastTimeNs = startTimeNs;
+        return true;
+    }
+
+    void close(){
+        if (file != nullptr) fclose(file);
+        file = nullptr;
+    }
+
+    /**
+     * @brief Read the next event. Definitions of sites and threads are applied on the way.
+     * @return false at the end of the file or on a truncated or corrupt record, including a record longer
+     *         than the rest of the file
+     */
+    bool next(Event& e){
+        while (file != nullptr) {
+            uint8_t type;
+            uint32_t length;
+            if (fread(&type, 1, 1, file) != 1 || fread(&length, sizeof(length), 1, file) != 1) return false;
+            offset += 1 + sizeof(length);
+            if ((int64_t) length > fileSize - offset) return false;
+            payload.resize(length);
+            if (length > 0 && fread(&payload[0], 1, length, file) != length) return false;
+            offset += length;
+            const char* p = payload.data();
+            const char* end = p + length;
+            bool ok = true;
+            switch (type) {
+                case BinaryLogFormat::SITE: {
+                    uint32_t id = get<uint32_t>(p, end, ok);
+                    Site s;
+                    s.level = get<int32_t>(p, end, ok);
+                    s.line = get<int32_t>(p, end, ok);
+                    s.file = getString(p, end, ok);
+                    s.format = getString(p, end, ok);
+                    if (ok) sites[id] = std::move(s);
+                    break;
+                }
+                case BinaryLogFormat::THREAD: {
+                    uint32_t id = get<uint32_t>(p, end, ok);
+                    std::string name = getString(p, end, ok);
+                    if (ok) threadNames[id] = std::move(name);
+                    break;
+                }
+                case BinaryLogFormat::EVENT: {
+                    e.thread = get<uint32_t>(p, end, ok);
+                    e.site = get<uint32_t>(p, end, ok);
+                    e.timeNs = get<int64_t>(p, end, ok);
+                    e.dropped = 0;
+                    auto argc = get<uint8_t>(p, end, ok);
+                    e.args.clear();
+                    for (int i = 0; ok && i < argc; i++) {
+                        switch (get<char>(p, end, ok)) {
+                            case 'i': e.args.emplace_back(get<int64_t>(p, end, ok)); break;
+                            case 'u': e.args.emplace_back(get<uint64_t>(p, end, ok)); break;
+                            case 'f': e.args.emplace_back(get<double>(p, end, ok)); break;
+                            case 'b': e.args.emplace_back(get<uint8_t>(p, end, ok) != 0); break;
+                            case 's': e.args.emplace_back(getString(p, end, ok)); break;
+                            default: ok = false;
+                        }
+                    }
+                    if (!ok) return false;
+                    lastTimeNs = e.timeNs;
+                    return true;
+                }
+                case BinaryLogFormat::DROPPED: {
+                    e.thread = get<uint32_t>(p, end, ok);
+                    e.dropped = get<uint64_t>(p, end, ok);
+                    e.site = 0;
+                    e.timeNs = lastTimeNs;
+                    e.args.clear();
+                    return ok;
+                }
+                default:
+                    break; // Unknown records of later versions are skipped
+            }
+            if (!ok) return false;
+        }
+        return false;
+    }
+
+    const Site* site(uint32_t id) const {
+        auto it = sites.find(id);
+        return it != sites.end() ? &it->second : nullptr;
+    }
+
+    std::string threadName(uint32_t thread) const {
+        auto it = threadNames.find(thread);
+        return it != threadNames.end() ? it->second : "#" + std::to_string(thread);
+    }
+
+    /**
+     * @brief The message of an event: its format string applied to its arguments
+     */
+    std::string format(const Event& e) const {
+        if (e.site == 0) return fmt::format("{} events dropped: the thread logged faster than they were written", e.dropped);
+        const Site* s = site(e.site);
+        if (s == nullptr) return fmt::format("<unknown site {}>", e.site);
+        fmt::dynamic_format_arg_store<fmt::format_context> store;
+        for (auto& a: e.args) std::visit([&](const auto& v) { store.push_back(v); }, a);
+        try {
+            return fmt::vformat(s->format, store);
+        } catch (const fmt::format_error& ex) {
+            return fmt::format("<{}> {}", ex.what(), s->format);
+        }
+    }
+
+    int64_t getStartTimeNs() const { return startTimeNs; }
+
+private:
+    template<class T>
+    static T get(const char*& p, const char* end, bool& ok){
+        T v{};
+        if (!ok || end - p < (std::ptrdiff_t) sizeof(T)) {
+            ok = false;
+            return v;
+        }
+        std::memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return v;
+    }
+
+    static std::string getString(const char*& p, const char* end, bool& ok){
+        auto length = get<uint32_t>(p, end, ok);
+        if (!ok || end - p < (std::ptrdiff_t) length) {
+            ok = false;
+            return "";
+        }
+        std::string s(p, length);
+        p += length;
+        return s;
+    }
+
+    FILE* file = nullptr;
+    int64_t fileSize = 0;
+    int64_t offset = 0;    // Bytes consumed by next(), without the cost of ftell() per record
+    std::string payload;
+    int64_t startTimeNs = 0;
+    int64_t lastTimeNs = 0;
+    std::unordered_map<uint32_t, Site> sites;
+    std::unordered_map<uint32_t, std::string> threadNames;
+};
+
+#endif //ISLAY_BINARYLOGREADER_H
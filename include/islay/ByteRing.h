@@ -0,0 +1,105 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_BYTERING_H
+#define ISLAY_BYTERING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+/**
+ * @brief Single-producer single-consumer ring of variable-length records, without lock
+ *
+ *   char* p = ring.reserve(n);   // Producer
+ *   if (p != nullptr) { ...write n bytes...; ring.commit(); }
+ *
+ *   ring.drain([](const char* p, uint32_t n){ ... });  // Consumer
+ *
+ * A record is a length prefix and the bytes, padded to 8 bytes. A record that does not fit before the
+ * end of the buffer is preceded by a WRAP prefix and written at the beginning, so records are contiguous.
+ */
+class ByteRing {
+public:
+    static constexpr uint32_t WRAP = 0xffffffffu;
+    static constexpr size_t PREFIX = 8;
+
+    /**
+     * @param _capacity Bytes, a power of two
+     */
+    explicit ByteRing(size_t _capacity) : capacity(_capacity), data(new char[_capacity]) {};
+
+    ByteRing(const ByteRing&) = delete;
+    ByteRing& operator=(const ByteRing&) = delete;
+
+    /// Largest record that fits
+    size_t maxRecord() const { return capacity / 2 - PREFIX; }
+
+    /**
+     * @brief Space for a record of length bytes, 8-byte aligned (producer). nullptr if the ring is full.
+     */
+    char* reserve(uint32_t length){
+        if (length > maxRecord()) return nullptr;
+        uint64_t need = align(PREFIX + length);
+        uint64_t h = head.load(std::memory_order_relaxed);
+        uint64_t pos = h & (capacity - 1);
+        uint64_t skip = need > capacity - pos ? capacity - pos : 0;
+        if (h + skip + need - tail.load(std::memory_order_acquire) > capacity) return nullptr;
+        if (skip != 0) {
+            std::memcpy(&data[pos], &WRAP, sizeof(WRAP));
+            h += skip;
+            pos = 0;
+        }
+        std::memcpy(&data[pos], &length, sizeof(length));
+        reserved = h + need;
+        return &data[pos + PREFIX];
+    }
+
+    /**
+     * @brief Publish the record of the last reserve() to the consumer
+     */
+    void commit(){
+        head.store(reserved, std::memory_order_release);
+    }
+
+    /**
+     * @brief Call f(bytes, length) on the published records (consumer). The bytes are valid only during the call.
+     */
+    template<class F>
+    size_t drain(F&& f){
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        uint64_t h = head.load(std::memory_order_acquire);
+        size_t count = 0;
+        while (t < h) {
+            uint64_t pos = t & (capacity - 1);
+            uint32_t length;
+            std::memcpy(&length, &data[pos], sizeof(length));
+            if (length == WRAP) {
+                t += capacity - pos;
+                continue;
+            }
+            f((const char*) &data[pos + PREFIX], length);
+            t += align(PREFIX + length);
+            count++;
+        }
+        tail.store(t, std::memory_order_release);
+        return count;
+    }
+
+    bool empty() const {
+        return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+    }
+
+private:
+    static uint64_t align(uint64_t n){ return (n + 7) & ~(uint64_t) 7; }
+
+    const size_t capacity;
+    std::unique_ptr<char[]> data;
+    uint64_t reserved = 0; // Producer side
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+};
+
+#endif //ISLAY_BYTERING_H
@@ -5,7 +5,11 @@
 #ifndef ISLAY_CONFIG_H
 #define ISLAY_CONFIG_H
 
+#include <atomic>
 #include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <Eigen/Core>
 #include <rapidjson/document.h>
@@ -13,6 +17,14 @@
 #include <rapidjson/filewritestream.h>
 #include <rapidjson/prettywriter.h>
 
+#include "ConfigSnapshot.h"
+#include "Param.h"
+
+/**
+ * @brief Parameters of config_default.json, shared by all threads
+ *   The setters modify a private document and publish an immutable copy of it (read-copy-update):
+ *   readers take the current ConfigSnapshot with snapshot() and never see a half-updated document.
+ */
 class Config {
 private:
     Config() {
@@ -34,6 +46,7 @@ private:
         }
 
         createResultDirectory();
+        publish();
     };
 
     ~Config() = default;
@@ -65,7 +78,35 @@ private:
         config.AddMember("RESULT_DIRECTORY", rapidjson::Value(resultDirName.c_str(), config.GetAllocator()), config.GetAllocator());
     }
 
+    /**
+     * @brief Publish the document as a new snapshot and update the Param handles (writeMtx held)
+     */
+    void publish() {
+        auto next = std::make_shared<const ConfigSnapshot>(config, version.load(std::memory_order_relaxed) + 1);
+        std::atomic_store_explicit(&current, next, std::memory_order_release);
+        version.store(next->getVersion(), std::memory_order_release);
+        refreshParams(next->getDocument());
+    }
+
+    /**
+     * @brief Update the handles of all the parameters from a snapshot document
+     */
+    void refreshParams(const rapidjson::Document& document) {
+        std::lock_guard<std::mutex> lock(paramMtx);
+        for (auto& [name, slot]: paramSlots) {
+            if (!document.HasMember(name.c_str()) || !slot->refresh(document[name.c_str()])) {
+                std::cerr << "Config parameter " << name << " is missing or changed type; its handles keep the last value" << std::endl;
+            }
+        }
+    }
+
+    std::mutex writeMtx; // Guards config, the document of the writers
     rapidjson::Document config;
+    std::shared_ptr<const ConfigSnapshot> current; // Accessed with std::atomic_load/atomic_store
+    std::atomic<unsigned long long> version{0};
+
+    std::mutex paramMtx; // Guards paramSlots
+    std::map<std::string, std::unique_ptr<ParamDetail::SlotBase>> paramSlots;
 
 public:
     Config(const Config &) = delete;
@@ -78,7 +119,18 @@ public:
         return instance;
     }
 
-    const rapidjson::Document &getDocument() const { return config; }
+    /**
+     * @brief The current parameters. Keep the shared_ptr while reading: e.g. take it once per iteration of a
+     *   worker to read parameters of the same version. See also ConfigSnapshotCache.
+     */
+    std::shared_ptr<const ConfigSnapshot> snapshot() const {
+        return std::atomic_load_explicit(&current, std::memory_order_acquire);
+    }
+
+    /// Version of the latest snapshot, incremented by each change
+    unsigned long long getVersion() const {
+        return version.load(std::memory_order_acquire);
+    }
 
     void saveConfig() {
         FILE *fp = fopen(( this->resultDirectory() + "/config.json").c_str(), "wb"); // non-Windows use "w"
@@ -86,7 +138,7 @@ public:
         char writeBuffer[65536];
         rapidjson::FileWriteStream os(fp, writeBuffer, sizeof(writeBuffer));
         rapidjson::PrettyWriter<rapidjson::FileWriteStream> writer(os);
-        config.Accept(writer);
+        snapshot()->getDocument().Accept(writer);
 
         fclose(fp);
     }
@@ -97,13 +149,14 @@ public:
         char writeBuffer[65536];
         rapidjson::FileWriteStream os(fp, writeBuffer, sizeof(writeBuffer));
         rapidjson::PrettyWriter<rapidjson::FileWriteStream> writer(os);
-        config.Accept(writer);
+        snapshot()->getDocument().Accept(writer);
 
         fclose(fp);
     }
 
     void loadConfig(std::string configFileName) {
         {
+            std::lock_guard<std::mutex> lock(writeMtx);
             FILE *fp;
             char buf[512];
 
@@ -116,6 +169,7 @@ public:
             config.ParseStream<rapidjson::ParseFlag::kParseCommentsFlag>(rs);
 
             fclose(fp);
+            publish();
         };
 
         saveConfig();
@@ -124,80 +178,142 @@ public:
     std::string showConfig() {
         rapidjson::StringBuffer buffer;
         rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
-        config.Accept(writer);
+        snapshot()->getDocument().Accept(writer);
         return std::string(buffer.GetString());
     }
 
     std::string resultDirectory(){
-        return std::string(config["RESULT_DIRECTORY"].GetString());
+        return snapshot()->readStringParam("RESULT_DIRECTORY");
     }
 
     std::string resourceDirectory(){
-        return std::string(config["RESOURCE_DIRECTORY"].GetString());
+        return snapshot()->readStringParam("RESOURCE_DIRECTORY");
     }
 
+    /**
+     * @brief Typed handle of a parameter (int, double, bool or std::string)
+     *   Bind it once, e.g. before the loop of a worker: reading a handle costs an atomic load, not a name lookup,
+     *   and is safe while the GUI sets the parameter.
+     * @return An unbound handle, which reads T{}, if the parameter is missing or of another type
+     */
+    template<class T>
+    Param<T> param(const std::string& paramName) {
+        std::lock_guard<std::mutex> lock(paramMtx);
+        // Taken under paramMtx: publish() stores a snapshot before its refreshParams() waits for the lock,
+        // so a change published meanwhile refreshes the new slot after it is inserted
+        auto snap = snapshot();
+        auto it = paramSlots.find(paramName);
+        if (it == paramSlots.end()) {
+            auto slot = std::make_unique<ParamDetail::Slot<T>>(paramName);
+            const rapidjson::Document& document = snap->getDocument();
+            if (!document.HasMember(paramName.c_str()) || !slot->refresh(document[paramName.c_str()])) {
+                std::cerr << "Invalid config parameter: " << paramName << std::endl;
+                return Param<T>();
+            }
+            it = paramSlots.emplace(paramName, std::move(slot)).first;
+        }
+        auto slot = dynamic_cast<const ParamDetail::Slot<T>*>(it->second.get());
+        if (slot == nullptr) {
+            std::cerr << "Config parameter " << paramName << " is bound with another type" << std::endl;
+        }
+        return Param<T>(slot);
+    }
+
+    /**
+     * @brief Read a parameter of the current snapshot. To read several parameters of the same version, read them
+     *   from one snapshot() instead.
+     */
     double readDoubleParam(std::string paramName) const {
-        return config[paramName.c_str()].GetDouble();
+        return snapshot()->readDoubleParam(paramName);
     }
 
     int readIntParam(std::string paramName) const {
-        return config[paramName.c_str()].GetInt();
+        return snapshot()->readIntParam(paramName);
     }
 
     std::string readStringParam(std::string paramName) const {
-        return std::string(config[paramName.c_str()].GetString());
+        return snapshot()->readStringParam(paramName);
     }
 
     bool readBoolParam(std::string paramName) const {
-        return config[paramName.c_str()].GetBool();
+        return snapshot()->readBoolParam(paramName);
     }
 
     Eigen::VectorXd readVectorParam(std::string paramName) const {
-        auto array = config[paramName.c_str()].GetArray();
-        int num = array.Size();
-
-        Eigen::VectorXd vector(num);
-        for (int i = 0; i < num; i++) {
-            vector(i) = array[i].GetDouble();
-        }
-        return vector;
+        return snapshot()->readVectorParam(paramName);
     }
 
     Eigen::MatrixXd readMatrixParam(std::string paramName) const {
-        auto array = config[paramName.c_str()].GetArray();
-
-        Eigen::MatrixXd matrix;
-        if(array[0].IsArray()) { // [Row x COl] or [Row x 1]
-            matrix = Eigen::MatrixXd(array.Size(),array[0].Size());
-        } else { // [1 x Col] or [1 x 1]
-            matrix = Eigen::MatrixXd(1, array.Size());
-        }
-
-        std::cout << matrix.rows() << "x" << matrix.cols() << std::endl;
-
-        return matrix;
+        return snapshot()->readMatrixParam(paramName);
     }
 
-    bool setStringParam(std::string paramName, std::string paramToSet) {
-        if (config[paramName.c_str()].IsString()) {
-            config[paramName.c_str()].SetString(paramToSet.c_str(), paramToSet.length(), config.GetAllocator());
-            return true;
-        } else {
+    /**
+     * @brief Set a parameter to a JSON value of the same kind (int, double, bool or string) and publish the change
+     *   Thread safe: the workers see the new value from their next snapshot() or Param read.
+     */
+    bool setParam(std::string paramName, const rapidjson::Value &paramToSet) {
+        std::lock_guard<std::mutex> lock(writeMtx);
+        auto member = config.FindMember(paramName.c_str());
+        if (member == config.MemberEnd()) {
             std::cerr << "Invalid config parameter setting" << std::endl;
             return false;
-        };
-    }
-
-    bool setDoubleParam(std::string paramName, double paramToSet) {
-        if (config[paramName.c_str()].IsDouble()) {
-            config[paramName.c_str()].SetDouble(paramToSet);
-            return true;
+        }
+        rapidjson::Value &value = member->value;
+        if (value.IsInt() && paramToSet.IsInt()) {
+            value.SetInt(paramToSet.GetInt());
+        } else if (value.IsDouble() && paramToSet.IsNumber()) {
+            value.SetDouble(paramToSet.GetDouble());
+        } else if (value.IsBool() && paramToSet.IsBool()) {
+            value.SetBool(paramToSet.GetBool());
+        } else if (value.IsString() && paramToSet.IsString()) {
+            value.SetString(paramToSet.GetString(), paramToSet.GetStringLength(), config.GetAllocator());
         } else {
             std::cerr << "Invalid config parameter setting" << std::endl;
             return false;
         }
+        publish();
+        return true;
+    }
+
+    bool setStringParam(std::string paramName, std::string paramToSet) {
+        return setParam(paramName, rapidjson::Value(rapidjson::StringRef(paramToSet.c_str(), paramToSet.length())));
+    }
+
+    bool setDoubleParam(std::string paramName, double paramToSet) {
+        return setParam(paramName, rapidjson::Value(paramToSet));
+    }
+
+    bool setIntParam(std::string paramName, int paramToSet) {
+        return setParam(paramName, rapidjson::Value(paramToSet));
+    }
+
+    bool setBoolParam(std::string paramName, bool paramToSet) {
+        return setParam(paramName, rapidjson::Value(paramToSet));
     }
 };
 
+/**
+ * @brief Latest snapshot of Config for a worker, reloaded only when a change was published
+ *
+ *   ConfigSnapshotCache config;                     // Member of the worker
+ *   while (...) {
+ *       const ConfigSnapshot &c = config.update();  // Once per iteration
+ *       double threshold = c.readDoubleParam("THRESHOLD");
+ *   }
+ *
+ * update() costs an atomic load while the version does not change. The snapshot it returns stays valid
+ * until the next update().
+ */
+class ConfigSnapshotCache {
+public:
+    const ConfigSnapshot &update() {
+        auto &config = Config::get_instance();
+        if (!cached || cached->getVersion() != config.getVersion()) cached = config.snapshot();
+        return *cached;
+    }
+
+private:
+    std::shared_ptr<const ConfigSnapshot> cached;
+};
 
 #endif //ISLAY_CONFIG_H
@@ -0,0 +1,83 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_CONFIGSNAPSHOT_H
+#define ISLAY_CONFIGSNAPSHOT_H
+
+#include <iostream>
+#include <string>
+#include <Eigen/Core>
+#include <rapidjson/document.h>
+
+/**
+ * @brief Immutable copy of the config document, published by Config on each change
+ *   A snapshot is never modified, so any thread can read it without lock while it holds the shared_ptr
+ *   from Config::snapshot(). All the parameters of a snapshot come from the same version.
+ */
+class ConfigSnapshot {
+public:
+    ConfigSnapshot(const rapidjson::Document& source, unsigned long long _version) : version(_version) {
+        document.CopyFrom(source, document.GetAllocator());
+    };
+
+    ConfigSnapshot(const ConfigSnapshot&) = delete;
+    ConfigSnapshot& operator=(const ConfigSnapshot&) = delete;
+
+    const rapidjson::Document& getDocument() const { return document; }
+
+    /// Incremented by each change of Config
+    unsigned long long getVersion() const { return version; }
+
+    bool hasParam(const std::string& paramName) const {
+        return document.HasMember(paramName.c_str());
+    }
+
+    double readDoubleParam(const std::string& paramName) const {
+        return document[paramName.c_str()].GetDouble();
+    }
+
+    int readIntParam(const std::string& paramName) const {
+        return document[paramName.c_str()].GetInt();
+    }
+
+    std::string readStringParam(const std::string& paramName) const {
+        return std::string(document[paramName.c_str()].GetString());
+    }
+
+    bool readBoolParam(const std::string& paramName) const {
+        return document[paramName.c_str()].GetBool();
+    }
+
+    Eigen::VectorXd readVectorParam(const std::string& paramName) const {
+        auto array = document[paramName.c_str()].GetArray();
+        int num = array.Size();
+
+        Eigen::VectorXd vector(num);
+        for (int i = 0; i < num; i++) {
+            vector(i) = array[i].GetDouble();
+        }
+        return vector;
+    }
+
+    Eigen::MatrixXd readMatrixParam(const std::string& paramName) const {
+        auto array = document[paramName.c_str()].GetArray();
+
+        Eigen::MatrixXd matrix;
+        if(array[0].IsArray()) { // [Row x COl] or [Row x 1]
+            matrix = Eigen::MatrixXd(array.Size(),array[0].Size());
+        } else { // [1 x Col] or [1 x 1]
+            matrix = Eigen::MatrixXd(1, array.Size());
+        }
+
+        std::cout << matrix.rows() << "x" << matrix.cols() << std::endl;
+
+        return matrix;
+    }
+
+private:
+    rapidjson::Document document;
+    const unsigned long long version;
+};
+
+#endif //ISLAY_CONFIGSNAPSHOT_H
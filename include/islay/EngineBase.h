@@ -5,23 +5,46 @@
 #ifndef ISLAY_ENGINEBASE_H
 #define ISLAY_ENGINEBASE_H
 
+#include <algorithm>
+
 #include "AppMsg.h"
 #include "Worker.h"
+#include "Pipeline.h"
 
 class EngineBase {
 protected:
     std::map<std::string, std::shared_ptr<WorkerManager>> workers;
     AppMsgPtr appMsg;
     std::shared_ptr<PUBinder> puBinder;
+    std::shared_ptr<WorkerThreadPool> threadPool;
+    std::shared_ptr<TaskScheduler> taskScheduler;
+
+    /**
+     * @brief Connection between an output port and an input port of pipeline stages
+     */
+    struct PipelineEdge {
+        std::string fromStage, fromPort, toStage, toPort;
+        size_t capacity;
+        OVERFLOW_POLICY policy;
+    };
+    std::vector<PipelineEdge> pipelineEdges;
+    std::vector<std::string> pipelineStages;
 
 public:
-    EngineBase (AppMsgPtr _appMsg): appMsg(std::move(_appMsg)),
-                                    puBinder(std::make_shared<PUBinder>())
+    /**
+     * @param taskSchedulerThreads Threads of the TaskScheduler. Each binds a PU on the first parallel_for/spawn
+     *   and keeps it until the engine is destroyed, so runWorkerWithCpuBinding() has only the other PUs.
+     *   0: half of the PUs.
+     */
+    EngineBase (AppMsgPtr _appMsg, unsigned int taskSchedulerThreads = 0): appMsg(std::move(_appMsg)),
+                                    puBinder(std::make_shared<PUBinder>()),
+                                    threadPool(std::make_shared<WorkerThreadPool>(puBinder)),
+                                    taskScheduler(std::make_shared<TaskScheduler>(puBinder, taskSchedulerThreads))
     {
     };
 
     virtual ~EngineBase(){
-        workers.clear();
+        workers.clear(); // Waits for running workers before the thread pool is destroyed
     };
 
     virtual bool run() = 0;
@@ -46,7 +69,7 @@ public:
             SPDLOG_WARN("Worker already exists.");
             return true;
         }
-        auto wm = WorkerManager::createWorkerManager<T>(name, puBinder, appMsg);
+        auto wm = WorkerManager::createWorkerManager<T>(name, puBinder, threadPool, taskScheduler, appMsg);
         auto [t, b] = workers.try_emplace(name, wm);
         return b;
     };
@@ -76,7 +99,6 @@ public:
             SPDLOG_WARN("Worker not found: {}", name);
             return false;
         }
-        workers.at(name)->status.store(WORKER_STATUS::IDLE);
         return workers.at(name)->reset();
     }
 
@@ -107,7 +129,9 @@ public:
 
         // Delete worker if idle
         if( getWorkerStatus(name) == WORKER_STATUS::IDLE) {
+            removeFromPipeline(name);
             workers.erase(workers.find(name));
+            threadPool->release(name); // Release the PU binding kept for the worker
             SPDLOG_INFO("Worker deleted: {}", name);
         }
 
@@ -123,13 +147,179 @@ public:
         return true;
     }
 
+    /**
+     * Pipeline
+     *   Stages (see Stage) are workers connected through typed ports:
+     *     addStage<Capture>("capture");
+     *     addStage<Undistort>("undistort");
+     *     connect("capture.out", "undistort.in", 4);
+     *     runPipeline();
+     *   Each connection is a bounded QueueMessenger. With OVERFLOW_POLICY::BLOCK a stage is throttled by
+     *   its slowest consumer (backpressure); with the drop policies it keeps running and drops frames.
+     */
+    template <class T>
+    bool addStage(std::string name){
+        static_assert(std::is_base_of<Stage, T>::value, "A stage must inherit Stage");
+        if(!registerWorker<T>(name)) return false;
+        if(std::find(pipelineStages.begin(), pipelineStages.end(), name) == pipelineStages.end())
+            pipelineStages.emplace_back(name);
+        return true;
+    }
+
+    /**
+     * @brief Connect an output port to an input port
+     * @param from "stage.port" of the output
+     * @param to "stage.port" of the input
+     * @param capacity Capacity of the queue of the input port
+     * @param policy Behavior when the queue is full
+     */
+    bool connect(const std::string& from, const std::string& to, size_t capacity = 4,
+                 OVERFLOW_POLICY policy = OVERFLOW_POLICY::BLOCK){
+        PipelineEdge edge{"", "", "", "", capacity, policy};
+        if(!splitPortName(from, edge.fromStage, edge.fromPort) || !splitPortName(to, edge.toStage, edge.toPort)){
+            SPDLOG_WARN("Port must be specified as stage.port: {} -> {}", from, to);
+            return false;
+        }
+        auto out = findPort(edge.fromStage, edge.fromPort, false);
+        auto in = findPort(edge.toStage, edge.toPort, true);
+        if(out == nullptr || in == nullptr){
+            SPDLOG_WARN("Port not found: {} -> {}", from, to);
+            return false;
+        }
+        if(out->getType() != in->getType()){
+            SPDLOG_WARN("Port type mismatch: {} ({}) -> {} ({})", from, out->getType().name(), to, in->getType().name());
+            return false;
+        }
+        pipelineEdges.emplace_back(std::move(edge));
+        return true;
+    }
+
+    /**
+     * @brief Run all the stages concurrently
+     *   Queues are created afresh for each run, so a pipeline can be run again once all its stages are idle.
+     */
+    bool runPipeline(bool cpuBind = false){
+        for(auto& name: pipelineStages){
+            if(getWorkerStatus(name) != WORKER_STATUS::IDLE){
+                SPDLOG_WARN("Stage is still running: {}", name);
+                return false;
+            }
+        }
+        for(auto& name: pipelineStages){
+            if(auto stage = getStage(name)) stage->detachOutputs();
+        }
+        for(auto& e: pipelineEdges){
+            auto in = findPort(e.toStage, e.toPort, true);
+            if(in) in->open(e.capacity, e.policy);
+        }
+        for(auto& e: pipelineEdges){
+            auto out = findPort(e.fromStage, e.fromPort, false);
+            auto in = findPort(e.toStage, e.toPort, true);
+            if(out && in) out->attach(in);
+        }
+        bool ok = true;
+        for(auto& name: pipelineStages){
+            ok &= cpuBind ? runWorkerWithCpuBinding(name) : runWorker(name);
+        }
+        return ok;
+    }
+
+    /**
+     * @brief Request all the stages to terminate
+     *   Closing the inputs releases the stages blocked on their ports.
+     */
+    bool terminatePipeline(){
+        for(auto& name: pipelineStages){
+            if(!isWorkerExist(name)) continue;
+            workers.at(name)->terminate();
+            if(auto stage = getStage(name)) stage->closeInputs();
+        }
+        return true;
+    }
+
+    std::map<std::string, StageStats> getPipelineStats(){
+        std::map<std::string, StageStats> stats;
+        for(auto& name: pipelineStages){
+            if(auto stage = getStage(name)) stats.emplace(name, stage->getStats());
+        }
+        return stats;
+    }
+
+    std::vector<std::string> getPipelineStages(){
+        return pipelineStages;
+    }
+
     /**
      * PU
      */
+    std::weak_ptr<PUBinder> getPUBinder(){
+        return puBinder;
+    }
+
     int getPuIfBinded(std::string workerName){
         return puBinder->getPuIfBinded(workerName);
     };
 
+    /**
+     * @brief PUs of the worker and its sub-threads binded by requestCpuBind
+     */
+    std::vector<unsigned int> getPusIfBinded(const std::string& workerName){
+        return puBinder->getPusOwnedBy(workerName);
+    }
+
+    /**
+     * @brief Placement policy of cpu-binded workers. See PLACEMENT_POLICY.
+     */
+    bool setPlacementPolicy(PLACEMENT_POLICY policy){
+        puBinder->setDefaultPolicy(policy);
+        return true;
+    }
+
+    /**
+     * @brief Placement policy of a worker (or a thread binded with requestCpuBind)
+     *   e.g. keep a consumer on the L3 cache of its producer:
+     *     setWorkerPlacement("consumer", PLACEMENT_POLICY::NEAR_PEER, "producer");
+     */
+    bool setWorkerPlacement(const std::string& name, PLACEMENT_POLICY policy, const std::string& peer = ""){
+        puBinder->setPlacement(name, policy, peer);
+        return true;
+    }
+
+    /**
+     * @brief Bind the memory of cpu-binded workers to the NUMA node of their PU
+     */
+    bool setMemoryBinding(bool enable){
+        puBinder->setMemoryBinding(enable);
+        return true;
+    }
+
+private:
+    static bool splitPortName(const std::string& portName, std::string& stage, std::string& port){
+        auto dot = portName.rfind('.');
+        if(dot == std::string::npos || dot == 0 || dot + 1 == portName.size()) return false;
+        stage = portName.substr(0, dot);
+        port = portName.substr(dot + 1);
+        return true;
+    }
+
+    std::shared_ptr<Stage> getStage(const std::string& name){
+        if(!isWorkerExist(name)) return nullptr;
+        return std::dynamic_pointer_cast<Stage>(workers.at(name)->t);
+    }
+
+    PortBase* findPort(const std::string& stageName, const std::string& portName, bool input){
+        auto stage = getStage(stageName);
+        if(!stage) return nullptr;
+        return input ? stage->findInput(portName) : stage->findOutput(portName);
+    }
+
+    void removeFromPipeline(const std::string& name){
+        pipelineStages.erase(std::remove(pipelineStages.begin(), pipelineStages.end(), name), pipelineStages.end());
+        pipelineEdges.erase(std::remove_if(pipelineEdges.begin(), pipelineEdges.end(), [&](const PipelineEdge& e){
+            return e.fromStage == name || e.toStage == name;
+        }), pipelineEdges.end());
+    }
+
 };
 
 #endif //ISLAY_ENGINEBASE_H
@@ -0,0 +1,178 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_FRAMEPOOL_H
+#define ISLAY_FRAMEPOOL_H
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief Pool of recycled cv::Mat buffers
+ *   A cv::Mat acquired from the pool is an ordinary refcounted cv::Mat whose allocator is the pool.
+ *   When the last cv::Mat referring to the buffer is released (e.g. the GUI drops the message),
+ *   the buffer goes back to the pool instead of being freed, and is handed out again by the next
+ *   acquire() of the same byte size. In steady-state streaming no heap allocation happens.
+ *
+ *   Usage (in a worker):
+ *     cv::Mat frame = FramePool::get_instance().acquire(lena.size(), lena.type());
+ *     cv::GaussianBlur(lena, frame, cv::Size(k, k), 10); // written in place, no reallocation
+ *     msg->img = frame;                                   // handed over without copy
+ *
+ *   Do not write into a frame after it has been sent; acquire a new one for the next frame instead.
+ */
+class FramePool : public cv::MatAllocator {
+private:
+    FramePool() : allocatedCount(0), reusedCount(0) {};
+    ~FramePool() override {
+        trim();
+    };
+
+public:
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+    FramePool(FramePool&&) = delete;
+    FramePool& operator=(FramePool&&) = delete;
+
+    static FramePool& get_instance()
+    {
+        // Never destroyed: a cv::Mat drawn from the pool may still be alive during static destruction.
+        static FramePool* instance = new FramePool();
+        return *instance;
+    }
+
+    /**
+     * @brief Returns a cv::Mat whose buffer is drawn from the pool. Its content is undefined.
+     */
+    cv::Mat acquire(int rows, int cols, int type) {
+        cv::Mat frame;
+        frame.allocator = this;
+        frame.create(rows, cols, type);
+        return frame;
+    }
+
+    cv::Mat acquire(cv::Size size, int type) {
+        return acquire(size.height, size.width, type);
+    }
+
+    /**
+     * @brief Free all buffers currently unused
+     */
+    void trim() {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& [bytes, bucket]: buckets) {
+            for (auto u: bucket) {
+                cv::fastFree(u->origdata);
+                delete u;
+            }
+            bucket.clear();
+        }
+    }
+
+    /// Number of buffers newly allocated from the heap
+    size_t getAllocatedCount() const { return allocatedCount.load(); }
+
+    /// Number of buffers handed out again from the pool
+    size_t getReusedCount() const { return reusedCount.load(); }
+
+    /// Number of buffers waiting in the pool
+    size_t getFreeCount() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        size_t n = 0;
+        for (const auto& [bytes, bucket]: buckets) n += bucket.size();
+        return n;
+    }
+
+    /**
+     * cv::MatAllocator interface
+     */
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data0, size_t* step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override {
+        size_t total = CV_ELEM_SIZE(type);
+        for (int i = dims - 1; i >= 0; i--) {
+            if (step) {
+                if (data0 && step[i] != CV_AUTOSTEP) {
+                    CV_Assert(total <= step[i]);
+                    total = step[i];
+                } else {
+                    step[i] = total;
+                }
+            }
+            total *= sizes[i];
+        }
+
+        if (data0) { // Wrapping user data: nothing to pool
+            cv::UMatData* u = new cv::UMatData(this);
+            u->data = u->origdata = (uchar*) data0;
+            u->size = total;
+            u->flags |= cv::UMatData::USER_ALLOCATED;
+            return u;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = buckets.find(total);
+            if (it != buckets.end() && !it->second.empty()) {
+                cv::UMatData* u = it->second.back();
+                it->second.pop_back();
+                reusedCount++;
+                return u;
+            }
+        }
+
+        cv::UMatData* u = new cv::UMatData(this);
+        u->data = u->origdata = (uchar*) cv::fastMalloc(total);
+        u->size = total;
+        allocatedCount++;
+        return u;
+    }
+
+    bool allocate(cv::UMatData* u, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override {
+        return u != nullptr;
+    }
+
+    void deallocate(cv::UMatData* u) const override {
+        if (!u) return;
+        CV_Assert(u->urefcount == 0);
+        CV_Assert(u->refcount == 0);
+        if (u->flags & cv::UMatData::USER_ALLOCATED) {
+            delete u;
+            return;
+        }
+
+        // Reset the bookkeeping of the buffer in place so that it can be reused as is
+        uchar* data = u->origdata;
+        size_t size = u->size;
+        u->~UMatData();
+        new (u) cv::UMatData(this);
+        u->data = u->origdata = data;
+        u->size = size;
+
+        std::unique_lock<std::mutex> lock(mtx);
+        auto& bucket = buckets[size];
+        if (bucket.capacity() == 0) bucket.reserve(MAX_FREE_PER_BUCKET);
+        if (bucket.size() < MAX_FREE_PER_BUCKET) {
+            bucket.push_back(u);
+            return;
+        }
+        lock.unlock();
+        cv::fastFree(data);
+        delete u;
+    }
+
+private:
+    static constexpr size_t MAX_FREE_PER_BUCKET = 32;
+
+    mutable std::mutex mtx;
+    mutable std::unordered_map<size_t, std::vector<cv::UMatData*>> buckets; // byte size -> free buffers
+    mutable std::atomic<size_t> allocatedCount;
+    mutable std::atomic<size_t> reusedCount;
+};
+
+#endif //ISLAY_FRAMEPOOL_H
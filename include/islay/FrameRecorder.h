@@ -0,0 +1,330 @@
+//
+// Created by Masahiro Hirano <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_FRAMERECORDER_H
+#define ISLAY_FRAMERECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <opencv2/opencv.hpp>
+
+#include "FramePool.h"
+#include "GlFunctions.h"
+#include "Logger.h"
+#include "PUBinder.h"
+#include "Profiler.h"
+#include "QueueMessenger.hpp"
+
+/**
+ * @brief Message of a window frame read back for recording or capture
+ */
+struct RecorderFrameMsg : public MsgData {
+    cv::Mat img;            // Bottom-up BGR, as read from GL
+    double timestamp = 0;   // Seconds on the steady clock when the frame was rendered
+    int session = 0;        // Recording session the frame belongs to. 0: not recorded
+    std::string capturePath;// Saved as a still image if not empty
+};
+
+/**
+ * @brief Window capture and recording off the GUI thread
+ *   readFrame() starts an asynchronous glReadPixels of the rendered frame into one of two pixel
+ *   buffer objects and collects the one started on the previous frame, by which time the GPU has
+ *   finished it. The pixels go through a bounded queue to an encoder thread (binded to a PU if one is
+ *   vacant), which flips and encodes them. When the queue is full, frames are dropped instead of
+ *   stalling the GUI.
+ *
+ *   Frames are timestamped when rendered and the encoder writes them at a constant frame rate,
+ *   repeating or skipping frames to follow the timestamps, so the video plays at the real speed
+ *   whatever the GUI frame rate.
+ *
+ *   Usage (GUI thread, with the GL context current):
+ *     recorder.startRecording(path);
+ *     ... render ...
+ *     recorder.readFrame(width, height); // Every frame, after rendering and before swapping
+ */
+class FrameRecorder {
+public:
+    explicit FrameRecorder(std::weak_ptr<PUBinder> _puBinder, size_t queueCapacity = 8)
+            : puBinder(std::move(_puBinder)), queue(queueCapacity, OVERFLOW_POLICY::DROP_NEWEST),
+              session(0), recording(false) {};
+
+    FrameRecorder(const FrameRecorder&) = delete;
+    FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+    ~FrameRecorder(){
+        stopRecording();
+        queue.close(); // The encoder drains the queue and exits
+        if (encoder.joinable()) encoder.join();
+#if !defined(IMGUI_IMPL_OPENGL_ES2)
+        if (pboSize > 0) {
+            const GlFunctions& gl = GlFunctions::get();
+            for (auto& slot: slots) {
+                if (slot.fence != nullptr) gl.deleteSync(slot.fence);
+                gl.deleteBuffers(1, &slot.pbo);
+            }
+        }
+#endif
+    }
+
+    /**
+     * @brief Start recording a video
+     * @param fps Frame rate of the video. Frames are repeated or skipped to match it.
+     */
+    bool startRecording(const std::string& path, double fps = 30.0, int fourcc = cv::VideoWriter::fourcc('H', '2', '6', '4')){
+        {
+            std::lock_guard<std::mutex> lock(sessionMtx);
+            sessionPath = path;
+            sessionFps = fps;
+            sessionFourcc = fourcc;
+        }
+        session.fetch_add(1);
+        recording.store(true);
+        startEncoder();
+        return true;
+    }
+
+    /**
+     * @brief Stop recording. The frames in flight are still encoded, then the video is closed.
+     */
+    void stopRecording(){
+        recording.store(false);
+    }
+
+    bool isRecording() const { return recording.load(); }
+
+    /**
+     * @brief Save the next frame as an image
+     */
+    void requestCapture(const std::string& path){
+        capturePath = path;
+        startEncoder();
+    }
+
+    /**
+     * @brief Number of frames dropped because the encoder did not keep up
+     */
+    unsigned long long getDropCount() const { return queue.getDropCount(); }
+
+    /**
+     * @brief Frames waiting for the encoder
+     */
+    size_t getQueuedCount() const { return queue.size(); }
+
+    /**
+     * @brief Read back the frame just rendered. Call every frame while recording or capturing.
+     */
+    void readFrame(int width, int height){
+        ISLAY_PROFILE_FUNCTION();
+        double now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        int recordingSession = recording.load() ? session.load() : 0;
+#if !defined(IMGUI_IMPL_OPENGL_ES2)
+        const GlFunctions& gl = GlFunctions::get();
+        if (gl.hasPbo()) {
+            collect(slots[(current + 1) % 2]); // Started on the previous frame
+            if (recordingSession == 0 && capturePath.empty()) return;
+            Slot& slot = slots[current];
+            current = (current + 1) % 2;
+            size_t bytes = (size_t) width * height * 3;
+            if (bytes > pboSize) allocate(bytes);
+            slot.width = width;
+            slot.height = height;
+            slot.timestamp = now;
+            slot.session = recordingSession;
+            slot.capturePath = std::move(capturePath);
+            capturePath.clear();
+            gl.bindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadBuffer(GL_BACK);
+            glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, nullptr); // Returns immediately
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            gl.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            if (gl.hasFence()) slot.fence = gl.fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            slot.pending = true;
+            return;
+        }
+#endif
+        // Synchronous fallback without pixel buffer objects
+        if (recordingSession == 0 && capturePath.empty()) return;
+        auto msg = queue.prepareMsg();
+        if (msg == nullptr) return;
+        msg->img = FramePool::get_instance().acquire(height, width, CV_8UC3);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadBuffer(GL_BACK);
+        glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, msg->img.data);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        msg->timestamp = now;
+        msg->session = recordingSession;
+        msg->capturePath = std::move(capturePath);
+        capturePath.clear();
+        queue.send(msg);
+    }
+
+private:
+#if !defined(IMGUI_IMPL_OPENGL_ES2)
+    struct Slot {
+        GLuint pbo = 0;
+        GLsync fence = nullptr;
+        bool pending = false;
+        int width = 0, height = 0;
+        double timestamp = 0;
+        int session = 0;
+        std::string capturePath;
+    };
+
+    void allocate(size_t bytes){
+        const GlFunctions& gl = GlFunctions::get();
+        for (auto& slot: slots) {
+            if (slot.pbo == 0) gl.genBuffers(1, &slot.pbo);
+            gl.bindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+            gl.bufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+        }
+        gl.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        pboSize = bytes;
+    }
+
+    /**
+     * Hand the pixels of a finished readback to the encoder
+     */
+    void collect(Slot& slot){
+        if (!slot.pending) return;
+        const GlFunctions& gl = GlFunctions::get();
+        slot.pending = false;
+        if (slot.fence != nullptr) {
+            gl.clientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000); // Done a frame ago in practice
+            gl.deleteSync(slot.fence);
+            slot.fence = nullptr;
+        }
+        auto msg = queue.prepareMsg();
+        if (msg == nullptr) {
+            // Encoder behind: drop the frame, but keep a capture request for the next frame
+            if (!slot.capturePath.empty() && capturePath.empty()) capturePath = std::move(slot.capturePath);
+            return;
+        }
+        size_t bytes = (size_t) slot.width * slot.height * 3;
+        msg->img = FramePool::get_instance().acquire(slot.height, slot.width, CV_8UC3);
+        gl.bindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        void* src = gl.mapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+        if (src != nullptr) {
+            std::memcpy(msg->img.data, src, bytes);
+            gl.unmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        gl.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        msg->timestamp = slot.timestamp;
+        msg->session = src != nullptr ? slot.session : 0;
+        msg->capturePath = src != nullptr ? std::move(slot.capturePath) : std::string();
+        slot.capturePath.clear();
+        queue.send(msg);
+    }
+#endif
+
+    void startEncoder(){
+        if (!encoder.joinable()) encoder = std::thread(&FrameRecorder::encode, this);
+    }
+
+    void encode(){
+        const std::string threadName = "FrameRecorder";
+#if WIN32
+        std::thread::native_handle_type self = GetCurrentThread();
+#else
+        std::thread::native_handle_type self = pthread_self();
+#endif
+        auto binder = puBinder.lock();
+        int pu = binder ? binder->bindThread(threadName, self, std::this_thread::get_id()) : -1;
+        if (binder && pu == -1)
+            SPDLOG_DEBUG("{} runs without CPU binding: no vacant PU", threadName);
+        binder.reset();
+        ISLAY_PROFILE_THREAD(threadName, pu);
+
+        cv::VideoWriter writer;
+        cv::Size writerSize;
+        int writerSession = 0;
+        double fps = 30.0, startTime = 0;
+        long long writtenCount = 0;
+        std::string path;
+        auto closeWriter = [&] {
+            if (!writer.isOpened()) return;
+            writer.release();
+            SPDLOG_INFO("Video recording end: {} ({} frames)", path, writtenCount);
+        };
+        while (true) {
+            auto msg = queue.waitReceive(std::chrono::milliseconds(100));
+            if (msg == nullptr) {
+                if (queue.isClosed()) break;
+                // Idle: the frames in flight of a stopped session have been encoded
+                if (writerSession != (recording.load() ? session.load() : 0)) closeWriter();
+                continue;
+            }
+
+            if (!msg->capturePath.empty()) {
+                cv::Mat img;
+                cv::flip(msg->img, img, 0);
+                cv::imwrite(msg->capturePath, img, std::vector<int>{cv::IMWRITE_PNG_COMPRESSION, 3});
+                SPDLOG_INFO("Window captured: {}", msg->capturePath);
+            }
+            if (msg->session != 0 && msg->session != writerSession && msg->session == session.load()) {
+                closeWriter();
+                int fourcc;
+                {
+                    std::lock_guard<std::mutex> lock(sessionMtx);
+                    path = sessionPath;
+                    fps = sessionFps;
+                    fourcc = sessionFourcc;
+                }
+                writerSize = msg->img.size();
+                writer.open(path, fourcc, fps, writerSize);
+                writerSession = msg->session;
+                startTime = msg->timestamp;
+                writtenCount = 0;
+                if (writer.isOpened()) SPDLOG_INFO("Video recording start: {}", path);
+                else SPDLOG_ERROR("Failed to open the video writer: {}", path);
+            }
+            if (writer.isOpened() && msg->session == writerSession) {
+                ISLAY_PROFILE_ZONE("encode");
+                // Write the frame into every slot of the constant frame rate up to its timestamp
+                long long target = std::llround((msg->timestamp - startTime) * fps);
+                if (writtenCount <= target) {
+                    cv::Mat img;
+                    cv::flip(msg->img, img, 0);
+                    if (img.size() != writerSize) cv::resize(img, img, writerSize); // Window resized
+                    while (writtenCount <= target) {
+                        writer << img;
+                        writtenCount++;
+                    }
+                }
+            }
+            msg->img.release(); // Back to the frame pool
+            queue.release(msg);
+        }
+        closeWriter();
+        if (auto b = puBinder.lock()) b->unbind(threadName);
+    }
+
+    std::weak_ptr<PUBinder> puBinder;
+    QueueMessenger<RecorderFrameMsg> queue;
+    std::thread encoder;
+
+    std::mutex sessionMtx;
+    std::string sessionPath;
+    double sessionFps = 30.0;
+    int sessionFourcc = 0;
+    std::atomic<int> session;     // Incremented by each startRecording()
+    std::atomic<bool> recording;
+
+    // GUI thread only
+    std::string capturePath;
+#if !defined(IMGUI_IMPL_OPENGL_ES2)
+    Slot slots[2];
+    int current = 0;
+    size_t pboSize = 0;
+#endif
+};
+
+#endif //ISLAY_FRAMERECORDER_H
@@ -0,0 +1,161 @@
+//
+// Created by Masahiro Hirano <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_GLFUNCTIONS_H
+#define ISLAY_GLFUNCTIONS_H
+
+#include <cstdio>
+
+#include <SDL.h>
+
+#if defined(IMGUI_IMPL_OPENGL_ES2)
+#include <SDL_opengles2.h>
+#else
+#include <SDL_opengl.h>
+#endif
+
+#if !defined(IMGUI_IMPL_OPENGL_ES2)
+/**
+ * @brief OpenGL entry points beyond GL 1.1, resolved at runtime through SDL
+ *   Pixel buffer objects need GL 2.1, fences GL 3.2 (or ARB_sync), persistent mapping GL 4.4
+ *   (or ARB_buffer_storage), shader passes GL 3.0 and swizzle GL 3.3 (or ARB_texture_swizzle).
+ *   A missing feature disables only what depends on it. Features are detected from the version of the
+ *   context actually created (glGetString(GL_VERSION)) and its extensions: an entry point resolved by
+ *   the window system (e.g. GLX) is not proof that the driver implements it.
+ */
+struct GlFunctions {
+    // Buffers
+    PFNGLGENBUFFERSPROC genBuffers = nullptr;
+    PFNGLDELETEBUFFERSPROC deleteBuffers = nullptr;
+    PFNGLBINDBUFFERPROC bindBuffer = nullptr;
+    PFNGLBUFFERDATAPROC bufferData = nullptr;
+    PFNGLMAPBUFFERRANGEPROC mapBufferRange = nullptr;
+    PFNGLUNMAPBUFFERPROC unmapBuffer = nullptr;
+    PFNGLBUFFERSTORAGEPROC bufferStorage = nullptr;
+    // Fences
+    PFNGLFENCESYNCPROC fenceSync = nullptr;
+    PFNGLCLIENTWAITSYNCPROC clientWaitSync = nullptr;
+    PFNGLDELETESYNCPROC deleteSync = nullptr;
+    // Shaders
+    PFNGLCREATESHADERPROC createShader = nullptr;
+    PFNGLSHADERSOURCEPROC shaderSource = nullptr;
+    PFNGLCOMPILESHADERPROC compileShader = nullptr;
+    PFNGLGETSHADERIVPROC getShaderiv = nullptr;
+    PFNGLGETSHADERINFOLOGPROC getShaderInfoLog = nullptr;
+    PFNGLDELETESHADERPROC deleteShader = nullptr;
+    PFNGLCREATEPROGRAMPROC createProgram = nullptr;
+    PFNGLATTACHSHADERPROC attachShader = nullptr;
+    PFNGLLINKPROGRAMPROC linkProgram = nullptr;
+    PFNGLGETPROGRAMIVPROC getProgramiv = nullptr;
+    PFNGLGETPROGRAMINFOLOGPROC getProgramInfoLog = nullptr;
+    PFNGLUSEPROGRAMPROC useProgram = nullptr;
+    PFNGLGETUNIFORMLOCATIONPROC getUniformLocation = nullptr;
+    PFNGLUNIFORM1IPROC uniform1i = nullptr;
+    PFNGLUNIFORM1FPROC uniform1f = nullptr;
+    PFNGLACTIVETEXTUREPROC activeTexture = nullptr;
+    // Framebuffers and vertex arrays
+    PFNGLGENFRAMEBUFFERSPROC genFramebuffers = nullptr;
+    PFNGLDELETEFRAMEBUFFERSPROC deleteFramebuffers = nullptr;
+    PFNGLBINDFRAMEBUFFERPROC bindFramebuffer = nullptr;
+    PFNGLFRAMEBUFFERTEXTURE2DPROC framebufferTexture2D = nullptr;
+    PFNGLCHECKFRAMEBUFFERSTATUSPROC checkFramebufferStatus = nullptr;
+    PFNGLGENVERTEXARRAYSPROC genVertexArrays = nullptr;
+    PFNGLDELETEVERTEXARRAYSPROC deleteVertexArrays = nullptr;
+    PFNGLBINDVERTEXARRAYPROC bindVertexArray = nullptr;
+
+    int majorVersion = 0, minorVersion = 0; // Of the current context
+    bool pbo = false;
+    bool fence = false;
+    bool persistentMapping = false;
+    bool shaders = false;
+    bool swizzle = false;
+
+    bool hasPbo() const {
+        return pbo && genBuffers && deleteBuffers && bindBuffer && bufferData && mapBufferRange && unmapBuffer;
+    }
+    bool hasFence() const { return fence && fenceSync && clientWaitSync && deleteSync; }
+    bool hasPersistentMapping() const { return persistentMapping && hasPbo() && hasFence() && bufferStorage; }
+    bool hasShaders() const {
+        return shaders &&
+               createShader && shaderSource && compileShader && getShaderiv && getShaderInfoLog && deleteShader &&
+               createProgram && attachShader && linkProgram && getProgramiv && getProgramInfoLog && useProgram &&
+               getUniformLocation && uniform1i && uniform1f && activeTexture &&
+               genFramebuffers && deleteFramebuffers && bindFramebuffer && framebufferTexture2D &&
+               checkFramebufferStatus && genVertexArrays && deleteVertexArrays && bindVertexArray;
+    }
+    bool hasSwizzle() const { return swizzle; }
+
+    /// Resolved once, with the GL context of the GUI thread current
+    static const GlFunctions& get(){
+        static GlFunctions gl = load();
+        return gl;
+    }
+
+private:
+    template<class F>
+    static void resolve(F& f, const char* name){ f = (F) SDL_GL_GetProcAddress(name); }
+
+    bool atLeast(int major, int minor) const {
+        return majorVersion > major || (majorVersion == major && minorVersion >= minor);
+    }
+
+    static GlFunctions load(){
+        GlFunctions gl;
+        // "4.6.0 NVIDIA 535.54", "3.3 (Core Profile) Mesa 23.0", ...
+        const char* version = (const char*) glGetString(GL_VERSION);
+        if (version == nullptr || std::sscanf(version, "%d.%d", &gl.majorVersion, &gl.minorVersion) != 2) {
+            gl.majorVersion = gl.minorVersion = 0;
+        }
+        gl.pbo = (gl.atLeast(3, 0) || SDL_GL_ExtensionSupported("GL_ARB_map_buffer_range")) &&
+                 (gl.atLeast(2, 1) || SDL_GL_ExtensionSupported("GL_ARB_pixel_buffer_object"));
+        gl.fence = gl.atLeast(3, 2) || SDL_GL_ExtensionSupported("GL_ARB_sync");
+        gl.persistentMapping = gl.atLeast(4, 4) || SDL_GL_ExtensionSupported("GL_ARB_buffer_storage");
+        gl.shaders = gl.atLeast(3, 0) ||
+                     (gl.atLeast(2, 0) && SDL_GL_ExtensionSupported("GL_ARB_framebuffer_object") &&
+                      SDL_GL_ExtensionSupported("GL_ARB_vertex_array_object"));
+        gl.swizzle = gl.atLeast(3, 3) ||
+                     SDL_GL_ExtensionSupported("GL_ARB_texture_swizzle") ||
+                     SDL_GL_ExtensionSupported("GL_EXT_texture_swizzle");
+
+        resolve(gl.genBuffers, "glGenBuffers");
+        resolve(gl.deleteBuffers, "glDeleteBuffers");
+        resolve(gl.bindBuffer, "glBindBuffer");
+        resolve(gl.bufferData, "glBufferData");
+        resolve(gl.mapBufferRange, "glMapBufferRange");
+        resolve(gl.unmapBuffer, "glUnmapBuffer");
+        if (gl.persistentMapping) resolve(gl.bufferStorage, "glBufferStorage");
+        resolve(gl.fenceSync, "glFenceSync");
+        resolve(gl.clientWaitSync, "glClientWaitSync");
+        resolve(gl.deleteSync, "glDeleteSync");
+
+        resolve(gl.createShader, "glCreateShader");
+        resolve(gl.shaderSource, "glShaderSource");
+        resolve(gl.compileShader, "glCompileShader");
+        resolve(gl.getShaderiv, "glGetShaderiv");
+        resolve(gl.getShaderInfoLog, "glGetShaderInfoLog");
+        resolve(gl.deleteShader, "glDeleteShader");
+        resolve(gl.createProgram, "glCreateProgram");
+        resolve(gl.attachShader, "glAttachShader");
+        resolve(gl.linkProgram, "glLinkProgram");
+        resolve(gl.getProgramiv, "glGetProgramiv");
+        resolve(gl.getProgramInfoLog, "glGetProgramInfoLog");
+        resolve(gl.useProgram, "glUseProgram");
+        resolve(gl.getUniformLocation, "glGetUniformLocation");
+        resolve(gl.uniform1i, "glUniform1i");
+        resolve(gl.uniform1f, "glUniform1f");
+        resolve(gl.activeTexture, "glActiveTexture");
+        resolve(gl.genFramebuffers, "glGenFramebuffers");
+        resolve(gl.deleteFramebuffers, "glDeleteFramebuffers");
+        resolve(gl.bindFramebuffer, "glBindFramebuffer");
+        resolve(gl.framebufferTexture2D, "glFramebufferTexture2D");
+        resolve(gl.checkFramebufferStatus, "glCheckFramebufferStatus");
+        resolve(gl.genVertexArrays, "glGenVertexArrays");
+        resolve(gl.deleteVertexArrays, "glDeleteVertexArrays");
+        resolve(gl.bindVertexArray, "glBindVertexArray");
+        return gl;
+    }
+};
+#endif
+
+#endif //ISLAY_GLFUNCTIONS_H
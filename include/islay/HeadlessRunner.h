@@ -0,0 +1,96 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_HEADLESSRUNNER_H
+#define ISLAY_HEADLESSRUNNER_H
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "ImageSink.h"
+#include "LatencyTracer.h"
+#include "../AppMsg.h"
+
+/**
+ * @brief Consumer of the AppMsg image channels in place of the GUI
+ *   Receives every channel of ocvImageMsgCollection (latest frame) and ocvImageQueueCollection
+ *   (every frame) and hands the images to an ImageSink. Sleeps on the channels while idle; channels
+ *   set up while running are picked up. The latency of each frame up to the sink is recorded in LatencyTracer.
+ */
+class HeadlessRunner {
+public:
+    HeadlessRunner(AppMsgPtr _appMsg, std::shared_ptr<ImageSink> _sink)
+            : appMsg(std::move(_appMsg)), sink(std::move(_sink)) {};
+
+    /**
+     * @brief Consume images until keepRunning() returns false, then drain what is left
+     */
+    void run(const std::function<bool()>& keepRunning){
+        MessengerRegistry<OcvImageMessenger>::Snapshot images;
+        MessengerRegistry<QueueMessenger<OcvImageMsg>>::Snapshot queues;
+        std::unique_ptr<MsgWaitSet> waitSet;
+        int idleWakeups = 0;
+        while (keepRunning()) {
+            auto currentImages = appMsg->ocvImageMsgCollection.snapshot();
+            auto currentQueues = appMsg->ocvImageQueueCollection.snapshot();
+            if (currentImages != images || currentQueues != queues || !waitSet) {
+                waitSet.reset(); // Detach from the channels before another set attaches
+                waitSet.reset(new MsgWaitSet);
+                for (auto& channel: *currentImages) waitSet->add(channel.second);
+                for (auto& channel: *currentQueues) waitSet->add(channel.second);
+                images = currentImages;
+                queues = currentQueues;
+            }
+            if (drain(*images, *queues)) {
+                idleWakeups = 0;
+            } else if (waitSet->wait(std::chrono::milliseconds(20)) && ++idleWakeups > 1) {
+                // Woken by a closed channel that has not left the registry yet
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        waitSet.reset();
+        drain(*appMsg->ocvImageMsgCollection.snapshot(), *appMsg->ocvImageQueueCollection.snapshot());
+        sink->close();
+    }
+
+    /**
+     * @brief Number of frames consumed from each channel
+     */
+    const std::map<std::string, unsigned long long>& getFrameCounts() const { return frameCounts; }
+
+private:
+    bool drain(const MessengerRegistry<OcvImageMessenger>::Map& images,
+               const MessengerRegistry<QueueMessenger<OcvImageMsg>>::Map& queues){
+        bool received = false;
+        for (auto& [name, messenger]: images) {
+            if (auto msg = messenger->receive()) {
+                sink->write(name, *msg, frameCounts[name]++);
+                LatencyTracer::get_instance().record(name, msg->getTimestamps());
+                received = true;
+            }
+            LatencyTracer::get_instance().setLostCount(name, messenger->getOverwrittenCount());
+        }
+        for (auto& [name, queue]: queues) {
+            while (auto msg = queue->receive()) {
+                sink->write(name, *msg, frameCounts[name]++);
+                LatencyTracer::get_instance().record(name, msg->getTimestamps());
+                msg->img.release(); // Back to the frame pool
+                queue->release(msg);
+                received = true;
+            }
+            LatencyTracer::get_instance().setLostCount(name, queue->getDropCount());
+        }
+        return received;
+    }
+
+    AppMsgPtr appMsg;
+    std::shared_ptr<ImageSink> sink;
+    std::map<std::string, unsigned long long> frameCounts;
+};
+
+#endif //ISLAY_HEADLESSRUNNER_H
@@ -0,0 +1,131 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_IMAGESINK_H
+#define ISLAY_IMAGESINK_H
+
+#include <cstdint>
+#include <filesystem>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+#include "Logger.h"
+#include "ShmImageChannel.h"
+#include "../AppMsg.h"
+
+/**
+ * @brief Destination of the images sent to AppMsg channels when there is no GUI
+ *   Called from a single thread (HeadlessRunner), so implementations need no locking.
+ */
+class ImageSink {
+public:
+    virtual ~ImageSink() = default;
+
+    /**
+     * @brief Consume a frame of a channel. The image is valid only during the call.
+     * @param frameIndex Number of the frame in the channel, from 0
+     */
+    virtual bool write(const std::string& channel, const OcvImageMsg& msg, unsigned long long frameIndex) = 0;
+
+    virtual void close() {};
+};
+
+/**
+ * @brief Discards the images. For benchmarking workers at full throughput.
+ */
+class NullImageSink : public ImageSink {
+public:
+    bool write(const std::string&, const OcvImageMsg& msg, unsigned long long) override {
+        bytes += msg.img.total() * msg.img.elemSize();
+        return true;
+    }
+
+    unsigned long long getBytes() const { return bytes; }
+
+private:
+    unsigned long long bytes = 0;
+};
+
+/**
+ * @brief Saves the images as files: <directory>/<channel>/<channel>_<frame>.<extension>
+ *   Images are saved as they are (no display mapping), so use an extension supporting their depth
+ *   (png for 8U/16U, tiff or exr for 32F).
+ */
+class DiskImageSink : public ImageSink {
+public:
+    /**
+     * @param _every Save every n-th frame of each channel
+     */
+    explicit DiskImageSink(std::string _directory, std::string _extension = "png", unsigned int _every = 1)
+            : directory(std::move(_directory)), extension(std::move(_extension)), every(std::max(1u, _every)) {};
+
+    bool write(const std::string& channel, const OcvImageMsg& msg, unsigned long long frameIndex) override {
+        if (frameIndex % every != 0 || msg.img.empty()) return true;
+        std::string name = sanitize(channel);
+        std::filesystem::path dir = std::filesystem::path(directory) / name;
+        if (createdDirectories.count(name) == 0) {
+            std::error_code ec;
+            std::filesystem::create_directories(dir, ec);
+            createdDirectories[name] = true;
+        }
+        std::ostringstream file;
+        file << name << "_" << std::setw(6) << std::setfill('0') << frameIndex << "." << extension;
+        if (!cv::imwrite((dir / file.str()).string(), msg.img)) {
+            SPDLOG_WARN("Failed to save an image of {}", channel);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static std::string sanitize(const std::string& s){
+        std::string r = s;
+        for (auto& c: r) {
+            if (!std::isalnum((unsigned char) c) && c != '_' && c != '-' && c != '.') c = '_';
+        }
+        return r;
+    }
+
+    std::string directory;
+    std::string extension;
+    unsigned int every;
+    std::map<std::string, bool> createdDirectories;
+};
+
+/**
+ * @brief Publishes the images of each channel to a shared memory ring "/islay_<channel>" (see ShmImageChannel.h)
+ *   so that viewers or recorders in other processes can attach to a headless run with ShmImageReader.
+ */
+class SharedMemoryImageSink : public ImageSink {
+public:
+    /**
+     * @param _slotCount Frames a reader may lag behind before it skips to the latest one
+     */
+    explicit SharedMemoryImageSink(uint32_t _slotCount = 4) : slotCount(_slotCount) {};
+
+    bool write(const std::string& channel, const OcvImageMsg& msg, unsigned long long) override {
+        if (msg.img.empty()) return true;
+        size_t bytes = msg.img.cols * msg.img.elemSize() * msg.img.rows;
+        auto& writer = writers[channel];
+        if (!writer) writer.reset(new ShmImageWriter);
+        if (writer->getSlotBytes() < bytes) {
+            // (Re)created for larger frames: attached readers see the old ring closed and reopen
+            if (!writer->open(channel, bytes, slotCount)) return false;
+        }
+        return writer->write(msg.img);
+    }
+
+    void close() override { writers.clear(); }
+
+private:
+    uint32_t slotCount;
+    std::map<std::string, std::unique_ptr<ShmImageWriter>> writers;
+};
+
+#endif //ISLAY_IMAGESINK_H
@@ -5,61 +5,288 @@
 #ifndef ISLAY_IMAGETEXTURE_H
 #define ISLAY_IMAGETEXTURE_H
 
+#include <cstring>
 #include <iostream>
 #include <string>
 
 #include <opencv2/opencv.hpp>
 
-#include <SDL.h>
+#include "GlFunctions.h"
+#include "Logger.h"
+#include "Profiler.h"
+#include "../AppMsg.h"
 
-#if defined(IMGUI_IMPL_OPENGL_ES2)
-#include <SDL_opengles2.h>
+#if !defined(IMGUI_IMPL_OPENGL_ES2)
+/**
+ * @brief Shader pass turning a single-channel texture into the displayed RGBA texture
+ *   Normalizes the values to [min, max], applies a color map and demosaics Bayer raw images,
+ *   so that no per-frame conversion runs on the CPU. Shared by all ImageTextures.
+ */
+class ImageMappingShader {
+    GLuint program = 0;
+    GLuint vao = 0;
+    GLint locSrc = -1, locScale = -1, locOffset = -1, locColormap = -1, locBayer = -1;
+    bool failed = false;
+
+public:
+    static ImageMappingShader& get_instance(){
+        static ImageMappingShader instance; // Lives as long as the GL context of the GUI thread
+        return instance;
+    }
+
+    /**
+     * @brief Render src (R8/R16/R32F) into the color attachment of the bound framebuffer
+     * @param scale, offset Normalization of the texture values: v * scale + offset
+     */
+    bool render(GLuint src, float scale, float offset, COLORMAP colormap, BAYER_PATTERN bayer){
+        const GlFunctions& gl = GlFunctions::get();
+        if (!build()) return false;
+        gl.useProgram(program);
+        gl.activeTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, src);
+        gl.uniform1i(locSrc, 0);
+        gl.uniform1f(locScale, scale);
+        gl.uniform1f(locOffset, offset);
+        gl.uniform1i(locColormap, (int) colormap);
+        gl.uniform1i(locBayer, (int) bayer);
+        gl.bindVertexArray(vao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        return true;
+    }
+
+private:
+    bool build(){
+        if (program != 0 || failed) return program != 0;
+        const GlFunctions& gl = GlFunctions::get();
+        if (!gl.hasShaders()) {
+            failed = true;
+            return false;
+        }
+#if defined(__APPLE__)
+        const char* version = "#version 150\n"; // Core profile 3.2
 #else
-#include <SDL_opengl.h>
+        const char* version = "#version 130\n";
+#endif
+        const char* vertexSrc =
+                "void main() {\n"
+                "    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n" // Full-screen triangle
+                "    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);\n"
+                "}\n";
+        const char* fragmentSrc =
+                "uniform sampler2D src;\n"
+                "uniform float scale;\n"
+                "uniform float offset;\n"
+                "uniform int colormap;\n" // 0: gray, 1: jet, 2: turbo
+                "uniform int bayer;\n"    // 0: none, 1: RGGB, 2: BGGR, 3: GRBG, 4: GBRG
+                "out vec4 fragColor;\n"
+                "float at(ivec2 p) {\n"
+                "    return texelFetch(src, clamp(p, ivec2(0), textureSize(src, 0) - 1), 0).r;\n"
+                "}\n"
+                "vec3 jet(float t) { return clamp(vec3(1.5) - abs(4.0 * t - vec3(3.0, 2.0, 1.0)), 0.0, 1.0); }\n"
+                "vec3 turbo(float t) {\n" // Polynomial approximation of the Turbo color map
+                "    const vec4 kr = vec4(0.13572138, 4.61539260, -42.66032258, 132.13108234);\n"
+                "    const vec4 kg = vec4(0.09140261, 2.19418839, 4.84296658, -14.18503333);\n"
+                "    const vec4 kb = vec4(0.10667330, 12.64194608, -60.58204836, 110.36276771);\n"
+                "    const vec2 kr2 = vec2(-152.94239396, 59.28637943);\n"
+                "    const vec2 kg2 = vec2(4.27729857, 2.82956604);\n"
+                "    const vec2 kb2 = vec2(-89.90310912, 27.34824973);\n"
+                "    vec4 v4 = vec4(1.0, t, t * t, t * t * t);\n"
+                "    vec2 v2 = v4.zw * v4.z;\n"
+                "    return clamp(vec3(dot(v4, kr) + dot(v2, kr2), dot(v4, kg) + dot(v2, kg2), dot(v4, kb) + dot(v2, kb2)), 0.0, 1.0);\n"
+                "}\n"
+                "vec3 demosaic(ivec2 p) {\n" // Bilinear
+                "    ivec2 red = bayer == 1 ? ivec2(0, 0) : bayer == 2 ? ivec2(1, 1) : bayer == 3 ? ivec2(1, 0) : ivec2(0, 1);\n"
+                "    ivec2 parity = p & 1;\n"
+                "    float c = at(p);\n"
+                "    float cross = (at(p + ivec2(-1, 0)) + at(p + ivec2(1, 0)) + at(p + ivec2(0, -1)) + at(p + ivec2(0, 1))) * 0.25;\n"
+                "    float diag = (at(p + ivec2(-1, -1)) + at(p + ivec2(1, -1)) + at(p + ivec2(-1, 1)) + at(p + ivec2(1, 1))) * 0.25;\n"
+                "    float horiz = (at(p + ivec2(-1, 0)) + at(p + ivec2(1, 0))) * 0.5;\n"
+                "    float vert = (at(p + ivec2(0, -1)) + at(p + ivec2(0, 1))) * 0.5;\n"
+                "    if (parity == red) return vec3(c, cross, diag);\n"
+                "    if (parity == ivec2(1) - red) return vec3(diag, cross, c);\n"
+                "    return parity.y == red.y ? vec3(horiz, c, vert) : vec3(vert, c, horiz);\n"
+                "}\n"
+                "void main() {\n"
+                "    ivec2 p = ivec2(gl_FragCoord.xy);\n" // Rows of the target and the source are in the same order
+                "    if (bayer != 0) {\n"
+                "        fragColor = vec4(clamp(demosaic(p) * scale + offset, 0.0, 1.0), 1.0);\n"
+                "        return;\n"
+                "    }\n"
+                "    float t = clamp(at(p) * scale + offset, 0.0, 1.0);\n"
+                "    fragColor = vec4(colormap == 1 ? jet(t) : colormap == 2 ? turbo(t) : vec3(t), 1.0);\n"
+                "}\n";
+
+        GLuint vs = compile(GL_VERTEX_SHADER, version, vertexSrc);
+        GLuint fs = compile(GL_FRAGMENT_SHADER, version, fragmentSrc);
+        if (vs != 0 && fs != 0) {
+            program = gl.createProgram();
+            gl.attachShader(program, vs);
+            gl.attachShader(program, fs);
+            gl.linkProgram(program);
+            GLint ok = GL_FALSE;
+            gl.getProgramiv(program, GL_LINK_STATUS, &ok);
+            if (ok != GL_TRUE) {
+                char log[1024];
+                gl.getProgramInfoLog(program, sizeof(log), nullptr, log);
+                SPDLOG_ERROR("Failed to link the image mapping shader: {}", log);
+                program = 0;
+            }
+        }
+        if (vs != 0) gl.deleteShader(vs);
+        if (fs != 0) gl.deleteShader(fs);
+        if (program == 0) {
+            failed = true;
+            return false;
+        }
+        locSrc = gl.getUniformLocation(program, "src");
+        locScale = gl.getUniformLocation(program, "scale");
+        locOffset = gl.getUniformLocation(program, "offset");
+        locColormap = gl.getUniformLocation(program, "colormap");
+        locBayer = gl.getUniformLocation(program, "bayer");
+        gl.genVertexArrays(1, &vao); // Core profiles draw nothing without a vertex array
+        return true;
+    }
+
+    static GLuint compile(GLenum type, const char* version, const char* src){
+        const GlFunctions& gl = GlFunctions::get();
+        GLuint shader = gl.createShader(type);
+        const char* sources[] = {version, src};
+        gl.shaderSource(shader, 2, sources, nullptr);
+        gl.compileShader(shader);
+        GLint ok = GL_FALSE;
+        gl.getShaderiv(shader, GL_COMPILE_STATUS, &ok);
+        if (ok != GL_TRUE) {
+            char log[1024];
+            gl.getShaderInfoLog(shader, sizeof(log), nullptr, log);
+            SPDLOG_ERROR("Failed to compile the image mapping shader: {}", log);
+            gl.deleteShader(shader);
+            return 0;
+        }
+        return shader;
+    }
+};
 #endif
 
 // Credit: https://github.com/ashitani/opencv_imgui_viewer
+/**
+ * @brief OpenGL texture showing a cv::Mat
+ *   The image is uploaded in its own format and never modified:
+ *   - CV_8UC3/CV_8UC4 (BGR/BGRA) are uploaded as is.
+ *   - Single-channel CV_8U/CV_16U/CV_32F are uploaded as R8/R16/R32F. Plain grayscale is shown through
+ *     a texture swizzle; value ranges, color maps and Bayer demosaicing are done by ImageMappingShader.
+ *   - Without those GL features (e.g. GL ES 2), single-channel images are converted on the CPU into
+ *     a scratch image.
+ *
+ *   In streaming mode (default), the texture storage is allocated once per size/format and each
+ *   frame is uploaded with glTexSubImage2D from a ring of pixel buffer objects: the GUI thread only
+ *   copies the frame into a mapped buffer and the transfer to the texture runs asynchronously.
+ *   Buffers are persistently mapped where available (GL 4.4), otherwise orphaned and mapped per frame.
+ *   A fence per buffer keeps a buffer from being overwritten while the GPU still reads it.
+ */
 class ImageTexture {
 private:
-    int width, height;
-    GLuint my_opengl_texture;
+    int width = 0, height = 0;  // Size of the texture
+    int frameWidth = 0, frameHeight = 0; // Size of the image shown
+    float magnification = 1.0;
+    GLuint my_opengl_texture;   // Texture the frames are uploaded to
+    GLuint displayTexture = 0;  // RGBA result of ImageMappingShader, if used
+    GLuint framebuffer = 0;
+    bool shown = false;         // Whether displayTexture is the one to show
+
+    // Storage currently allocated
+    GLint storageFormat = 0;
+    GLenum storageType = 0;
+    int displayWidth = 0, displayHeight = 0;
+    int swizzledFormat = 0;     // Storage format the gray swizzle was set for
+
+    cv::Mat scratch;            // CPU fallback only
+    cv::Mat downsampled;
+    int maxUploadWidth = 0, maxUploadHeight = 0;
+
+    bool streaming = true;
+
+#if !defined(IMGUI_IMPL_OPENGL_ES2)
+    static constexpr int RING_SIZE = 3;
+    struct PixelBuffer {
+        GLuint pbo = 0;
+        void* mapped = nullptr; // Persistently mapped pointer, if any
+        GLsync fence = nullptr; // Signaled when the GPU has consumed the buffer
+    };
+    PixelBuffer ring[RING_SIZE];
+    int ringIndex = 0;
+    size_t ringBytes = 0;     // Capacity of each buffer
+    bool ringPersistent = false;
+#endif
 
 public:
     ImageTexture(){
         glGenTextures(1, &my_opengl_texture);
     }
     ~ImageTexture(){
+        releaseRing();
+#if !defined(IMGUI_IMPL_OPENGL_ES2)
+        if (framebuffer != 0) GlFunctions::get().deleteFramebuffers(1, &framebuffer);
+#endif
         glBindTexture(GL_TEXTURE_2D, 0);  // unbind texture
         glDeleteTextures(1, &my_opengl_texture);
+        if (displayTexture != 0) glDeleteTextures(1, &displayTexture);
     };
 
-    void setImage(cv::Mat *pframe, float mag = 1.0){ // from cv::Mat (BGR)
+    ImageTexture(const ImageTexture&) = delete;
+    ImageTexture& operator=(const ImageTexture&) = delete;
 
-        if(!pframe->empty()) {
-            resize(*pframe, *pframe, cv::Size(), mag, mag, cv::INTER_NEAREST);
+    /**
+     * @brief Upload through the PBO ring (true) or synchronously from client memory (false)
+     */
+    void setStreaming(bool enable){
+        if (!enable) releaseRing();
+        streaming = enable;
+    }
 
-            width = pframe->cols;
-            height = pframe->rows;
+    bool isStreaming() const { return streaming; }
 
-            glBindTexture(GL_TEXTURE_2D, my_opengl_texture);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-            if (pframe->channels() == 3) { // Pretty ugly, costly implementation...
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR,
-                             GL_UNSIGNED_BYTE, (pframe->data));
-            } else if (pframe->channels() == 1 && pframe->depth() == CV_8U) {
-                cv::cvtColor(*pframe, *pframe, cv::COLOR_GRAY2BGR);
-                // Some enviromnent doesn't support GP_BGR
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR,
-                             GL_UNSIGNED_BYTE, (pframe->data));
-            } else if (pframe->channels() == 1 && pframe->depth() == CV_32F) {
-                cv::cvtColor(*pframe, *pframe, cv::COLOR_GRAY2BGR);
-                // Some enviromnent doesn't support GP_BGR
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR,
-                             GL_FLOAT, (pframe->data));
+    /**
+     * @brief Downsample images larger than the size they are displayed at, before uploading
+     *   Images are halved while they still cover the size, so the texture size only changes when the
+     *   display size crosses a power of two. Bayer images are never downsampled. 0 disables it.
+     */
+    void setMaxUploadSize(int w, int h){
+        maxUploadWidth = w;
+        maxUploadHeight = h;
+    }
+
+    /**
+     * @brief Show a cv::Mat. The image is not modified.
+     * @param mag Magnification of the size returned by getSize()
+     */
+    void setImage(const cv::Mat& image, const ImageDisplayMapping& mapping = ImageDisplayMapping(), float mag = 1.0){
+        ISLAY_PROFILE_ZONE("upload");
+        if (image.empty()) return;
+        magnification = mag;
+        frameWidth = image.cols;
+        frameHeight = image.rows;
+        const cv::Mat& frame = downsample(image, mapping);
+
+        glBindTexture(GL_TEXTURE_2D, my_opengl_texture);
+        if (frame.channels() == 3 && frame.depth() == CV_8U) {
+            upload(frame, GL_RGB, GL_BGR, GL_UNSIGNED_BYTE);
+            shown = false;
+        } else if (frame.channels() == 4 && frame.depth() == CV_8U) {
+            upload(frame, GL_RGBA, GL_BGRA, GL_UNSIGNED_BYTE);
+            shown = false;
+        } else if (frame.channels() == 1 &&
+                   (frame.depth() == CV_8U || frame.depth() == CV_16U || frame.depth() == CV_32F)) {
+            if (!setSingleChannelImage(frame, mapping)) {
+                mapToBgr(frame, mapping, scratch);
+                glBindTexture(GL_TEXTURE_2D, my_opengl_texture);
+                upload(scratch, GL_RGB, GL_BGR, GL_UNSIGNED_BYTE);
+                shown = false;
             }
         }
+    }
+
+    void setImage(cv::Mat *pframe, float mag = 1.0){ // from cv::Mat (BGR)
+        setImage(*pframe, ImageDisplayMapping(), mag);
     };
 
     void getOpenCVMat(); /// TODO: implement this. Get OpenCV Mat from OpenGL texture
@@ -70,10 +297,274 @@ public:
     };
 
     void* getOpenglTexture(){
-        return (void*)(intptr_t)my_opengl_texture;
+        return (void*)(intptr_t)(shown ? displayTexture : my_opengl_texture);
     };
 
-    ImVec2 getSize(){ return ImVec2(width, height); };
+    ImVec2 getSize(){ return ImVec2(frameWidth * magnification, frameHeight * magnification); };
+
+    /**
+     * @brief Map a single-channel image to BGR on the CPU: normalize, apply the color map or demosaic
+     */
+    static void mapToBgr(const cv::Mat& frame, const ImageDisplayMapping& mapping, cv::Mat& dst){
+        double typeRange = frame.depth() == CV_8U ? 255.0 : frame.depth() == CV_16U ? 65535.0 : 1.0;
+        double minValue = mapping.minValue, maxValue = mapping.maxValue;
+        if (mapping.autoRange) {
+            cv::minMaxLoc(frame, &minValue, &maxValue);
+        } else if (maxValue < minValue) {
+            minValue = 0;
+            maxValue = typeRange;
+        }
+        double scale = 255.0 / std::max(maxValue - minValue, 1e-12);
+        cv::Mat gray;
+        frame.convertTo(gray, CV_8U, scale, -minValue * scale);
+        if (mapping.bayer != BAYER_PATTERN::NONE) {
+            static const int codes[] = {0, cv::COLOR_BayerBG2BGR, cv::COLOR_BayerRG2BGR,
+                                        cv::COLOR_BayerGB2BGR, cv::COLOR_BayerGR2BGR};
+            cv::cvtColor(gray, dst, codes[(int) mapping.bayer]);
+        } else if (mapping.colormap != COLORMAP::GRAY) {
+            cv::applyColorMap(gray, dst, mapping.colormap == COLORMAP::JET ? cv::COLORMAP_JET : cv::COLORMAP_TURBO);
+        } else {
+            cv::cvtColor(gray, dst, cv::COLOR_GRAY2BGR);
+        }
+    }
+
+private:
+    const cv::Mat& downsample(const cv::Mat& image, const ImageDisplayMapping& mapping){
+        if (maxUploadWidth <= 0 || maxUploadHeight <= 0 || mapping.bayer != BAYER_PATTERN::NONE) return image;
+        int level = 0;
+        while ((image.cols >> (level + 1)) >= maxUploadWidth && (image.rows >> (level + 1)) >= maxUploadHeight) level++;
+        if (level == 0) return image;
+        cv::resize(image, downsampled, cv::Size(image.cols >> level, image.rows >> level), 0, 0, cv::INTER_AREA);
+        return downsampled;
+    }
+
+    /**
+     * Upload a single-channel image in its native format, then map it to colors on the GPU.
+     * Returns false if the GL features needed are missing.
+     */
+    bool setSingleChannelImage(const cv::Mat& frame, const ImageDisplayMapping& mapping){
+#if defined(IMGUI_IMPL_OPENGL_ES2)
+        return false;
+#else
+        const GlFunctions& gl = GlFunctions::get();
+        GLint internalFormat;
+        GLenum type;
+        double typeRange; // Value mapped to 1.0 by the normalized texture format
+        if (frame.depth() == CV_8U) {
+            internalFormat = GL_R8; type = GL_UNSIGNED_BYTE; typeRange = 255.0;
+        } else if (frame.depth() == CV_16U) {
+            internalFormat = GL_R16; type = GL_UNSIGNED_SHORT; typeRange = 65535.0;
+        } else {
+            internalFormat = GL_R32F; type = GL_FLOAT; typeRange = 1.0;
+        }
+
+        double minValue = mapping.minValue, maxValue = mapping.maxValue;
+        if (mapping.autoRange) {
+            cv::minMaxLoc(frame, &minValue, &maxValue);
+        } else if (maxValue < minValue) {
+            minValue = 0;
+            maxValue = typeRange;
+        }
+        bool identity = minValue == 0 && maxValue == typeRange && mapping.colormap == COLORMAP::GRAY &&
+                        mapping.bayer == BAYER_PATTERN::NONE;
+
+        if (identity && gl.hasSwizzle()) {
+            upload(frame, internalFormat, GL_RED, type);
+            if (swizzledFormat != internalFormat) {
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // Shown directly
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                const GLint gray[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+                glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, gray);
+                swizzledFormat = internalFormat;
+            }
+            shown = false;
+            return true;
+        }
+        if (!gl.hasShaders()) return false;
+
+        upload(frame, internalFormat, GL_RED, type);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // texelFetch only
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        if (!prepareDisplayTexture()) return false;
+
+        // Keep the state of the GUI rendering
+        GLint lastFramebuffer, lastProgram, lastVertexArray, lastViewport[4];
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &lastFramebuffer);
+        glGetIntegerv(GL_CURRENT_PROGRAM, &lastProgram);
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &lastVertexArray);
+        glGetIntegerv(GL_VIEWPORT, lastViewport);
+        GLboolean lastBlend = glIsEnabled(GL_BLEND), lastScissor = glIsEnabled(GL_SCISSOR_TEST);
+
+        gl.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, width, height);
+        glDisable(GL_BLEND);
+        glDisable(GL_SCISSOR_TEST);
+        double span = std::max(maxValue - minValue, 1e-12) / typeRange;
+        bool rendered = ImageMappingShader::get_instance().render(
+                my_opengl_texture, (float) (1.0 / span), (float) (-minValue / typeRange / span),
+                mapping.colormap, mapping.bayer);
+
+        gl.bindFramebuffer(GL_FRAMEBUFFER, lastFramebuffer);
+        gl.useProgram(lastProgram);
+        gl.bindVertexArray(lastVertexArray);
+        glViewport(lastViewport[0], lastViewport[1], lastViewport[2], lastViewport[3]);
+        if (lastBlend) glEnable(GL_BLEND);
+        if (lastScissor) glEnable(GL_SCISSOR_TEST);
+        shown = rendered;
+        return rendered;
+#endif
+    }
+
+#if !defined(IMGUI_IMPL_OPENGL_ES2)
+    /**
+     * The RGBA target of the shader pass, allocated once per size
+     */
+    bool prepareDisplayTexture(){
+        const GlFunctions& gl = GlFunctions::get();
+        if (displayTexture != 0 && displayWidth == width && displayHeight == height) return true;
+        if (displayTexture == 0) glGenTextures(1, &displayTexture);
+        if (framebuffer == 0) gl.genFramebuffers(1, &framebuffer);
+        displayWidth = width;
+        displayHeight = height;
+        glBindTexture(GL_TEXTURE_2D, displayTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+        GLint lastFramebuffer;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &lastFramebuffer);
+        gl.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        gl.framebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, displayTexture, 0);
+        bool complete = gl.checkFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        gl.bindFramebuffer(GL_FRAMEBUFFER, lastFramebuffer);
+        if (!complete) SPDLOG_WARN("Framebuffer of the image mapping is incomplete");
+        return complete;
+    }
+#endif
+
+    /**
+     * Upload a frame to the bound texture, allocating its storage when the size or the format changes
+     */
+    void upload(const cv::Mat& frame, GLint internalFormat, GLenum format, GLenum type){
+        if (frame.cols != width || frame.rows != height || internalFormat != storageFormat || type != storageType) {
+            width = frame.cols;
+            height = frame.rows;
+            storageFormat = internalFormat;
+            storageType = type;
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+#if !defined(IMGUI_IMPL_OPENGL_ES2)
+            if (swizzledFormat != 0) {
+                const GLint rgba[] = {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA};
+                glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, rgba);
+                swizzledFormat = 0;
+            }
+#endif
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Rows are not 4-byte aligned in general
+        if (!streaming || !uploadThroughRing(frame, format, type)) {
+            cv::Mat continuous = frame.isContinuous() ? frame : frame.clone();
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type, continuous.data);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    /**
+     * Copy the frame into the next free buffer of the ring and start the transfer to the texture.
+     * Returns false if streaming is unavailable or all the buffers are still in flight.
+     */
+    bool uploadThroughRing(const cv::Mat& frame, GLenum format, GLenum type){
+#if defined(IMGUI_IMPL_OPENGL_ES2)
+        return false; // No pixel buffer objects
+#else
+        const GlFunctions& gl = GlFunctions::get();
+        if (!gl.hasPbo()) return false;
+
+        size_t rowBytes = frame.cols * frame.elemSize();
+        size_t bytes = rowBytes * frame.rows;
+        if (bytes > ringBytes) allocateRing(bytes);
+
+        // Skip the buffers the GPU is still reading
+        PixelBuffer* buffer = nullptr;
+        for (int i = 0; i < RING_SIZE && buffer == nullptr; i++) {
+            PixelBuffer& candidate = ring[(ringIndex + i) % RING_SIZE];
+            if (candidate.fence != nullptr) {
+                GLenum state = gl.clientWaitSync(candidate.fence, 0, 0);
+                if (state != GL_ALREADY_SIGNALED && state != GL_CONDITION_SATISFIED) continue;
+                gl.deleteSync(candidate.fence);
+                candidate.fence = nullptr;
+            }
+            buffer = &candidate;
+            ringIndex = (ringIndex + i + 1) % RING_SIZE;
+        }
+        if (buffer == nullptr) return false;
+
+        gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->pbo);
+        void* dst = buffer->mapped;
+        if (dst == nullptr) {
+            // Orphan the previous contents so that mapping does not wait for the GPU
+            gl.bufferData(GL_PIXEL_UNPACK_BUFFER, ringBytes, nullptr, GL_STREAM_DRAW);
+            dst = gl.mapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        }
+        if (dst == nullptr) {
+            gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return false;
+        }
+        if (frame.isContinuous()) {
+            std::memcpy(dst, frame.data, bytes);
+        } else {
+            for (int r = 0; r < frame.rows; r++) std::memcpy((uchar*) dst + r * rowBytes, frame.ptr(r), rowBytes);
+        }
+        if (buffer->mapped == nullptr) gl.unmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type, nullptr); // from the bound buffer
+        gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (gl.hasFence()) buffer->fence = gl.fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        return true;
+#endif
+    }
+
+#if !defined(IMGUI_IMPL_OPENGL_ES2)
+    void allocateRing(size_t bytes){
+        const GlFunctions& gl = GlFunctions::get();
+        releaseRing();
+        ringBytes = bytes;
+        ringPersistent = gl.hasPersistentMapping();
+        const GLbitfield persistentFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        for (auto& buffer: ring) {
+            gl.genBuffers(1, &buffer.pbo);
+            gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+            if (ringPersistent) {
+                gl.bufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, persistentFlags);
+                buffer.mapped = gl.mapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, persistentFlags);
+            } else {
+                gl.bufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+            }
+        }
+        gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        ringIndex = 0;
+    }
+#endif
+
+    void releaseRing(){
+#if !defined(IMGUI_IMPL_OPENGL_ES2)
+        if (ringBytes == 0) return;
+        const GlFunctions& gl = GlFunctions::get();
+        for (auto& buffer: ring) {
+            if (buffer.fence != nullptr) gl.deleteSync(buffer.fence);
+            if (buffer.mapped != nullptr) {
+                gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+                gl.unmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            }
+            gl.deleteBuffers(1, &buffer.pbo);
+            buffer = PixelBuffer();
+        }
+        gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        ringBytes = 0;
+#endif
+    }
 };
 
 #endif //ISLAY_IMAGETEXTURE_H
@@ -8,13 +8,32 @@
 #define ISLAY_INTERTHREADMESSENGER_H
 
 #include <mutex>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Synchronization backend of InterThreadMessenger
+ *   MUTEX: The pointers to the three buffers are exchanged under a std::mutex (default)
+ *   TRIPLE_BUFFER: The index of the intermediate buffer and its "fresh" flag are packed
+ *                  into a single atomic word, which is exchanged without any lock.
+ *                  Only valid for one sender thread and one receiver thread at a time:
+ *                  concurrent send() or receive() calls race. Debug builds assert on them.
+ */
+enum class MESSENGER_MODE {MUTEX = 0, TRIPLE_BUFFER = 1};
 
 /**
  * An interface class for the message data to be passed by InterThreadMessenger.
- * Data members are to be added in the subclass of this. 
+ * Data members are to be added in the subclass of this.
  */
 class MsgData {
-    template<class T> friend class InterThreadMessenger;
+    template<class T, MESSENGER_MODE M> friend class InterThreadMessenger;
+    template<class T> friend class QueueMessenger;
 public:
 
     /**
@@ -33,33 +52,97 @@ public:
      * exchanged instead of actual data copy.  If this pointer
      * exchange is the desired behavior, this method does not neeed to
      * be overridden).
-     * 
+     *
      * @param dst Pointer to the destination message data
      */
     virtual void copyTo(MsgData *dst) {}
 
+    /**
+     * Monotonic timestamps (steady_clock, nanoseconds) recorded by the messenger along the path
+     * of the message; 0 until reached. See LatencyTracer.
+     */
+    struct Timestamps {
+        uint64_t prepare = 0; // prepareMsg()
+        uint64_t send = 0;    // send()
+        uint64_t receive = 0; // receive()
+    };
+
+    const Timestamps &getTimestamps() const { return timestamps; }
+
+    unsigned long long getSeqno() const { return seqno; }
+
+    /**
+     * The clock of the timestamps
+     */
+    static uint64_t clockNs() {
+        return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    unsigned long long seqno;
+    Timestamps timestamps;
+};
+
+/**
+ * A signal to sleep on until a messenger receives a message.
+ * Senders touch the mutex only when somebody is waiting, so an unobserved send() stays lock-free.
+ */
+class MsgSignal {
+public:
+    MsgSignal() : waiters(0) {};
+
+    /**
+     * Wake up all threads waiting on this signal.
+     * The state the waiters check must be published with a seq_cst store before calling this.
+     */
+    void notify() {
+        if (waiters.load(std::memory_order_seq_cst) == 0) {
+            return;
+        }
+        { std::lock_guard<std::mutex> lock(mtx); } // Make sure the waiter is either in wait or will see the new state
+        cv.notify_all();
+    }
+
+    /**
+     * Sleep until pred() returns true or the timeout expires.
+     * Returns the last value of pred().
+     */
+    template<class Rep, class Period, class Predicate>
+    bool waitFor(const std::chrono::duration<Rep, Period> &timeout, Predicate pred) {
+        std::unique_lock<std::mutex> lock(mtx);
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool ret = cv.wait_for(lock, timeout, pred);
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+        return ret;
+    }
+
 private:
-    unsigned int seqno;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::atomic<int> waiters;
 };
 
 /**
  * Class template of the inter thread messenger
  *
  * @tparam CustomMsgData A subclass of MsgData passed by the messenger.
+ * @tparam Mode Synchronization backend. See MESSENGER_MODE.
  */
-template<class CustomMsgData>
+template<class CustomMsgData, MESSENGER_MODE Mode = MESSENGER_MODE::MUTEX>
 class InterThreadMessenger {
 public:
-    InterThreadMessenger() : master_seqno(0), closed(false) {
-        msg_sender = new CustomMsgData();
-        msg_buffer = new CustomMsgData();
-        msg_receiver = new CustomMsgData();
+    InterThreadMessenger() : sender_ind(0), buffer_state(1), receiver_ind(2),
+                             master_seqno(0), overwritten(0), closed(false), signal(&own_signal) {
+        for (auto &b: buffers) b = new CustomMsgData();
+        msg_sender = buffers[0];
+        msg_buffer = buffers[1];
+        msg_receiver = buffers[2];
     }
 
     ~InterThreadMessenger() {
-        delete msg_sender;
-        delete msg_buffer;
-        delete msg_receiver;
+        for (auto &b: buffers) delete b;
     }
 
     /**
@@ -67,7 +150,14 @@ public:
      * that the message data to be sent can be put into it.
      */
     CustomMsgData *prepareMsg() const {
-        return msg_sender;
+        CustomMsgData *msg;
+        if constexpr (Mode == MESSENGER_MODE::TRIPLE_BUFFER) {
+            msg = buffers[sender_ind];
+        } else {
+            msg = msg_sender;
+        }
+        msg->timestamps.prepare = MsgData::clockNs();
+        return msg;
     }
 
     /**
@@ -76,11 +166,29 @@ public:
      */
     void send() {
         master_seqno++;
-        {
+        uint64_t now = MsgData::clockNs();
+        if constexpr (Mode == MESSENGER_MODE::TRIPLE_BUFFER) {
+            SingleThreadCheck check(sending);
+            buffers[sender_ind]->seqno = master_seqno;
+            buffers[sender_ind]->timestamps.send = now;
+            // Release publishes the message written into the sender's buffer,
+            // acquire takes over the buffer the receiver has given back.
+            // (seq_cst so that a receiver going to sleep in waitReceive() cannot miss it)
+            unsigned int prev = buffer_state.exchange(sender_ind | FRESH_BIT, std::memory_order_seq_cst);
+            sender_ind = prev & INDEX_MASK;
+            if (prev & FRESH_BIT) {
+                overwritten.fetch_add(1, std::memory_order_relaxed); // Replaced before the receiver saw it
+            }
+        } else {
             std::lock_guard<std::mutex> lock(mtx);
             msg_sender->seqno = master_seqno;
+            msg_sender->timestamps.send = now;
+            if (msg_buffer->seqno > msg_receiver->seqno) {
+                overwritten.fetch_add(1, std::memory_order_relaxed);
+            }
             swapPtr(&msg_sender, &msg_buffer);
         }
+        signal.load(std::memory_order_acquire)->notify();
     }
 
     /**
@@ -88,7 +196,12 @@ public:
      * newer than the one in the receiver's buffer.
      */
     bool isUpdated() {
-        return msg_buffer->seqno > msg_receiver->seqno;
+        if constexpr (Mode == MESSENGER_MODE::TRIPLE_BUFFER) {
+            return (buffer_state.load(std::memory_order_acquire) & FRESH_BIT) != 0;
+        } else {
+            std::lock_guard<std::mutex> lock(mtx);
+            return msg_buffer->seqno > msg_receiver->seqno;
+        }
     }
 
     /**
@@ -99,30 +212,75 @@ public:
      * isUpdated(); nullptr otherwise.
      */
     CustomMsgData *receive() {
-        if (!isUpdated()) {
-            return nullptr;
+        if constexpr (Mode == MESSENGER_MODE::TRIPLE_BUFFER) {
+            // Cheap relaxed check first so that polling an idle messenger never writes the shared word.
+            if ((buffer_state.load(std::memory_order_relaxed) & FRESH_BIT) == 0) {
+                return nullptr;
+            }
+            SingleThreadCheck check(receiving);
+            unsigned int prev = buffer_state.exchange(receiver_ind, std::memory_order_acq_rel);
+            receiver_ind = prev & INDEX_MASK;
+            buffers[receiver_ind]->timestamps.receive = MsgData::clockNs();
+            return buffers[receiver_ind];
+        } else {
+            if (!isUpdated()) {
+                return nullptr;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                swapPtr(&msg_buffer, &msg_receiver);
+            }
+            msg_receiver->timestamps.receive = MsgData::clockNs();
+            return msg_receiver;
         }
-        {
-            std::lock_guard<std::mutex> lock(mtx);
-            swapPtr(&msg_buffer, &msg_receiver);
+    }
+
+    /**
+     * Receive the message, sleeping until one is sent if there is no new message.
+     * Returns the pointer to the receiver's buffer; nullptr if the timeout expired
+     * or the messenger was closed without a new message.
+     */
+    template<class Rep, class Period>
+    CustomMsgData *waitReceive(const std::chrono::duration<Rep, Period> &timeout) {
+        CustomMsgData *msg = receive();
+        if (msg != nullptr) {
+            return msg;
         }
-        return msg_receiver;
+        signal.load(std::memory_order_acquire)->waitFor(timeout, [this] { return isUpdated() || isClosed(); });
+        return receive();
+    }
+
+    /**
+     * Route the notification of send() and close() to another signal (used by MsgWaitSet).
+     * Call with nullptr to restore the messenger's own signal.
+     * Must not be called while a thread is sleeping in waitReceive() of this messenger.
+     */
+    void attachSignal(MsgSignal *s) {
+        signal.store(s != nullptr ? s : &own_signal, std::memory_order_release);
     }
 
     /**
      * Returns true iff the messenger has been closed.
      */
     bool isClosed() const {
-        return closed;
+        return closed.load();
+    }
+
+    /**
+     * Number of messages replaced by a newer one before the receiver received them.
+     */
+    unsigned long long getOverwrittenCount() const {
+        return overwritten.load(std::memory_order_relaxed);
     }
 
     /**
      * Close the messenger.
      */
     void close() {
-        closed = true;
+        closed.store(true);
+        signal.load(std::memory_order_acquire)->notify();
     }
-    
+
 private:
     void swapPtr(CustomMsgData **p1, CustomMsgData **p2) {
         CustomMsgData *tmp;
@@ -130,13 +288,101 @@ private:
         *p1 = *p2;
         *p2 = tmp;
     }
-    
+
+    /**
+     * Asserts in debug builds that no other thread is in the same side (send or receive) of a TRIPLE_BUFFER messenger
+     */
+    struct SingleThreadCheck {
+#ifndef NDEBUG
+        std::atomic<int> &users;
+        explicit SingleThreadCheck(std::atomic<int> &_users) : users(_users) {
+            int others = users.fetch_add(1, std::memory_order_acquire);
+            assert(others == 0 && "TRIPLE_BUFFER messenger used by two senders or two receivers at once");
+            (void) others;
+        }
+        ~SingleThreadCheck() { users.fetch_sub(1, std::memory_order_release); }
+#else
+        explicit SingleThreadCheck(std::atomic<int> &) {}
+#endif
+    };
+
+    static constexpr unsigned int INDEX_MASK = 0x3;
+    static constexpr unsigned int FRESH_BIT = 0x4;
+
+    CustomMsgData *buffers[3];
+
+    // MESSENGER_MODE::MUTEX
     CustomMsgData *msg_sender;
     CustomMsgData *msg_buffer;
     CustomMsgData *msg_receiver;
-    std::mutex mtx;
-    unsigned int master_seqno;
-    bool closed;
+    mutable std::mutex mtx;
+
+    // MESSENGER_MODE::TRIPLE_BUFFER
+    // Each index is kept on its own cache line to avoid false sharing between the sender and the receiver.
+    alignas(64) unsigned int sender_ind;            // Owned by the sender thread
+    alignas(64) std::atomic<unsigned int> buffer_state; // Index of the intermediate buffer | FRESH_BIT
+    alignas(64) unsigned int receiver_ind;          // Owned by the receiver thread
+    std::atomic<int> sending{0}, receiving{0};      // Threads in send() and receive(), for SingleThreadCheck
+
+    unsigned long long master_seqno;
+    std::atomic<unsigned long long> overwritten;
+    std::atomic<bool> closed;
+
+    MsgSignal own_signal;
+    std::atomic<MsgSignal *> signal;
+};
+
+/**
+ * Wait for a message on any of several messengers.
+ *
+ *   MsgWaitSet waitSet;
+ *   waitSet.add(msgrA); waitSet.add(msgrB);
+ *   while (waitSet.wait(std::chrono::milliseconds(100))) {
+ *       if (auto a = msgrA->receive()) { ... }
+ *       if (auto b = msgrB->receive()) { ... }
+ *   }
+ *
+ * Add messengers before the receiving thread starts waiting. The wait set must be destroyed
+ * before the messengers added to it, or after their senders stopped.
+ */
+class MsgWaitSet {
+public:
+    MsgWaitSet() = default;
+    MsgWaitSet(const MsgWaitSet &) = delete;
+    MsgWaitSet &operator=(const MsgWaitSet &) = delete;
+
+    ~MsgWaitSet() {
+        for (auto &detach: detachers) detach();
+    }
+
+    /**
+     * Add a messenger (InterThreadMessenger or QueueMessenger) to the set.
+     */
+    template<class Messenger>
+    void add(const std::shared_ptr<Messenger> &messenger) {
+        messenger->attachSignal(&signal);
+        readies.emplace_back([messenger] { return messenger->isUpdated() || messenger->isClosed(); });
+        detachers.emplace_back([messenger] { messenger->attachSignal(nullptr); });
+    }
+
+    /**
+     * Sleep until any of the messengers has a new message or is closed.
+     * Returns false if the timeout expired.
+     */
+    template<class Rep, class Period>
+    bool wait(const std::chrono::duration<Rep, Period> &timeout) {
+        return signal.waitFor(timeout, [this] {
+            for (auto &ready: readies) {
+                if (ready()) return true;
+            }
+            return false;
+        });
+    }
+
+private:
+    MsgSignal signal;
+    std::vector<std::function<bool()>> readies;
+    std::vector<std::function<void()>> detachers;
 };
 
 #endif //ISLAY_INTERTHREADMESSENGER_H
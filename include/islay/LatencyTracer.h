@@ -0,0 +1,203 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_LATENCYTRACER_H
+#define ISLAY_LATENCYTRACER_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "InterThreadMessenger.hpp"
+#include "Logger.h"
+
+/**
+ * @brief Segments of the path of a message, between the timestamps of MsgData::Timestamps and the display
+ *   FILL:    prepareMsg() -> send(), the time the worker spends filling the message
+ *   QUEUE:   send() -> receive(), the time the message waits in the messenger
+ *   DISPLAY: receive() -> display (upload, draw and swap; or the sink of a headless run)
+ *   TOTAL:   prepareMsg() -> display
+ */
+enum class LATENCY_STAGE {FILL = 0, QUEUE = 1, DISPLAY = 2, TOTAL = 3};
+constexpr size_t LATENCY_STAGE_COUNT = 4;
+
+inline const char* latencyStageName(LATENCY_STAGE stage){
+    static const char* names[] = {"fill", "queue", "display", "total"};
+    return names[(int) stage];
+}
+
+/**
+ * @brief Histogram of durations in nanoseconds with log-linear buckets
+ *   8 buckets per power of two, so percentiles are within 12.5 %; fixed size, no allocation on record().
+ */
+class LatencyHistogram {
+public:
+    void record(uint64_t ns){
+        buckets[bucketOf(ns)]++;
+        count++;
+        sum += ns;
+        maxNs = std::max(maxNs, ns);
+    }
+
+    /**
+     * @brief Duration below which a fraction q of the samples are, in nanoseconds (middle of the bucket)
+     */
+    double percentile(double q) const {
+        if (count == 0) return 0;
+        auto target = (unsigned long long) (q * (count - 1)) + 1;
+        unsigned long long seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen >= target) return std::min<double>((lowerBound(i) + lowerBound(i + 1)) * 0.5, (double) maxNs);
+        }
+        return (double) maxNs;
+    }
+
+    double mean() const { return count > 0 ? (double) sum / count : 0; }
+    uint64_t max() const { return maxNs; }
+    unsigned long long getCount() const { return count; }
+
+    void reset(){ *this = LatencyHistogram(); }
+
+private:
+    static constexpr size_t SUB_BITS = 3;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+    /// Index of the highest set bit of a non-zero value
+    static size_t highestBit(uint64_t v){
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+        unsigned long index;
+        _BitScanReverse64(&index, v);
+        return (size_t) index;
+#elif defined(__GNUC__) || defined(__clang__)
+        return (size_t) (63 - __builtin_clzll(v));
+#else
+        size_t index = 0;
+        while (v >>= 1) index++;
+        return index;
+#endif
+    }
+
+    static size_t bucketOf(uint64_t ns){
+        if (ns < (1u << SUB_BITS)) return (size_t) ns;
+        size_t exponent = highestBit(ns);
+        size_t sub = (size_t) (ns >> (exponent - SUB_BITS)) & ((1u << SUB_BITS) - 1);
+        return ((exponent - SUB_BITS + 1) << SUB_BITS) + sub;
+    }
+
+    static double lowerBound(size_t bucket){
+        if (bucket < (1u << SUB_BITS)) return (double) bucket;
+        size_t exponent = (bucket >> SUB_BITS) + SUB_BITS - 1;
+        size_t sub = bucket & ((1u << SUB_BITS) - 1);
+        return std::ldexp((double) ((1u << SUB_BITS) + sub), (int) (exponent - SUB_BITS));
+    }
+
+    std::array<unsigned long long, BUCKETS> buckets{};
+    unsigned long long count = 0;
+    uint64_t sum = 0;
+    uint64_t maxNs = 0;
+};
+
+/**
+ * @brief Latency statistics of the frames of each channel, from the worker to the display
+ *   The consumer of a channel (Application, HeadlessRunner) calls record() with the timestamps of each
+ *   frame it shows and setLostCount() with the counters of the messenger.
+ */
+class LatencyTracer {
+public:
+    struct Channel {
+        std::array<LatencyHistogram, LATENCY_STAGE_COUNT> stages;
+        unsigned long long lost = 0;     // Overwritten (InterThreadMessenger) or dropped (QueueMessenger) frames
+        unsigned long long lostBase = 0; // Counter of the messenger at the last reset()
+    };
+
+    static LatencyTracer& get_instance(){
+        static LatencyTracer instance;
+        return instance;
+    }
+
+    /**
+     * @brief Record a frame of a channel displayed at displayNs (MsgData::clockNs())
+     */
+    void record(const std::string& channel, const MsgData::Timestamps& t, uint64_t displayNs = MsgData::clockNs()){
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& c = channels[channel];
+        auto add = [&](LATENCY_STAGE stage, uint64_t from, uint64_t to){
+            if (from != 0 && to >= from) c.stages[(int) stage].record(to - from);
+        };
+        add(LATENCY_STAGE::FILL, t.prepare, t.send);
+        add(LATENCY_STAGE::QUEUE, t.send, t.receive);
+        add(LATENCY_STAGE::DISPLAY, t.receive, displayNs);
+        add(LATENCY_STAGE::TOTAL, t.prepare, displayNs);
+    }
+
+    /**
+     * @brief Update the frames of a channel lost in the messenger (getOverwrittenCount() or getDropCount())
+     */
+    void setLostCount(const std::string& channel, unsigned long long total){
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& c = channels[channel];
+        if (total < c.lostBase) c.lostBase = 0; // The messenger was recreated
+        c.lost = total - c.lostBase;
+    }
+
+    std::map<std::string, Channel> snapshot(){
+        std::lock_guard<std::mutex> lock(mtx);
+        return channels;
+    }
+
+    /**
+     * @brief Clear the statistics. Lost counts restart from the current counters of the messengers.
+     */
+    void reset(){
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& [name, c]: channels) {
+            for (auto& h: c.stages) h.reset();
+            c.lostBase += c.lost;
+            c.lost = 0;
+        }
+    }
+
+    /**
+     * @brief Write the statistics as CSV, one line per channel and stage, in microseconds
+     */
+    bool exportCsv(const std::string& path){
+        std::ofstream ofs(path);
+        if (!ofs) {
+            SPDLOG_ERROR("Cannot write {}", path);
+            return false;
+        }
+        ofs << "channel,stage,count,mean_us,p50_us,p99_us,max_us,lost\n";
+        for (auto& [name, c]: snapshot()) {
+            for (size_t i = 0; i < LATENCY_STAGE_COUNT; i++) {
+                auto& h = c.stages[i];
+                ofs << name << "," << latencyStageName((LATENCY_STAGE) i) << "," << h.getCount() << ","
+                    << h.mean() * 1e-3 << "," << h.percentile(0.5) * 1e-3 << "," << h.percentile(0.99) * 1e-3 << ","
+                    << h.max() * 1e-3 << "," << c.lost << "\n";
+            }
+        }
+        SPDLOG_INFO("Latency statistics saved: {}", path);
+        return true;
+    }
+
+private:
+    LatencyTracer() = default;
+    ~LatencyTracer() = default;
+    LatencyTracer(const LatencyTracer&) = delete;
+    LatencyTracer& operator=(const LatencyTracer&) = delete;
+
+    std::mutex mtx;
+    std::map<std::string, Channel> channels;
+};
+
+#endif //ISLAY_LATENCYTRACER_H
@@ -0,0 +1,128 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_LOGSTORE_H
+#define ISLAY_LOGSTORE_H
+
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/base_sink.h>
+
+/**
+ * @brief A log message with its fields, as kept by LogStore
+ */
+struct LogEntry {
+    std::chrono::system_clock::time_point time;
+    spdlog::level::level_enum level = spdlog::level::info;
+    size_t threadId = 0;  // spdlog::details::os::thread_id() of the thread that logged it
+    std::string thread;   // Name given with Logger::setThreadName(), the thread id otherwise
+    std::string text;
+
+    /**
+     * @brief Local time of the entry with microseconds, e.g. "%H:%M:%S" gives "14:03:59.123456"
+     */
+    std::string timeString(const char* format = "%y-%m-%d %H:%M:%S") const {
+        std::time_t t = std::chrono::system_clock::to_time_t(time);
+        std::tm tm{};
+#if WIN32
+        localtime_s(&tm, &t);
+#else
+        localtime_r(&t, &tm);
+#endif
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count() % 1000000;
+        char stamp[64];
+        size_t n = std::strftime(stamp, sizeof(stamp), format, &tm);
+        snprintf(stamp + n, sizeof(stamp) - n, ".%06lld", (long long) micros);
+        return stamp;
+    }
+
+    /**
+     * @brief The entry as formatted by the file and console sinks: "[yy-mm-dd HH:MM:SS.ffffff][level] text"
+     */
+    std::string line() const {
+        auto name = spdlog::level::to_string_view(level);
+        return fmt::format("[{}][{:>5}] {}", timeString(), std::string(name.data(), name.size()), text);
+    }
+};
+
+/**
+ * @brief Structured in-memory sink, read by index
+ *   Keeps the latest CAPACITY entries. Each entry has an absolute index that stays valid while the entry
+ *   is kept, so a reader (the log window of the GUI) only fetches what it has not seen:
+ *
+ *     size_t next = 0;
+ *     next = store->read(next, [](const LogEntry& e){ ... });  // Each frame
+ */
+class LogStore : public spdlog::sinks::base_sink<std::mutex> {
+public:
+    static constexpr size_t CAPACITY = 1 << 16;
+
+    /**
+     * @brief Call f(entry) on the entries from the absolute index from, and return the index after the last
+     *   Entries that were already discarded are skipped.
+     */
+    template<class F>
+    size_t read(size_t from, F&& f){
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = std::max(from, first); i < first + entries.size(); i++) f(entries[i - first]);
+        return first + entries.size();
+    }
+
+    /// Absolute index of the oldest entry kept
+    size_t begin(){
+        std::lock_guard<std::mutex> lock(mutex_);
+        return first;
+    }
+
+    /// Absolute index of the next entry
+    size_t end(){
+        std::lock_guard<std::mutex> lock(mutex_);
+        return first + entries.size();
+    }
+
+    void clear(){
+        std::lock_guard<std::mutex> lock(mutex_);
+        first += entries.size();
+        entries.clear();
+    }
+
+    /**
+     * @brief Name the entries of a thread, e.g. after the worker it runs
+     */
+    void setThreadName(size_t threadId, const std::string& name){
+        std::lock_guard<std::mutex> lock(mutex_);
+        threadNames[threadId] = name;
+    }
+
+protected:
+    void sink_it_(const spdlog::details::log_msg& msg) override {
+        if (entries.size() == CAPACITY) {
+            entries.pop_front();
+            first++;
+        }
+        LogEntry e;
+        e.time = msg.time;
+        e.level = msg.level;
+        e.threadId = msg.thread_id;
+        auto it = threadNames.find(msg.thread_id);
+        e.thread = it != threadNames.end() ? it->second : std::to_string(msg.thread_id);
+        e.text.assign(msg.payload.data(), msg.payload.size());
+        entries.push_back(std::move(e));
+    }
+
+    void flush_() override {}
+
+private:
+    std::deque<LogEntry> entries;
+    size_t first = 0; // Absolute index of entries.front()
+    std::map<size_t, std::string> threadNames;
+};
+
+#endif //ISLAY_LOGSTORE_H
@@ -15,7 +15,13 @@
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/basic_file_sink.h> // support for basic file logging
 #include <spdlog/sinks/stdout_color_sinks.h> // or "../stdout_sinks.h" if no colors needed
-#include <spdlog/sinks/ostream_sink.h>
+#include <spdlog/details/os.h>
+
+#include "AsyncLogSink.h"
+#include "BinaryLog.h"
+#include "LogStore.h"
+
+class PUBinder;
 
 class Logger
 {
@@ -23,23 +29,38 @@ private:
     Logger(){
         try
         {   // Default logger
-            auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
-            auto file_sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>("log.txt", true);
-            auto ostream_sink = std::make_shared<spdlog::sinks::ostream_sink_mt> (oss);
-            spdlog::sinks_init_list sink_list = { file_sink, console_sink, ostream_sink};
-            for (auto &sink:sink_list) {
-                sink->set_pattern("[%C-%m-%d %H:%M:%S.%f][%^%5l%$] %v");
-            }
-            logger.reset(new spdlog::logger("LOGGER", sink_list.begin(), sink_list.end()));
-            logger->set_level(spdlog::level::trace);
-            spdlog::set_default_logger(logger);
+            store = std::make_shared<LogStore>();
+            setSinks("log.txt");
         }
         catch (const spdlog::spdlog_ex& ex)
         {
             std::cout << "[Log initialization failed] " << ex.what() << std::endl;
         }
     };
-    ~Logger() = default;
+    ~Logger(){
+        stopAsync();
+    }
+
+    void setSinks(const std::string& logFile){
+        auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+        auto file_sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(logFile, true);
+        sinks = { file_sink, console_sink, store };
+        for (auto &sink:sinks) {
+            sink->set_pattern("[%C-%m-%d %H:%M:%S.%f][%^%5l%$] %v");
+        }
+        resetLogger();
+    }
+
+    void resetLogger(){
+        if (async && async->isRunning()) {
+            async->setBackSinks(sinks);
+            logger.reset(new spdlog::logger("LOGGER", async));
+        } else {
+            logger.reset(new spdlog::logger("LOGGER", sinks.begin(), sinks.end()));
+        }
+        logger->set_level(spdlog::level::trace);
+        spdlog::set_default_logger(logger);
+    }
 
 public:
     Logger(const Logger&) = delete;
@@ -54,20 +75,67 @@ public:
     }
 
     void setExportDirectory(std::string logExportDirectory){
-        auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
-        auto file_sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(logExportDirectory + "/log.txt", true);
-        auto ostream_sink = std::make_shared<spdlog::sinks::ostream_sink_mt> (oss);
-        spdlog::sinks_init_list sink_list = { file_sink, console_sink, ostream_sink};
-        for (auto &sink:sink_list) {
-            sink->set_pattern("[%C-%m-%d %H:%M:%S.%f][%^%5l%$] %v");
-        }
-        logger.reset(new spdlog::logger("LOGGER", sink_list.begin(), sink_list.end()));
-        logger->set_level(spdlog::level::trace);
-        spdlog::set_default_logger(logger);
+        flush();
+        setSinks(logExportDirectory + "/log.txt");
+    }
+
+    /**
+     * @brief Switch to the asynchronous mode: logging only copies the message into a ring of the calling
+     *   thread, and a flusher thread writes the file, console and store. See AsyncLogSink.
+     * @param puBinder Binds the flusher thread ("Logger") to a PU, so that it does not preempt the workers
+     */
+    template<class Binder = PUBinder>
+    void startAsync(std::weak_ptr<Binder> puBinder = std::weak_ptr<Binder>()){
+        if (!async) async = std::make_shared<AsyncLogSink>();
+        if (async->isRunning()) return;
+        async->setBackSinks(sinks);
+        async->start([puBinder] {
+            auto binder = puBinder.lock();
+            if (!binder) return;
+#if WIN32
+            std::thread::native_handle_type self = GetCurrentThread();
+#else
+            std::thread::native_handle_type self = pthread_self();
+#endif
+            binder->bindThread("Logger", self, std::this_thread::get_id());
+        }, [puBinder] {
+            if (auto binder = puBinder.lock()) binder->unbind("Logger");
+        });
+        resetLogger();
+        SPDLOG_INFO("Asynchronous logging started");
+    }
+
+    /**
+     * @brief Back to synchronous logging, after writing the pending messages
+     */
+    void stopAsync(){
+        if (!async || !async->isRunning()) return;
+        async->stop();
+        resetLogger();
+    }
+
+    bool isAsync() const { return async && async->isRunning(); }
+
+    /**
+     * @brief Write the messages logged so far to the file, console and store
+     */
+    void flush(){
+        if (logger) logger->flush();
+    }
+
+    /**
+     * @brief Name the messages of the calling thread in the store and the binary log (e.g. after the worker it runs)
+     */
+    void setThreadName(const std::string& name){
+        store->setThreadName(spdlog::details::os::thread_id(), name);
+        BinaryLog::get_instance().setThreadName(name);
     }
 
     std::shared_ptr<spdlog::logger> logger;
-    std::ostringstream oss;
+    std::shared_ptr<LogStore> store; // Structured messages for the GUI, read by index
+    std::shared_ptr<AsyncLogSink> async;
+    std::vector<spdlog::sink_ptr> sinks; // File, console and store
+
 };
 
 #endif //ISLAY_LOGGER_H
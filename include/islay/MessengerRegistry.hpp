@@ -0,0 +1,131 @@
+/**
+ @file MessengerRegistry.hpp
+ @brief A thread-safe registry of named messengers (channels), read without locks.
+ @author mhirano<masahiro.dll@gmail.com>
+ */
+
+#ifndef ISLAY_MESSENGERREGISTRY_H
+#define ISLAY_MESSENGERREGISTRY_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+/**
+ * Class template of the channel registry
+ *
+ * The set of channels is an immutable std::map published through an atomic shared_ptr (read-copy-update):
+ * - Readers (e.g. the GUI loop) take a snapshot() and iterate it without any lock. A snapshot stays valid
+ *   however the registry is modified afterwards.
+ * - Writers (setup/remove/clear) copy the map, modify the copy and publish it. They are serialized by a
+ *   mutex, but they are rare: a producer calls setup() once and keeps the returned handle.
+ * - A removed channel stays alive as long as somebody holds its handle, so producers and consumers
+ *   using it never see a dangling messenger. It is closed on removal so that they can notice.
+ *
+ * @tparam Messenger InterThreadMessenger or QueueMessenger
+ */
+template<class Messenger>
+class MessengerRegistry {
+public:
+    using Handle = std::shared_ptr<Messenger>;
+    using Map = std::map<std::string, Handle>;
+    using Snapshot = std::shared_ptr<const Map>;
+
+    MessengerRegistry() : channels(std::make_shared<const Map>()) {};
+
+    MessengerRegistry(const MessengerRegistry &) = delete;
+    MessengerRegistry &operator=(const MessengerRegistry &) = delete;
+
+    /**
+     * Returns the channel with a name, creating it with args if it does not exist.
+     * Keep the returned handle rather than calling this for every message.
+     */
+    template<class... Args>
+    Handle setup(const std::string &name, Args &&... args) {
+        if (auto handle = find(name)) {
+            return handle;
+        }
+        std::lock_guard<std::mutex> lock(writeMtx);
+        Snapshot current = snapshot();
+        auto it = current->find(name);
+        if (it != current->end()) {
+            return it->second; // Created by another thread in the meantime
+        }
+        auto handle = std::make_shared<Messenger>(std::forward<Args>(args)...);
+        auto next = std::make_shared<Map>(*current);
+        next->emplace(name, handle);
+        publish(std::move(next));
+        return handle;
+    }
+
+    /**
+     * Returns the channel with a name; nullptr if it does not exist.
+     */
+    Handle find(const std::string &name) const {
+        Snapshot current = snapshot();
+        auto it = current->find(name);
+        return it != current->end() ? it->second : nullptr;
+    }
+
+    /**
+     * Returns the current set of channels.
+     */
+    Snapshot snapshot() const {
+        return std::atomic_load(&channels);
+    }
+
+    /**
+     * Removes a channel and closes it.
+     */
+    bool remove(const std::string &name) {
+        Handle removed;
+        {
+            std::lock_guard<std::mutex> lock(writeMtx);
+            Snapshot current = snapshot();
+            auto it = current->find(name);
+            if (it == current->end()) {
+                return false;
+            }
+            removed = it->second;
+            auto next = std::make_shared<Map>(*current);
+            next->erase(name);
+            publish(std::move(next));
+        }
+        removed->close();
+        return true;
+    }
+
+    /**
+     * Removes all channels and closes them.
+     */
+    void clear() {
+        Snapshot removed;
+        {
+            std::lock_guard<std::mutex> lock(writeMtx);
+            removed = snapshot();
+            publish(std::make_shared<Map>());
+        }
+        for (auto &channel: *removed) { channel.second->close(); }
+    }
+
+    bool close() {
+        for (auto &channel: *snapshot()) { channel.second->close(); }
+        return true;
+    }
+
+    size_t size() const {
+        return snapshot()->size();
+    }
+
+private:
+    void publish(std::shared_ptr<Map> next) {
+        std::atomic_store(&channels, Snapshot(std::move(next)));
+    }
+
+    Snapshot channels;
+    std::mutex writeMtx;
+};
+
+#endif //ISLAY_MESSENGERREGISTRY_H
@@ -5,8 +5,20 @@
 #ifndef ISLAY_PUBINDER_H
 #define ISLAY_PUBINDER_H
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 #include <hwloc.h>
+#include <spdlog/spdlog.h>
 
 #if WIN32
 #include <windows.h>
@@ -20,81 +32,371 @@ inline std::string id_to_str(std::thread::id id){
     return os.str();
 }
 
-class PUBinder{
+/**
+ * @brief How PUBinder picks a vacant PU for a thread
+ *   FIRST_VACANT: The vacant PU with the lowest logical index
+ *   COMPACT: The vacant PU closest to the PUs already binded (SMT siblings, then the same L3, then the same package)
+ *   SCATTER: The vacant PU farthest from the PUs already binded, spreading threads over packages and cores
+ *   ONE_PER_CORE: A PU of a core none of whose PUs is binded. Never an SMT sibling of a busy core.
+ *   NEAR_PEER: A PU sharing the L3 cache with the PU of a peer thread, on another core if possible
+ */
+enum class PLACEMENT_POLICY {FIRST_VACANT = 0, COMPACT = 1, SCATTER = 2, ONE_PER_CORE = 3, NEAR_PEER = 4};
+
+/**
+ * @brief Binds threads to PUs (processing units) and keeps track of the bindings by name
+ *   Thread-safe. A PU is claimed with a compare-and-swap on its slot, so binding threads concurrently
+ *   never picks the same PU twice. The names of the threads holding PUs are indexed in a hash map
+ *   (read under a shared lock) for getPuIfBinded().
+ *
+ *   A worker may bind several threads: its own thread under its name, and sub-threads (e.g. a
+ *   display thread) under their own names with the worker as owner. See getPusOwnedBy().
+ *
+ *   Bindings are released by unbind(), and automatically:
+ *   - when a thread that binded itself exits,
+ *   - for the sub-threads of a worker, when unbindSubThreads() is called at the end of its run.
+ */
+class PUBinder : public std::enable_shared_from_this<PUBinder> {
+    struct Placement {
+        PLACEMENT_POLICY policy;
+        std::string peer; // Thread name to be close to (NEAR_PEER)
+    };
+
+    struct Binding {
+        std::string threadName;
+        std::string owner; // Worker on behalf of which the thread is binded
+        std::thread::id id;
+    };
+
+    /// Releases the bindings of a thread that binded itself when it exits
+    struct ThreadExitGuard {
+        std::vector<std::weak_ptr<PUBinder>> binders;
+        ~ThreadExitGuard(){
+            for(auto& b: binders){
+                if(auto binder = b.lock()) binder->unbindThread(std::this_thread::get_id());
+            }
+        }
+    };
+
     hwloc_topology_t topology;
     unsigned int pu_num;
-    std::map<unsigned int, std::string> puMap;
+    std::unique_ptr<std::atomic<bool>[]> puTaken; // Ownership of each PU, claimed lock-free
+
+    mutable std::shared_mutex indexMtx;           // Guards the following
+    std::vector<Binding> bindings;                // Binding of each PU
+    std::unordered_map<std::string, unsigned int> nameIndex;               // thread name -> PU
+    std::unordered_map<std::string, std::vector<unsigned int>> ownerIndex; // owner -> PUs
+    std::unordered_map<std::string, Placement> placements; // Placement requested for each thread name
+
+    std::atomic<PLACEMENT_POLICY> defaultPolicy{PLACEMENT_POLICY::FIRST_VACANT};
+    std::atomic<bool> memoryBinding{false};
 
 public:
-    PUBinder(){
+    /**
+     * @param syntheticTopology hwloc synthetic topology (e.g. "pack:2 l3:1 core:8 pu:2") to try the placement
+     *                          policies for another machine. Threads are not actually binded then. Empty for this machine.
+     */
+    explicit PUBinder(const std::string& syntheticTopology = ""){
         hwloc_topology_init(&topology);
+        if(!syntheticTopology.empty() && hwloc_topology_set_synthetic(topology, syntheticTopology.c_str()) != 0){
+            SPDLOG_WARN("Invalid synthetic topology: {}", syntheticTopology);
+        }
         hwloc_topology_load(topology);
         int topodepth = hwloc_topology_get_depth(topology);
         pu_num = hwloc_get_nbobjs_by_depth(topology, topodepth-1); // Get PU lists
         SPDLOG_INFO("Number of processing units: {}", pu_num);
+        puTaken.reset(new std::atomic<bool>[pu_num]);
         for(unsigned int i=0;i<pu_num;i++){
-            puMap[i]="";
+            puTaken[i].store(false);
         }
+        bindings.resize(pu_num);
     }
 
+    PUBinder(const PUBinder&) = delete;
+    PUBinder& operator=(const PUBinder&) = delete;
+
     ~PUBinder(){
         hwloc_topology_destroy(topology);
     }
 
-    int bindThread(std::string threadName, std::thread::native_handle_type thread, std::thread::id id){
-        // Pick a vacant PU to bind the thread
-        int firstUnbindedPuLogicalInd;
-        for(const auto& [k,v]: puMap){
-            if(v=="") {
-                firstUnbindedPuLogicalInd = k;
-                break;
-            }
-            firstUnbindedPuLogicalInd = -1;
+    /**
+     * @brief Placement policy for threads without their own placement (see setPlacement)
+     */
+    void setDefaultPolicy(PLACEMENT_POLICY policy){ defaultPolicy.store(policy); }
+
+    PLACEMENT_POLICY getDefaultPolicy() const { return defaultPolicy.load(); }
+
+    /**
+     * @brief Placement policy for the thread binded with a name
+     * @param peer Thread name to be close to. Only for PLACEMENT_POLICY::NEAR_PEER.
+     */
+    void setPlacement(const std::string& threadName, PLACEMENT_POLICY policy, const std::string& peer = ""){
+        std::unique_lock<std::shared_mutex> lock(indexMtx);
+        placements[threadName] = Placement{policy, peer};
+    }
+
+    /**
+     * @brief Also bind the memory allocated by a binded thread to the NUMA node of its PU
+     *   Only effective when a thread binds itself (the memory binding of another thread cannot be set).
+     */
+    void setMemoryBinding(bool enable){ memoryBinding.store(enable); }
+
+    /**
+     * @brief Bind a thread to a vacant PU picked by its placement policy
+     *   A name holds one PU: binding the same thread again returns its PU, and another thread claiming a name
+     *   that is already binded is refused (unbind the name first).
+     * @param owner Worker on behalf of which the thread is binded. Defaults to the thread name.
+     * @return Logical index of the PU. -1 if no vacant PU satisfies the policy or the name is binded by another thread.
+     */
+    int bindThread(std::string threadName, std::thread::native_handle_type thread, std::thread::id id,
+                   std::string owner = ""){
+        Placement placement{defaultPolicy.load(), ""};
+        {
+            std::shared_lock<std::shared_mutex> lock(indexMtx);
+            int binded;
+            if(findBinding(threadName, id, binded)) return binded;
+            auto it = placements.find(threadName);
+            if(it != placements.end()) placement = it->second;
+        }
+
+        // Pick a vacant PU and claim it. Retry if another thread claimed it in the meantime.
+        int puLogicalInd;
+        while(true){
+            puLogicalInd = pickPu(placement);
+            if(puLogicalInd == -1)
+                return puLogicalInd;
+            bool expected = false;
+            if(puTaken[puLogicalInd].compare_exchange_strong(expected, true)) break;
         }
 
-        if(firstUnbindedPuLogicalInd == -1)
-            return firstUnbindedPuLogicalInd;
+        // Record the binding before binding the thread: the name may have been binded in the meantime
+        if(owner.empty()) owner = threadName;
+        {
+            std::unique_lock<std::shared_mutex> lock(indexMtx);
+            int binded;
+            if(findBinding(threadName, id, binded)){
+                puTaken[puLogicalInd].store(false);
+                return binded;
+            }
+            nameIndex[threadName] = puLogicalInd;
+            ownerIndex[owner].push_back(puLogicalInd);
+            bindings[puLogicalInd] = Binding{threadName, owner, id};
+        }
 
         // Get the vacant pu object
-        hwloc_obj_t pu = hwloc_get_obj_by_type(topology, hwloc_obj_type_t::HWLOC_OBJ_PU, firstUnbindedPuLogicalInd);
+        hwloc_obj_t pu = hwloc_get_obj_by_type(topology, hwloc_obj_type_t::HWLOC_OBJ_PU, puLogicalInd);
         // Bind the thread (identified by handle) with the vacant PU
         hwloc_set_thread_cpubind(topology, thread, pu->cpuset, HWLOC_CPUBIND_THREAD);
-        assert(pu->logical_index == firstUnbindedPuLogicalInd && "PU and thread was not binded correctly.");
-        puMap[pu->logical_index] = threadName;
-        return firstUnbindedPuLogicalInd;
+        assert(pu->logical_index == (unsigned int) puLogicalInd && "PU and thread was not binded correctly.");
+        if(memoryBinding.load()){
+            if(id == std::this_thread::get_id()){
+                if(hwloc_set_membind(topology, pu->nodeset, HWLOC_MEMBIND_BIND,
+                                     HWLOC_MEMBIND_THREAD | HWLOC_MEMBIND_BYNODESET) != 0)
+                    SPDLOG_DEBUG("Failed to bind the memory of {} to the NUMA node of PU #{}", threadName, puLogicalInd);
+            } else {
+                SPDLOG_DEBUG("Memory of {} not binded: only a thread binding itself can bind its memory", threadName);
+            }
+        }
+
+        // Release the binding when the thread exits
+        if(id == std::this_thread::get_id()){
+            auto self = weak_from_this();
+            if(!self.expired()) threadExitGuard().binders.emplace_back(std::move(self));
+        }
+        return puLogicalInd;
     }
 
-    bool unbind(std::string threadName){
-        for(auto&[k,v]: puMap){
-            if(v == threadName) {
-                v="";
-                /// TODO: check if binded thread is already joined.
-                return true;
-            }
+    /**
+     * @brief Release the PU binded under a thread name
+     */
+    bool unbind(const std::string& threadName){
+        unsigned int pu;
+        {
+            std::shared_lock<std::shared_mutex> lock(indexMtx);
+            auto it = nameIndex.find(threadName);
+            if(it == nameIndex.end()) return false;
+            pu = it->second;
+        }
+        return release(pu, [&](const Binding& b){ return b.threadName == threadName; });
+    }
+
+    /**
+     * @brief Release the PUs binded by a thread
+     */
+    bool unbindThread(std::thread::id id){
+        bool released = false;
+        for(unsigned int i=0;i<pu_num;i++){
+            if(puTaken[i].load()) released |= release(i, [&](const Binding& b){ return b.id == id; });
         }
-        return false;
+        return released;
     }
 
-    int getPuIfBinded(std::string threadName){
-        for(const auto& [k,v]:puMap){
-            if(v == threadName) return k;
+    /**
+     * @brief Release the PUs of the sub-threads of a worker, keeping the one binded under its own name
+     */
+    bool unbindSubThreads(const std::string& owner){
+        std::vector<unsigned int> pus = getPusOwnedBy(owner);
+        bool released = false;
+        for(auto pu: pus){
+            released |= release(pu, [&](const Binding& b){ return b.owner == owner && b.threadName != owner; });
         }
-        return -1;
+        return released;
+    }
+
+    int getPuIfBinded(const std::string& threadName) const {
+        std::shared_lock<std::shared_mutex> lock(indexMtx);
+        auto it = nameIndex.find(threadName);
+        return it != nameIndex.end() ? (int) it->second : -1;
     }
 
+    /**
+     * @brief PUs of all the threads binded on behalf of a worker
+     */
+    std::vector<unsigned int> getPusOwnedBy(const std::string& owner) const {
+        std::shared_lock<std::shared_mutex> lock(indexMtx);
+        auto it = ownerIndex.find(owner);
+        return it != ownerIndex.end() ? it->second : std::vector<unsigned int>();
+    }
+
+    /// Number of PUs
+    unsigned int getPuNum() const { return pu_num; }
+
     /// Only for debugging
     std::string puListStr(){
         std::ostringstream os;
         os.str(""); os.clear();
-        for(const auto& [k,v]: puMap){
-            if(v==""){
+        std::shared_lock<std::shared_mutex> lock(indexMtx);
+        for(unsigned int k=0;k<pu_num;k++){
+            if(!puTaken[k].load()){
                 os << k << ":" << " " << ", ";
             } else{
-                os << k << ":" << v << ", ";
+                os << k << ":" << bindings[k].threadName << ", ";
             }
         }
         return os.str();
     }
+
+private:
+    static ThreadExitGuard& threadExitGuard(){
+        static thread_local ThreadExitGuard guard;
+        return guard;
+    }
+
+    /**
+     * @brief Whether a name is binded (indexMtx held)
+     * @param pu The PU of the name if it is binded by the thread id, -1 if by another thread
+     */
+    bool findBinding(const std::string& threadName, std::thread::id id, int& pu) const {
+        auto it = nameIndex.find(threadName);
+        if(it == nameIndex.end()) return false;
+        unsigned int binded = it->second;
+        if(bindings[binded].id == id){
+            pu = (int) binded;
+        } else {
+            SPDLOG_WARN("{} is already binded to PU #{} by another thread. Binding refused.", threadName, binded);
+            pu = -1;
+        }
+        return true;
+    }
+
+    /// Release a PU if its binding matches
+    template<class Pred>
+    bool release(unsigned int pu, Pred match){
+        {
+            std::unique_lock<std::shared_mutex> lock(indexMtx);
+            if(!puTaken[pu].load() || !match(bindings[pu])) return false;
+            nameIndex.erase(bindings[pu].threadName);
+            auto it = ownerIndex.find(bindings[pu].owner);
+            if(it != ownerIndex.end()){
+                it->second.erase(std::remove(it->second.begin(), it->second.end(), pu), it->second.end());
+                if(it->second.empty()) ownerIndex.erase(it);
+            }
+            bindings[pu] = Binding();
+        }
+        puTaken[pu].store(false);
+        return true;
+    }
+
+    hwloc_obj_t getPu(unsigned int logicalInd){
+        return hwloc_get_obj_by_type(topology, HWLOC_OBJ_PU, logicalInd);
+    }
+
+    /// The ancestor of a PU of a type. The package if the type is absent (e.g. no L3 cache).
+    hwloc_obj_t ancestor(hwloc_obj_t pu, hwloc_obj_type_t type){
+        hwloc_obj_t obj = hwloc_get_ancestor_obj_by_type(topology, type, pu);
+        if(obj == nullptr && type != HWLOC_OBJ_PACKAGE) obj = ancestor(pu, HWLOC_OBJ_PACKAGE);
+        return obj;
+    }
+
+    /// Depth of the deepest common ancestor of two PUs: larger when they share more of the hierarchy
+    int closeness(hwloc_obj_t a, hwloc_obj_t b){
+        return hwloc_get_common_ancestor_obj(topology, a, b)->depth;
+    }
+
+    int pickPu(const Placement& placement){
+        std::vector<hwloc_obj_t> vacant, binded;
+        for(unsigned int k=0;k<pu_num;k++){
+            (puTaken[k].load() ? binded : vacant).push_back(getPu(k));
+        }
+        if(vacant.empty()) return -1;
+
+        // Candidates are scanned by logical index and the first best one wins
+        hwloc_obj_t best = nullptr;
+        switch(placement.policy){
+            case PLACEMENT_POLICY::FIRST_VACANT:
+                best = vacant.front();
+                break;
+            case PLACEMENT_POLICY::COMPACT: {
+                int bestScore = -1;
+                for(auto pu: vacant){
+                    int score = 0;
+                    for(auto b: binded) score = std::max(score, closeness(pu, b));
+                    if(score > bestScore){ best = pu; bestScore = score; }
+                }
+                break;
+            }
+            case PLACEMENT_POLICY::SCATTER: {
+                // Minimize the closeness to the nearest binded PU, then the total closeness to all of them
+                std::pair<int, int> bestScore(INT_MAX, INT_MAX);
+                for(auto pu: vacant){
+                    std::pair<int, int> score(0, 0);
+                    for(auto b: binded){
+                        int c = closeness(pu, b);
+                        score.first = std::max(score.first, c);
+                        score.second += c;
+                    }
+                    if(score < bestScore){ best = pu; bestScore = score; }
+                }
+                break;
+            }
+            case PLACEMENT_POLICY::ONE_PER_CORE:
+                for(auto pu: vacant){
+                    hwloc_obj_t core = ancestor(pu, HWLOC_OBJ_CORE);
+                    bool busy = false;
+                    for(auto b: binded) busy |= (ancestor(b, HWLOC_OBJ_CORE) == core);
+                    if(!busy){ best = pu; break; }
+                }
+                break;
+            case PLACEMENT_POLICY::NEAR_PEER: {
+                int peerInd = placement.peer.empty() ? -1 : getPuIfBinded(placement.peer);
+                if(peerInd == -1){
+                    SPDLOG_DEBUG("Peer {} not binded. Placing compactly instead.", placement.peer);
+                    return pickPu(Placement{PLACEMENT_POLICY::COMPACT, ""});
+                }
+                hwloc_obj_t peer = getPu(peerInd);
+                // Same L3 on another core > same package on another core > SMT sibling > anywhere else
+                int bestScore = -1;
+                for(auto pu: vacant){
+                    bool sameCore = ancestor(pu, HWLOC_OBJ_CORE) == ancestor(peer, HWLOC_OBJ_CORE);
+                    bool sameL3 = ancestor(pu, HWLOC_OBJ_L3CACHE) == ancestor(peer, HWLOC_OBJ_L3CACHE);
+                    bool samePackage = ancestor(pu, HWLOC_OBJ_PACKAGE) == ancestor(peer, HWLOC_OBJ_PACKAGE);
+                    int score = sameCore ? 1 : sameL3 ? 3 : samePackage ? 2 : 0;
+                    if(score > bestScore){ best = pu; bestScore = score; }
+                }
+                break;
+            }
+        }
+        return best != nullptr ? (int) best->logical_index : -1;
+    }
 };
 
 #endif //ISLAY_PUBINDER_H
@@ -0,0 +1,134 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_PARAM_H
+#define ISLAY_PARAM_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include <rapidjson/document.h>
+
+namespace ParamDetail {
+
+/**
+ * @brief Current value of a config parameter, shared by all the Param handles of its name
+ */
+struct SlotBase {
+    explicit SlotBase(std::string _name) : name(std::move(_name)) {};
+    virtual ~SlotBase() = default;
+
+    /**
+     * @brief Take the value of the JSON member. False (the value is kept) if its type does not match.
+     */
+    virtual bool refresh(const rapidjson::Value& v) = 0;
+
+    const std::string name;
+};
+
+template<class T>
+struct Slot : SlotBase {
+    static_assert(std::is_same_v<T, int> || std::is_same_v<T, double> || std::is_same_v<T, bool>,
+                  "Param supports int, double, bool and std::string");
+
+    using SlotBase::SlotBase;
+
+    bool refresh(const rapidjson::Value& v) override {
+        if constexpr (std::is_same_v<T, int>) {
+            if (!v.IsInt()) return false;
+            value.store(v.GetInt(), std::memory_order_relaxed);
+        } else if constexpr (std::is_same_v<T, double>) {
+            if (!v.IsNumber()) return false; // As readDoubleParam(), integers are read as double
+            value.store(v.GetDouble(), std::memory_order_relaxed);
+        } else {
+            if (!v.IsBool()) return false;
+            value.store(v.GetBool(), std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    std::atomic<T> value{};
+};
+
+/**
+ * @brief Strings are replaced as a whole (read-copy-update): a reader keeps the string it loaded
+ */
+template<>
+struct Slot<std::string> : SlotBase {
+    using SlotBase::SlotBase;
+
+    bool refresh(const rapidjson::Value& v) override {
+        if (!v.IsString()) return false;
+        std::atomic_store_explicit(&value, std::make_shared<const std::string>(v.GetString(), v.GetStringLength()),
+                                   std::memory_order_release);
+        return true;
+    }
+
+    std::shared_ptr<const std::string> value = std::make_shared<const std::string>();
+};
+
+}
+
+/**
+ * @brief Typed handle of a config parameter, bound once by name with Config::param()
+ *
+ *   Param<int> width = Config::get_instance().param<int>("IMAGE_WIDTH"); // Before the loop
+ *   for (...) { cv::resize(img, out, cv::Size(width, height)); }         // A relaxed atomic load per read
+ *
+ * The handle reads the value last set with Config::set*Param() or loadConfig(), from any thread, without
+ * the name lookup of Config::read*Param(). An unbound handle (unknown name or type) reads T{}.
+ */
+template<class T>
+class Param {
+public:
+    Param() = default;
+
+    T get() const {
+        return slot != nullptr ? slot->value.load(std::memory_order_relaxed) : T{};
+    }
+
+    operator T() const { return get(); }
+
+    bool isBound() const { return slot != nullptr; }
+
+    std::string name() const { return slot != nullptr ? slot->name : ""; }
+
+private:
+    friend class Config;
+    explicit Param(const ParamDetail::Slot<T>* _slot) : slot(_slot) {};
+
+    const ParamDetail::Slot<T>* slot = nullptr;
+};
+
+/**
+ * @brief String parameters load a shared immutable string: ref() does not copy it
+ */
+template<>
+class Param<std::string> {
+public:
+    Param() = default;
+
+    std::shared_ptr<const std::string> ref() const {
+        return slot != nullptr ? std::atomic_load_explicit(&slot->value, std::memory_order_acquire)
+                               : std::make_shared<const std::string>();
+    }
+
+    std::string get() const { return *ref(); }
+
+    operator std::string() const { return get(); }
+
+    bool isBound() const { return slot != nullptr; }
+
+    std::string name() const { return slot != nullptr ? slot->name : ""; }
+
+private:
+    friend class Config;
+    explicit Param(const ParamDetail::Slot<std::string>* _slot) : slot(_slot) {};
+
+    const ParamDetail::Slot<std::string>* slot = nullptr;
+};
+
+#endif //ISLAY_PARAM_H
@@ -0,0 +1,387 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_PIPELINE_H
+#define ISLAY_PIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <typeindex>
+#include <vector>
+
+#include "Worker.h"
+#include "QueueMessenger.hpp"
+
+/**
+ * @brief Statistics of a pipeline stage since it was started
+ */
+struct StageStats {
+    unsigned long long processed = 0; // Number of process() calls completed
+    unsigned long long dropped = 0;   // Messages dropped by the overflow policy of the input ports
+    double throughput = 0;            // Processed items per second
+    double avgServiceMs = 0;          // Time spent in process() excluding the waits on ports
+    double maxServiceMs = 0;
+    double avgQueueMs = 0;            // Time an input message spent in the queue
+    double avgBlockedMs = 0;          // Time per item blocked on full outputs (backpressure)
+    double avgLatencyMs = 0;          // Time from the emission by the source stage to the end of this stage
+};
+
+/**
+ * @brief Message passed between stages
+ */
+template<class T>
+struct PortMsg : public MsgData {
+    T value;
+    std::chrono::steady_clock::time_point sentAt; // When the message was sent by the upstream stage
+    std::chrono::steady_clock::time_point origin; // When the item was emitted by the source stage
+};
+
+class Stage;
+
+/**
+ * @brief Named and typed port of a stage
+ */
+class PortBase {
+protected:
+    Stage* stage;
+    std::string name;
+    std::type_index type;
+
+public:
+    PortBase(Stage* _stage, std::string _name, std::type_index _type, bool isInput);
+    PortBase(const PortBase&) = delete;
+    PortBase& operator=(const PortBase&) = delete;
+    virtual ~PortBase() {};
+
+    const std::string& getName() const { return name; }
+    std::type_index getType() const { return type; }
+
+    /**
+     * @brief Stop passing messages through the port
+     */
+    virtual void close() = 0;
+
+    /**
+     * @brief Number of messages dropped by the overflow policy in the current run
+     */
+    virtual unsigned long long getDropCount() const { return 0; }
+
+    /**
+     * @brief Input port: create a fresh queue for a new run
+     */
+    virtual void open(size_t capacity, OVERFLOW_POLICY policy) {}
+
+    /**
+     * @brief Output port: connect to the current queue of an input port
+     * @return false if the input port does not take the items of this port
+     */
+    virtual bool attach(PortBase* in) { return false; }
+
+    /**
+     * @brief Output port: disconnect from all input ports
+     */
+    virtual void detach() {}
+};
+
+/**
+ * @brief Base class of pipeline stages
+ *   A stage is a worker whose run() calls process() repeatedly. process() receives items from
+ *   input ports, processes them and sends the results to output ports. Stages are connected and run
+ *   by EngineBase (see EngineBase::connect).
+ *
+ *     class Blur : public Stage {
+ *         InPort<cv::Mat> in{this, "in"};
+ *         OutPort<cv::Mat> out{this, "out"};
+ *     public:
+ *         explicit Blur(std::weak_ptr<WorkerManager> wm, AppMsgPtr appMsg): Stage(wm, appMsg){};
+ *         bool process() override {
+ *             cv::Mat img;
+ *             if (!in.receive(img)) return false; // upstream finished
+ *             ...
+ *             return out.send(std::move(result));
+ *         }
+ *     };
+ *
+ *   The stage stops when process() returns false or termination is requested. Its ports are then
+ *   closed, so that the downstream stages finish after draining their inputs and the upstream stages
+ *   blocked on a full output are released.
+ */
+class Stage : public WorkerBase {
+    friend class PortBase;
+    template<class T> friend class InPort;
+    template<class T> friend class OutPort;
+
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit Stage(std::weak_ptr<WorkerManager> _wm, AppMsgPtr _appMsg):
+            WorkerBase(std::move(_wm), std::move(_appMsg)), terminated(false),
+            processed(0), serviceNs(0), maxServiceNs(0), queueNs(0), received(0), blockedNs(0), latencyNs(0),
+            startNs(0), runNs(0), running(false) {};
+
+    static long long nowNs(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * @brief Process one item
+     * @return false to stop the stage
+     */
+    virtual bool process() = 0;
+
+    bool run(const std::shared_ptr<void> data) final {
+        terminated = false;
+        resetStats();
+        startNs.store(nowNs());
+        running.store(true);
+        while (!isTerminated()) {
+            waitNs = 0;
+            origin = Clock::time_point();
+            auto t0 = Clock::now();
+            if (!process()) break;
+            auto t1 = Clock::now();
+            long long serviceTime = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() - waitNs;
+            processed.fetch_add(1, std::memory_order_relaxed);
+            serviceNs.fetch_add(serviceTime, std::memory_order_relaxed);
+            if (serviceTime > maxServiceNs.load(std::memory_order_relaxed))
+                maxServiceNs.store(serviceTime, std::memory_order_relaxed);
+            if (origin != Clock::time_point())
+                latencyNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - origin).count(),
+                                    std::memory_order_relaxed);
+        }
+        runNs.store(nowNs() - startNs.load());
+        running.store(false);
+        closePorts();
+        return true;
+    }
+
+    /**
+     * @brief Returns true once termination has been requested
+     *   Unlike checkIfTerminateRequested(), the request is remembered.
+     */
+    bool isTerminated(){
+        if (!terminated && checkIfTerminateRequested()) terminated = true;
+        return terminated;
+    }
+
+    PortBase* findInput(const std::string& portName) {
+        auto it = inputs.find(portName);
+        return it != inputs.end() ? it->second : nullptr;
+    }
+
+    PortBase* findOutput(const std::string& portName) {
+        auto it = outputs.find(portName);
+        return it != outputs.end() ? it->second : nullptr;
+    }
+
+    StageStats getStats() const;
+
+    /**
+     * @brief Close the input ports, so that the stage and its upstream stages stop.
+     *   Thread-safe, unlike closing the output ports which is left to the stage itself.
+     */
+    void closeInputs(){
+        for (auto& [portName, port]: inputs) port->close();
+    }
+
+    /**
+     * @brief Disconnect the output ports. Only while the stage is idle.
+     */
+    void detachOutputs(){
+        for (auto& [portName, port]: outputs) port->detach();
+    }
+
+private:
+    void closePorts(){
+        closeInputs();
+        for (auto& [portName, port]: outputs) port->close();
+    }
+
+    void resetStats(){
+        processed = 0; serviceNs = 0; maxServiceNs = 0; queueNs = 0; received = 0;
+        blockedNs = 0; latencyNs = 0; runNs = 0;
+    }
+
+    std::map<std::string, PortBase*> inputs;
+    std::map<std::string, PortBase*> outputs;
+    bool terminated;
+
+    // Bookkeeping of the current process() call. Touched by the stage thread only.
+    long long waitNs = 0;
+    Clock::time_point origin;
+
+    std::atomic<unsigned long long> processed;
+    std::atomic<long long> serviceNs;
+    std::atomic<long long> maxServiceNs;
+    std::atomic<long long> queueNs;
+    std::atomic<unsigned long long> received;
+    std::atomic<long long> blockedNs;
+    std::atomic<long long> latencyNs;
+    std::atomic<long long> startNs; // Clock::time_point of the start of the run
+    std::atomic<long long> runNs;   // Duration of the last run once it completes
+    std::atomic<bool> running;
+};
+
+inline PortBase::PortBase(Stage* _stage, std::string _name, std::type_index _type, bool isInput)
+        : stage(_stage), name(std::move(_name)), type(_type) {
+    auto& ports = isInput ? stage->inputs : stage->outputs;
+    if (!ports.emplace(name, this).second) SPDLOG_WARN("Port already exists: {}", name);
+}
+
+template<class T> class OutPort;
+
+/**
+ * @brief Input port receiving items of type T
+ *   Messages from all the output ports connected to it are merged into one bounded queue.
+ */
+template<class T>
+class InPort : public PortBase {
+    friend class OutPort<T>;
+
+    struct Channel {
+        QueueMessenger<PortMsg<T>> queue;
+        std::atomic<int> openProducers;
+        Channel(size_t capacity, OVERFLOW_POLICY policy) : queue(capacity, policy), openProducers(0) {};
+    };
+    std::shared_ptr<Channel> channel;
+
+public:
+    InPort(Stage* _stage, std::string _name) : PortBase(_stage, std::move(_name), typeid(T), true) {};
+
+    /**
+     * @brief Receive an item, sleeping until one arrives
+     * @return false if the input is closed and drained, or termination of the stage is requested
+     */
+    bool receive(T& value){
+        auto ch = std::atomic_load(&channel);
+        if (!ch) return false; // not connected
+        auto t0 = Stage::Clock::now();
+        while (!stage->isTerminated()) {
+            auto msg = ch->queue.waitReceive(std::chrono::milliseconds(100));
+            if (msg == nullptr) {
+                if (ch->queue.isClosed() && !ch->queue.isUpdated()) break;
+                continue;
+            }
+            auto now = Stage::Clock::now();
+            value = std::move(msg->value);
+            if (msg->origin > stage->origin) stage->origin = msg->origin; // Track the newest item in the output
+            stage->queueNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(now - msg->sentAt).count(),
+                                     std::memory_order_relaxed);
+            stage->received.fetch_add(1, std::memory_order_relaxed);
+            ch->queue.release(msg);
+            stage->waitNs += std::chrono::duration_cast<std::chrono::nanoseconds>(now - t0).count();
+            return true;
+        }
+        stage->waitNs += std::chrono::duration_cast<std::chrono::nanoseconds>(Stage::Clock::now() - t0).count();
+        return false;
+    }
+
+    /**
+     * @brief Returns true if an item is waiting in the queue
+     */
+    bool isUpdated() const {
+        auto ch = std::atomic_load(&channel);
+        return ch && ch->queue.isUpdated();
+    }
+
+    unsigned long long getDropCount() const override {
+        auto ch = std::atomic_load(&channel);
+        return ch ? ch->queue.getDropCount() : 0;
+    }
+
+    void open(size_t capacity, OVERFLOW_POLICY policy) override {
+        std::atomic_store(&channel, std::make_shared<Channel>(capacity, policy));
+    }
+
+    void close() override {
+        auto ch = std::atomic_load(&channel);
+        if (ch) ch->queue.close(); // Releases the producers blocked on the full queue
+    }
+};
+
+/**
+ * @brief Output port sending items of type T
+ *   An item is delivered to every input port connected (fan-out). With OVERFLOW_POLICY::BLOCK,
+ *   send() waits while a downstream queue is full, which throttles the stage to its consumers.
+ */
+template<class T>
+class OutPort : public PortBase {
+    std::vector<std::shared_ptr<typename InPort<T>::Channel>> channels;
+
+public:
+    OutPort(Stage* _stage, std::string _name) : PortBase(_stage, std::move(_name), typeid(T), false) {};
+
+    /**
+     * @brief Send an item to all the connected input ports
+     * @return false if none of the downstream stages accepts items any more
+     */
+    bool send(const T& value){
+        auto t0 = Stage::Clock::now();
+        auto origin = stage->origin != Stage::Clock::time_point() ? stage->origin : t0;
+        bool delivered = false;
+        for (auto& ch: channels) {
+            auto msg = ch->queue.prepareMsg();
+            if (msg == nullptr) {
+                delivered |= !ch->queue.isClosed(); // dropped by the overflow policy
+                continue;
+            }
+            msg->value = value;
+            msg->origin = origin;
+            msg->sentAt = Stage::Clock::now();
+            ch->queue.send(msg);
+            delivered = true;
+        }
+        long long blocked = std::chrono::duration_cast<std::chrono::nanoseconds>(Stage::Clock::now() - t0).count();
+        stage->blockedNs.fetch_add(blocked, std::memory_order_relaxed);
+        stage->waitNs += blocked;
+        if (stage->origin == Stage::Clock::time_point()) stage->origin = origin;
+        return delivered;
+    }
+
+    bool attach(PortBase* in) override {
+        auto inPort = dynamic_cast<InPort<T>*>(in);
+        if (inPort == nullptr) return false;
+        auto ch = std::atomic_load(&inPort->channel);
+        if (!ch) return false;
+        ch->openProducers.fetch_add(1);
+        channels.emplace_back(std::move(ch));
+        return true;
+    }
+
+    void detach() override { channels.clear(); }
+
+    /**
+     * @brief The downstream queue is closed once all its producers have closed
+     */
+    void close() override {
+        for (auto& ch: channels) {
+            if (ch->openProducers.fetch_sub(1) == 1) ch->queue.close();
+        }
+        channels.clear();
+    }
+};
+
+inline StageStats Stage::getStats() const {
+    StageStats s;
+    s.processed = processed.load(std::memory_order_relaxed);
+    for (auto& [portName, port]: inputs) s.dropped += port->getDropCount();
+    double elapsedNs = running.load()
+            ? (double) (nowNs() - startNs.load())
+            : (double) runNs.load();
+    if (elapsedNs > 0) s.throughput = s.processed * 1e9 / elapsedNs;
+    if (s.processed > 0) {
+        s.avgServiceMs = serviceNs.load(std::memory_order_relaxed) * 1e-6 / s.processed;
+        s.avgBlockedMs = blockedNs.load(std::memory_order_relaxed) * 1e-6 / s.processed;
+        s.avgLatencyMs = latencyNs.load(std::memory_order_relaxed) * 1e-6 / s.processed;
+    }
+    s.maxServiceMs = maxServiceNs.load(std::memory_order_relaxed) * 1e-6;
+    auto n = received.load(std::memory_order_relaxed);
+    if (n > 0) s.avgQueueMs = queueNs.load(std::memory_order_relaxed) * 1e-6 / n;
+    return s;
+}
+
+#endif //ISLAY_PIPELINE_H
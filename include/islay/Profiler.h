@@ -0,0 +1,288 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_PROFILER_H
+#define ISLAY_PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#elif defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include "Logger.h"
+
+/**
+ * @brief Scoped zone profiler exporting Chrome trace JSON (chrome://tracing, https://ui.perfetto.dev)
+ *
+ *   void Foo::bar(){
+ *       ISLAY_PROFILE_FUNCTION();               // Zone named after the function
+ *       { ISLAY_PROFILE_ZONE("blur"); ... }     // Zone name must be a string literal (its pointer is kept)
+ *   }
+ *   ISLAY_PROFILE_THREAD("WorkerSample", pu);  // Row of the following zones of this thread in the trace
+ *
+ *   Profiler::get_instance().start();
+ *   ...
+ *   Profiler::get_instance().stop();
+ *   Profiler::get_instance().exportChromeTrace(resultDirectory + "/trace.json");
+ *
+ * Each thread writes its zones into its own ring of events without any lock or shared write, so a
+ * zone costs two clock reads and a store while profiling, and a relaxed load otherwise. On x86-64 the
+ * clock is the TSC, converted to nanoseconds of steady_clock at export. A ring keeps
+ * the latest EVENTS_PER_THREAD zones of its thread. It is allocated by the first zone the thread records
+ * while profiling, and freed after the thread exits, by the next exportChromeTrace() or start().
+ * Define ISLAY_DISABLE_PROFILER to compile the macros out.
+ */
+class Profiler {
+public:
+    static constexpr size_t EVENTS_PER_THREAD = 1 << 15;
+
+    struct Event {
+        const char* name;
+        uint64_t begin; // ticks()
+        uint64_t end;
+        uint32_t label; // Index of the thread label at the end of the zone
+    };
+
+    /// Events of a thread. Written only by the thread; read by exportChromeTrace().
+    struct ThreadBuffer {
+        std::unique_ptr<Event[]> events{new Event[EVENTS_PER_THREAD]};
+        std::atomic<uint64_t> head{0};
+        std::atomic<bool> exited{false}; // The thread exited: freed once exported
+        uint32_t tid = 0;
+    };
+
+    static Profiler& get_instance(){
+        // Never destroyed: zones may end in threads outliving static destruction.
+        static Profiler* instance = new Profiler();
+        return *instance;
+    }
+
+    static uint64_t clockNs(){
+        return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * @brief The clock of the zones: the TSC on x86-64 (invariant on the CPUs of this decade), clockNs() otherwise
+     */
+    static uint64_t ticks(){
+#if defined(__x86_64__) || defined(_M_X64)
+        return __rdtsc();
+#else
+        return clockNs();
+#endif
+    }
+
+    /**
+     * @brief Start recording. Zones recorded before are not exported.
+     */
+    void start(){
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            removeExitedThreads(); // Their zones are before this start
+        }
+        startNs.store(clockNs());
+        startTicks.store(ticks());
+        enabled.store(true);
+        SPDLOG_INFO("Profiler started");
+    }
+
+    void stop(){
+        enabled.store(false);
+        stopNs.store(clockNs());
+        stopTicks.store(ticks());
+        SPDLOG_INFO("Profiler stopped");
+    }
+
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Name the row of the following zones of the calling thread, e.g. the worker it runs and its PU
+     * @param pu PU the thread is bound to. -1 if not bound.
+     */
+    void setThreadName(const std::string& name, int pu = -1){
+        std::string label = pu >= 0 ? name + " (PU #" + std::to_string(pu) + ")" : name;
+        std::lock_guard<std::mutex> lock(mtx);
+        uint32_t index = 0;
+        while (index < labels.size() && labels[index] != label) index++;
+        if (index == labels.size()) labels.push_back(label);
+        local().label = index;
+    }
+
+    /**
+     * @brief Record a zone of the calling thread
+     */
+    void record(const char* name, uint64_t begin, uint64_t end){
+        Local& l = local();
+        ThreadBuffer& b = l.buffer ? *l.buffer : threadBuffer();
+        uint64_t h = b.head.load(std::memory_order_relaxed);
+        b.events[h & (EVENTS_PER_THREAD - 1)] = Event{name, begin, end, l.label};
+        b.head.store(h + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Write the zones recorded since start() as Chrome trace JSON. One row per thread and label.
+     */
+    bool exportChromeTrace(const std::string& path){
+        std::ofstream ofs(path);
+        if (!ofs) {
+            SPDLOG_ERROR("Cannot write {}", path);
+            return false;
+        }
+        std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+        std::vector<std::string> currentLabels;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            buffers = threads;
+            currentLabels = labels;
+            removeExitedThreads(); // Exported below for the last time
+        }
+        // Ticks to nanoseconds, calibrated over the recording
+        uint64_t from = startTicks.load(), to = stopTicks.load();
+        double nsPerTick = 1.0;
+        if (enabled.load() || to <= from) {
+            to = ticks();
+            nsPerTick = (double) (clockNs() - startNs.load()) / std::max<uint64_t>(1, to - from);
+        } else {
+            nsPerTick = (double) (stopNs.load() - startNs.load()) / (to - from);
+        }
+
+        ofs << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+        ofs << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"islay\"}}";
+        std::vector<bool> named;
+        size_t count = 0;
+        for (auto& b: buffers) {
+            uint64_t head = b->head.load(std::memory_order_acquire);
+            uint64_t first = head > EVENTS_PER_THREAD ? head - EVENTS_PER_THREAD : 0;
+            std::vector<Event> events;
+            events.reserve(head - first);
+            for (uint64_t i = first; i < head; i++) events.push_back(b->events[i & (EVENTS_PER_THREAD - 1)]);
+            // Events the thread overwrote while they were copied are dropped
+            uint64_t overwritten = b->head.load(std::memory_order_acquire);
+            overwritten = overwritten > EVENTS_PER_THREAD ? overwritten - EVENTS_PER_THREAD : 0;
+
+            named.assign(currentLabels.size(), false);
+            for (uint64_t i = first; i < head; i++) {
+                const Event& e = events[i - first];
+                if (i < overwritten || e.begin < from || e.end > to || e.label >= currentLabels.size()) continue;
+                uint64_t tid = (uint64_t) b->tid << 16 | e.label;
+                if (!named[e.label]) {
+                    named[e.label] = true;
+                    ofs << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+                        << ",\"args\":{\"name\":\"" << escape(currentLabels[e.label]) << " #" << b->tid << "\"}}";
+                }
+                ofs << ",\n{\"name\":\"" << escape(e.name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+                    << ",\"ts\":" << fixed3((e.begin - from) * nsPerTick * 1e-3)
+                    << ",\"dur\":" << fixed3((e.end - e.begin) * nsPerTick * 1e-3) << "}";
+                count++;
+            }
+        }
+        ofs << "\n]}\n";
+        SPDLOG_INFO("Trace of {} zones saved: {}", count, path);
+        return true;
+    }
+
+private:
+    Profiler(){ labels.emplace_back("thread"); }
+
+    /// State of the calling thread
+    struct Local {
+        std::shared_ptr<ThreadBuffer> buffer; // Allocated by the first zone recorded
+        uint32_t label = 0;
+        ~Local(){ if (buffer) buffer->exited.store(true, std::memory_order_release); }
+    };
+
+    static Local& local(){
+        thread_local Local l;
+        return l;
+    }
+
+    ThreadBuffer& threadBuffer(){
+        Local& l = local();
+        auto b = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> lock(mtx);
+        b->tid = ++lastTid;
+        threads.push_back(b); // Kept after the thread exits, until its zones are exported
+        l.buffer = b;
+        return *b;
+    }
+
+    /// mtx held
+    void removeExitedThreads(){
+        threads.erase(std::remove_if(threads.begin(), threads.end(), [](const std::shared_ptr<ThreadBuffer>& b) {
+            return b->exited.load(std::memory_order_acquire);
+        }), threads.end());
+    }
+
+    static std::string escape(const std::string& s){
+        std::string r;
+        for (char c: s) {
+            if (c == '"' || c == '\\') r += '\\';
+            r += c;
+        }
+        return r;
+    }
+
+    static std::string fixed3(double v){
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.3f", v);
+        return buf;
+    }
+
+    std::atomic<bool> enabled{false};
+    std::atomic<uint64_t> startNs{0};
+    std::atomic<uint64_t> stopNs{0};
+    std::atomic<uint64_t> startTicks{0};
+    std::atomic<uint64_t> stopTicks{0};
+    std::mutex mtx; // Guards threads and labels
+    std::vector<std::shared_ptr<ThreadBuffer>> threads;
+    uint32_t lastTid = 0;
+    std::vector<std::string> labels;
+};
+
+/**
+ * @brief Records a zone from its construction to its destruction while the profiler is enabled
+ */
+class ProfileZone {
+public:
+    explicit ProfileZone(const char* _name) : name(_name),
+            begin(Profiler::get_instance().isEnabled() ? Profiler::ticks() : 0) {};
+
+    ~ProfileZone(){
+        if (begin != 0) Profiler::get_instance().record(name, begin, Profiler::ticks());
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    const char* name;
+    uint64_t begin;
+};
+
+#define ISLAY_PROFILE_CONCAT_(a, b) a##b
+#define ISLAY_PROFILE_CONCAT(a, b) ISLAY_PROFILE_CONCAT_(a, b)
+#ifndef ISLAY_DISABLE_PROFILER
+#define ISLAY_PROFILE_ZONE(name) ProfileZone ISLAY_PROFILE_CONCAT(islayProfileZone, __LINE__)(name)
+#define ISLAY_PROFILE_FUNCTION() ISLAY_PROFILE_ZONE(__func__)
+#define ISLAY_PROFILE_THREAD(...) Profiler::get_instance().setThreadName(__VA_ARGS__)
+#else
+#define ISLAY_PROFILE_ZONE(name) do {} while (0)
+#define ISLAY_PROFILE_FUNCTION() do {} while (0)
+#define ISLAY_PROFILE_THREAD(...) do {} while (0)
+#endif
+
+#endif //ISLAY_PROFILER_H
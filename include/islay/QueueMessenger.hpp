@@ -0,0 +1,308 @@
+/**
+ @file QueueMessenger.hpp
+ @brief A bounded multi-producer multi-consumer queue of messages. Unlike InterThreadMessenger, every message
+        sent is delivered unless the overflow policy drops it.
+ @author mhirano<masahiro.dll@gmail.com>
+ */
+
+#ifndef ISLAY_QUEUEMESSENGER_H
+#define ISLAY_QUEUEMESSENGER_H
+
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+
+#include "InterThreadMessenger.hpp"
+
+/**
+ * @brief Behavior of QueueMessenger::prepareMsg() when the queue is full
+ *   BLOCK: Wait until a consumer releases a slot
+ *   DROP_OLDEST: Discard the oldest message waiting in the queue and reuse its slot for the new one. Only if no
+ *                message is waiting (every slot is held by a consumer between receive() and release(), or being
+ *                written by a producer) is the new message discarded: at most one message is lost per prepareMsg().
+ *   DROP_NEWEST: Discard the new message (prepareMsg() returns nullptr)
+ */
+enum class OVERFLOW_POLICY {BLOCK = 0, DROP_OLDEST = 1, DROP_NEWEST = 2};
+
+/**
+ * Class template of the bounded message queue
+ *
+ * All slots are allocated at construction and reused, so a message is written in place by the
+ * producer and read in place by the consumer without any copy.
+ * A slot is owned by one side at a time: the indices of the free slots and of the sent messages go
+ * through two lock-free rings (Vyukov's bounded MPMC queue), so a slot held by a consumer does not
+ * block the messages queued behind it, and DROP_OLDEST can always evict the oldest message waiting.
+ *
+ * Producer:
+ *   auto msg = queue.prepareMsg();  // nullptr if the message is dropped or the queue is closed
+ *   if (msg) { msg->img = ...; queue.send(msg); }
+ * Consumer:
+ *   auto msg = queue.receive();     // nullptr if empty
+ *   if (msg) { ...; queue.release(msg); }
+ *
+ * Messages are delivered in the order they were sent.
+ *
+ * @tparam CustomMsgData A subclass of MsgData passed by the queue.
+ */
+template<class CustomMsgData>
+class QueueMessenger {
+public:
+    /**
+     * @param _capacity Number of slots. Rounded up to a power of two.
+     * @param _policy Behavior when the queue is full. See OVERFLOW_POLICY.
+     */
+    explicit QueueMessenger(size_t _capacity = 16, OVERFLOW_POLICY _policy = OVERFLOW_POLICY::BLOCK)
+            : policy(_policy), prepared(0),
+              dropped_oldest(0), dropped_newest(0), closed(false),
+              signal(&own_signal) {
+        capacity = 2;
+        while (capacity < _capacity) capacity <<= 1;
+        slots.reset(new CustomMsgData[capacity]);
+        free_slots.init(capacity);
+        ready_slots.init(capacity);
+        for (size_t i = 0; i < capacity; i++) free_slots.push(i);
+    }
+
+    QueueMessenger(const QueueMessenger &) = delete;
+    QueueMessenger &operator=(const QueueMessenger &) = delete;
+
+    /**
+     * Claims a free slot and returns the pointer to its CustomMsgData so that the message
+     * data to be sent can be put into it. Must be followed by send().
+     * Returns nullptr if the message is dropped by the overflow policy or the queue is closed.
+     */
+    CustomMsgData *prepareMsg() {
+        while (!isClosed()) {
+            size_t index = 0;
+            if (!free_slots.pop(index)) {
+                switch (policy) {
+                    case OVERFLOW_POLICY::BLOCK:
+                        space_signal.waitFor(std::chrono::milliseconds(10), [this] { return hasSpace() || isClosed(); });
+                        continue;
+                    case OVERFLOW_POLICY::DROP_OLDEST:
+                        if (ready_slots.pop(index)) { // The slot of the oldest waiting message is taken over
+                            dropped_oldest.fetch_add(1, std::memory_order_relaxed);
+                            break;
+                        }
+                        if (hasSpace()) continue; // Consumers emptied the queue meanwhile
+                        dropped_newest.fetch_add(1, std::memory_order_relaxed);
+                        return nullptr;
+                    case OVERFLOW_POLICY::DROP_NEWEST:
+                        dropped_newest.fetch_add(1, std::memory_order_relaxed);
+                        return nullptr;
+                }
+            }
+            CustomMsgData *msg = &slots[index];
+            msg->seqno = prepared.fetch_add(1, std::memory_order_relaxed);
+            msg->timestamps.prepare = MsgData::clockNs();
+            return msg;
+        }
+        return nullptr;
+    }
+
+    /**
+     * Publishes the message prepared by prepareMsg().
+     */
+    void send(CustomMsgData *msg) {
+        msg->timestamps.send = MsgData::clockNs();
+        ready_slots.push(indexOf(msg));
+        signal.load(std::memory_order_acquire)->notify();
+    }
+
+    /**
+     * Takes the oldest message out of the queue.
+     * Returns the pointer to its CustomMsgData, which stays valid until release(); nullptr if the queue is empty.
+     */
+    CustomMsgData *receive() {
+        size_t index;
+        if (!ready_slots.pop(index)) {
+            return nullptr;
+        }
+        CustomMsgData *msg = &slots[index];
+        msg->timestamps.receive = MsgData::clockNs();
+        return msg;
+    }
+
+    /**
+     * Takes the oldest message out of the queue, sleeping until one is sent if the queue is empty.
+     * Returns nullptr if the timeout expired or the queue was closed while empty.
+     */
+    template<class Rep, class Period>
+    CustomMsgData *waitReceive(const std::chrono::duration<Rep, Period> &timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (true) {
+            CustomMsgData *msg = receive();
+            if (msg != nullptr || isClosed()) {
+                return msg;
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) {
+                return nullptr;
+            }
+            // Another consumer may take the message between the wake-up and receive(), hence the loop.
+            signal.load(std::memory_order_acquire)->waitFor(deadline - now, [this] { return isUpdated() || isClosed(); });
+        }
+    }
+
+    /**
+     * Returns true iff the oldest message in the queue is ready to be received.
+     */
+    bool isUpdated() const {
+        return !ready_slots.empty();
+    }
+
+    /**
+     * Route the notification of send() and close() to another signal (used by MsgWaitSet).
+     * Call with nullptr to restore the queue's own signal.
+     */
+    void attachSignal(MsgSignal *s) {
+        signal.store(s != nullptr ? s : &own_signal, std::memory_order_release);
+    }
+
+    /**
+     * Gives the slot of a received message back to producers.
+     */
+    void release(CustomMsgData *msg) {
+        free_slots.push(indexOf(msg));
+        if (policy == OVERFLOW_POLICY::BLOCK) space_signal.notify();
+    }
+
+    /**
+     * Returns the approximate number of messages waiting in the queue.
+     */
+    size_t size() const {
+        return ready_slots.size();
+    }
+
+    size_t getCapacity() const { return capacity; }
+
+    OVERFLOW_POLICY getPolicy() const { return policy; }
+
+    /**
+     * Number of messages discarded by OVERFLOW_POLICY::DROP_OLDEST
+     */
+    unsigned long long getDroppedOldestCount() const { return dropped_oldest.load(std::memory_order_relaxed); }
+
+    /**
+     * Number of messages discarded by OVERFLOW_POLICY::DROP_NEWEST (or by DROP_OLDEST when no message was waiting)
+     */
+    unsigned long long getDroppedNewestCount() const { return dropped_newest.load(std::memory_order_relaxed); }
+
+    unsigned long long getDropCount() const { return getDroppedOldestCount() + getDroppedNewestCount(); }
+
+    /**
+     * Returns true iff the queue has been closed.
+     */
+    bool isClosed() const {
+        return closed.load();
+    }
+
+    /**
+     * Close the queue. Producers blocked in prepareMsg() return nullptr.
+     */
+    void close() {
+        closed.store(true);
+        signal.load(std::memory_order_acquire)->notify();
+        space_signal.notify();
+    }
+
+private:
+    /**
+     * Bounded lock-free MPMC ring of slot indices (Vyukov). Each slot index is in at most one ring at a
+     * time, so a ring as large as the number of slots never overflows.
+     */
+    class IndexRing {
+    public:
+        void init(size_t _capacity) {
+            mask = _capacity - 1;
+            cells.reset(new Cell[_capacity]);
+            for (size_t i = 0; i < _capacity; i++) cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+
+        void push(size_t value) {
+            size_t pos = tail.load(std::memory_order_relaxed);
+            while (true) {
+                Cell &cell = cells[pos & mask];
+                size_t seq = cell.seq.load(std::memory_order_acquire);
+                auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+                if (diff == 0) {
+                    if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        cell.value = value;
+                        cell.seq.store(pos + 1, std::memory_order_seq_cst);
+                        return;
+                    }
+                } else {
+                    pos = tail.load(std::memory_order_relaxed); // Never full: another push got ahead
+                }
+            }
+        }
+
+        bool pop(size_t &value) {
+            size_t pos = head.load(std::memory_order_relaxed);
+            while (true) {
+                Cell &cell = cells[pos & mask];
+                size_t seq = cell.seq.load(std::memory_order_acquire);
+                auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+                if (diff == 0) {
+                    if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        value = cell.value;
+                        cell.seq.store(pos + mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false; // empty
+                } else {
+                    pos = head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool empty() const {
+            size_t pos = head.load(std::memory_order_relaxed);
+            return cells[pos & mask].seq.load(std::memory_order_seq_cst) != pos + 1;
+        }
+
+        size_t size() const {
+            size_t t = tail.load(std::memory_order_relaxed);
+            size_t h = head.load(std::memory_order_relaxed);
+            return t > h ? t - h : 0;
+        }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> seq;
+            size_t value;
+        };
+
+        std::unique_ptr<Cell[]> cells;
+        size_t mask = 0;
+        alignas(64) std::atomic<size_t> tail{0};
+        alignas(64) std::atomic<size_t> head{0};
+    };
+
+    size_t indexOf(const CustomMsgData *msg) const {
+        return static_cast<size_t>(msg - slots.get());
+    }
+
+    bool hasSpace() const {
+        return !free_slots.empty();
+    }
+
+    std::unique_ptr<CustomMsgData[]> slots;
+    size_t capacity;
+    OVERFLOW_POLICY policy;
+
+    IndexRing free_slots;  // Slots producers can prepare
+    IndexRing ready_slots; // Sent messages, oldest first
+    alignas(64) std::atomic<unsigned long long> prepared;
+    alignas(64) std::atomic<unsigned long long> dropped_oldest;
+    std::atomic<unsigned long long> dropped_newest;
+    std::atomic<bool> closed;
+
+    MsgSignal own_signal;
+    MsgSignal space_signal;
+    std::atomic<MsgSignal *> signal;
+};
+
+#endif //ISLAY_QUEUEMESSENGER_H
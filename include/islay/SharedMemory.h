@@ -0,0 +1,148 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_SHAREDMEMORY_H
+#define ISLAY_SHAREDMEMORY_H
+
+#include <string>
+
+#if !WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Logger.h"
+
+/**
+ * @brief A named POSIX shared memory object mapped into the process
+ *   The creator owns the name and unlinks it on destruction, unless the name has been given to another
+ *   object meanwhile; other processes open() it by name. Not available on Windows (isValid() stays false).
+ */
+class SharedMemoryRegion {
+public:
+    SharedMemoryRegion() = default;
+    SharedMemoryRegion(const SharedMemoryRegion&) = delete;
+    SharedMemoryRegion& operator=(const SharedMemoryRegion&) = delete;
+
+    ~SharedMemoryRegion(){ reset(); }
+
+    /**
+     * @brief Create a shared memory object of a size, zero-filled
+     *   Fails if the name exists: open() it to decide whether it may be replaced, then unlink() it.
+     * @param name Name starting with '/', e.g. "/islay_lena"
+     */
+    bool create(const std::string& _name, size_t _size){
+        reset();
+#if !WIN32
+        int fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd == -1) {
+            SPDLOG_ERROR("shm_open failed: {}", _name);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == -1 || ftruncate(fd, (off_t) _size) == -1) {
+            SPDLOG_ERROR("ftruncate failed: {}", _name);
+            close(fd);
+            shm_unlink(_name.c_str());
+            return false;
+        }
+        if (!map(fd, _size, true)) {
+            shm_unlink(_name.c_str());
+            return false;
+        }
+        name = _name;
+        device = st.st_dev;
+        inode = st.st_ino;
+        owner = true;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * @brief Map an existing shared memory object created by another process
+     */
+    bool open(const std::string& _name, bool writable = false){
+        reset();
+#if !WIN32
+        int fd = shm_open(_name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+        if (fd == -1) return false;
+        struct stat st;
+        if (fstat(fd, &st) == -1 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        if (!map(fd, (size_t) st.st_size, writable)) return false;
+        name = _name;
+        device = st.st_dev;
+        inode = st.st_ino;
+        owner = false;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * @brief Remove the name if it still refers to this object, not to one created since under the same name
+     */
+    bool unlink(){
+#if !WIN32
+        if (name.empty()) return false;
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd == -1) return false;
+        struct stat st;
+        bool same = fstat(fd, &st) == 0 && st.st_dev == device && st.st_ino == inode;
+        close(fd);
+        return same && shm_unlink(name.c_str()) == 0;
+#else
+        return false;
+#endif
+    }
+
+    void reset(){
+#if !WIN32
+        if (address != nullptr) munmap(address, length);
+        if (owner) unlink();
+#endif
+        address = nullptr;
+        length = 0;
+        owner = false;
+        name.clear();
+    }
+
+    bool isValid() const { return address != nullptr; }
+    void* data() const { return address; }
+    size_t size() const { return length; }
+    const std::string& getName() const { return name; }
+
+private:
+#if !WIN32
+    bool map(int fd, size_t _size, bool writable){
+        void* p = mmap(nullptr, _size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        close(fd); // The mapping keeps the object
+        if (p == MAP_FAILED) {
+            SPDLOG_ERROR("mmap failed: {} bytes", _size);
+            return false;
+        }
+        address = p;
+        length = _size;
+        return true;
+    }
+#endif
+
+    std::string name;
+#if !WIN32
+    dev_t device = 0;
+    ino_t inode = 0; // Identity of the object, to tell it from a replacement under the same name
+#endif
+    void* address = nullptr;
+    size_t length = 0;
+    bool owner = false;
+};
+
+#endif //ISLAY_SHAREDMEMORY_H
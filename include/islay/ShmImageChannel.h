@@ -0,0 +1,403 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_SHMIMAGECHANNEL_H
+#define ISLAY_SHMIMAGECHANNEL_H
+
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <climits>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#if !WIN32
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#endif
+
+#include <opencv2/opencv.hpp>
+
+#include "Logger.h"
+#include "SharedMemory.h"
+
+/**
+ * Layout of a shared memory image channel "/islay_<channel>":
+ *   ShmChannelHeader | ShmSlotHeader x slotCount | (page aligned) pixels of slot 0 | pixels of slot 1 | ...
+ *
+ * Each slot is a seqlock: its seq is odd while the writer fills it and 2 * (seqno + 1) once published,
+ * so a reader can check that the frame it read was not overwritten meanwhile. The writer never waits.
+ * The atomics are lock-free and therefore address-free, so they work across processes.
+ */
+struct ShmChannelHeader {
+    static constexpr uint32_t MAGIC = 0x59414c53; // "SLAY"
+    static constexpr uint32_t VERSION = 3;
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t writerPid;                 // Process of the writer, to tell a live channel from a crashed one
+    uint64_t slotBytes;                 // Pixel capacity of a slot
+    uint64_t slotStride;                // Distance between the pixels of two slots
+    uint64_t dataOffset;                // Offset of the pixels of slot 0
+    std::atomic<uint64_t> published;    // Number of frames published
+    std::atomic<uint32_t> futexWord;    // Incremented by each publish; readers sleep on it
+    std::atomic<uint32_t> waiters;      // Readers sleeping on futexWord
+    std::atomic<uint32_t> closed;       // Set when the writer is gone or has replaced the channel
+};
+
+struct ShmSlotHeader {
+    std::atomic<uint64_t> seq;
+    uint64_t seqno;                     // Frame number in the channel, from 0
+    uint64_t timestampNs;               // steady_clock (CLOCK_MONOTONIC), comparable between processes
+    int32_t rows, cols, type;           // cv::Mat geometry and type
+    uint32_t step;                      // Bytes per row
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "Shared memory channels need lock-free atomics");
+
+/**
+ * @brief Information of a frame read from a shared memory channel
+ */
+struct ShmFrameInfo {
+    uint64_t seqno = 0;
+    uint64_t timestampNs = 0;
+    uint32_t slot = 0;
+};
+
+namespace ShmImageChannel {
+    inline std::string shmName(const std::string& channel){
+        std::string name = "/islay_" + channel;
+        for (size_t i = 1; i < name.size(); i++) {
+            char c = name[i];
+            if (!std::isalnum((unsigned char) c) && c != '_' && c != '-' && c != '.') name[i] = '_';
+        }
+        return name;
+    }
+
+    inline uint64_t nowNs(){
+        return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    inline uint32_t processId(){
+#if !WIN32
+        return (uint32_t) getpid();
+#else
+        return 0;
+#endif
+    }
+
+    inline bool isProcessAlive(uint32_t pid){
+#if !WIN32
+        return pid != 0 && (kill((pid_t) pid, 0) == 0 || errno == EPERM);
+#else
+        return pid != 0;
+#endif
+    }
+
+    inline void futexWait(std::atomic<uint32_t>* word, uint32_t expected, std::chrono::nanoseconds timeout){
+#if defined(__linux__)
+        struct timespec ts;
+        ts.tv_sec = (time_t) (timeout.count() / 1000000000);
+        ts.tv_nsec = (long) (timeout.count() % 1000000000);
+        // Not FUTEX_PRIVATE: the word is shared between processes
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+        if (word->load() == expected) std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(timeout, std::chrono::microseconds(100)));
+#endif
+    }
+
+    inline void futexWakeAll(std::atomic<uint32_t>* word){
+#if defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+        (void) word;
+#endif
+    }
+}
+
+/**
+ * @brief Producer side of a shared memory image channel
+ *   Zero-copy:  cv::Mat frame = writer.acquire(size, type); ...render into frame...; writer.publish();
+ *   With copy:  writer.write(img);
+ *   Readers in other processes see the latest frames (up to slotCount behind) with ShmImageReader.
+ */
+class ShmImageWriter {
+public:
+    ShmImageWriter() = default;
+    ShmImageWriter(const ShmImageWriter&) = delete;
+    ShmImageWriter& operator=(const ShmImageWriter&) = delete;
+
+    ~ShmImageWriter(){ close(); }
+
+    /**
+     * @brief Create the channel
+     *   A channel of the same name is replaced if it is closed, or if its writer is this process (a channel
+     *   set up again with larger slots) or has died. A channel published by another live process is not.
+     * @param slotBytes Largest frame in bytes
+     * @param slotCount Number of frames a reader may lag behind before it misses frames
+     */
+    bool open(const std::string& channel, size_t slotBytes, uint32_t slotCount = 4){
+        close();
+        std::string name = ShmImageChannel::shmName(channel);
+        if (!takeOver(name)) return false;
+        size_t headerBytes = sizeof(ShmChannelHeader) + sizeof(ShmSlotHeader) * slotCount;
+        size_t dataOffset = (headerBytes + 4095) & ~(size_t) 4095;
+        size_t stride = (slotBytes + 4095) & ~(size_t) 4095;
+        if (!region.create(name, dataOffset + stride * slotCount)) return false;
+
+        header = new (region.data()) ShmChannelHeader();
+        header->magic = ShmChannelHeader::MAGIC;
+        header->version = ShmChannelHeader::VERSION;
+        header->slotCount = slotCount;
+        header->writerPid = ShmImageChannel::processId();
+        header->slotBytes = slotBytes;
+        header->slotStride = stride;
+        header->dataOffset = dataOffset;
+        header->published.store(0);
+        header->futexWord.store(0);
+        header->waiters.store(0);
+        header->closed.store(0);
+        slots = reinterpret_cast<ShmSlotHeader*>(header + 1);
+        for (uint32_t i = 0; i < slotCount; i++) {
+            new (&slots[i]) ShmSlotHeader();
+            slots[i].seq.store(0);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Mark the channel closed and remove its name. Readers attached keep their mapping.
+     */
+    void close(){
+        if (header == nullptr) return;
+        header->closed.store(1);
+        header->futexWord.fetch_add(1);
+        ShmImageChannel::futexWakeAll(&header->futexWord);
+        header = nullptr;
+        slots = nullptr;
+        region.reset();
+    }
+
+    bool isOpen() const { return header != nullptr; }
+
+    size_t getSlotBytes() const { return header != nullptr ? header->slotBytes : 0; }
+
+    /**
+     * @brief A cv::Mat over the next slot, to be filled and then published. Empty if it does not fit.
+     */
+    cv::Mat acquire(cv::Size size, int type){
+        if (header == nullptr) return cv::Mat();
+        size_t step = size.width * CV_ELEM_SIZE(type);
+        if (step * size.height > header->slotBytes) return cv::Mat();
+        uint64_t seqno = header->published.load(std::memory_order_relaxed);
+        ShmSlotHeader& slot = slots[seqno % header->slotCount];
+        slot.seq.store(2 * seqno + 1, std::memory_order_relaxed); // Odd: being written
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.seqno = seqno;
+        slot.rows = size.height;
+        slot.cols = size.width;
+        slot.type = type;
+        slot.step = (uint32_t) step;
+        acquired = true;
+        return cv::Mat(size, type, pixels(seqno % header->slotCount), step);
+    }
+
+    /**
+     * @brief Publish the slot filled after acquire() and wake the readers
+     */
+    void publish(uint64_t timestampNs = ShmImageChannel::nowNs()){
+        if (header == nullptr || !acquired) return;
+        acquired = false;
+        uint64_t seqno = header->published.load(std::memory_order_relaxed);
+        ShmSlotHeader& slot = slots[seqno % header->slotCount];
+        slot.timestampNs = timestampNs;
+        slot.seq.store(2 * seqno + 2, std::memory_order_release);
+        header->published.store(seqno + 1, std::memory_order_release);
+        header->futexWord.fetch_add(1, std::memory_order_seq_cst);
+        if (header->waiters.load(std::memory_order_seq_cst) > 0) ShmImageChannel::futexWakeAll(&header->futexWord);
+    }
+
+    /**
+     * @brief Copy an image into the next slot and publish it
+     */
+    bool write(const cv::Mat& img, uint64_t timestampNs = ShmImageChannel::nowNs()){
+        cv::Mat slot = acquire(img.size(), img.type());
+        if (slot.empty()) return false;
+        img.copyTo(slot);
+        publish(timestampNs);
+        return true;
+    }
+
+private:
+    uint8_t* pixels(uint32_t index){
+        return static_cast<uint8_t*>(region.data()) + header->dataOffset + header->slotStride * index;
+    }
+
+    /**
+     * @brief Free the name of an existing channel unless another live process publishes it. Its readers
+     *   are woken up as from close(), so that they follow the new channel.
+     */
+    static bool takeOver(const std::string& name){
+        SharedMemoryRegion existing;
+        if (!existing.open(name, true)) return true; // Nothing to replace
+        auto* h = static_cast<ShmChannelHeader*>(existing.data());
+        if (existing.size() >= sizeof(ShmChannelHeader) && h->magic == ShmChannelHeader::MAGIC) {
+            if (h->closed.load() == 0) {
+                uint32_t pid = h->version == ShmChannelHeader::VERSION ? h->writerPid : 0;
+                if (pid != ShmImageChannel::processId() && ShmImageChannel::isProcessAlive(pid)) {
+                    SPDLOG_ERROR("{} is published by process {}. Not replaced: close it or use another channel name",
+                                 name, pid);
+                    return false;
+                }
+                if (pid != ShmImageChannel::processId()) {
+                    SPDLOG_WARN("{} was left open by a writer that is gone (process {}). Replacing it", name, pid);
+                }
+                h->closed.store(1);
+            }
+            h->futexWord.fetch_add(1);
+            ShmImageChannel::futexWakeAll(&h->futexWord);
+        } else {
+            SPDLOG_WARN("{} exists but is not an image channel. Replacing it", name);
+        }
+        if (!existing.unlink()) {
+            SPDLOG_ERROR("Failed to remove {}", name);
+            return false;
+        }
+        return true;
+    }
+
+    SharedMemoryRegion region;
+    ShmChannelHeader* header = nullptr;
+    ShmSlotHeader* slots = nullptr;
+    bool acquired = false;
+};
+
+/**
+ * @brief Consumer side of a shared memory image channel, usually in another process
+ *   Latest-value semantics like InterThreadMessenger: a reader that falls behind skips to the newest frame.
+ *
+ *   ShmImageReader reader;
+ *   if (reader.open("lena")) {
+ *       cv::Mat img; ShmFrameInfo info;
+ *       while (reader.waitNext(img, info, std::chrono::milliseconds(100)) || !reader.isClosed()) { ... }
+ *   }
+ */
+class ShmImageReader {
+public:
+    ShmImageReader() = default;
+    ShmImageReader(const ShmImageReader&) = delete;
+    ShmImageReader& operator=(const ShmImageReader&) = delete;
+
+    /**
+     * @brief Attach to a channel. The mapping is writable only for the futex waiter count.
+     */
+    bool open(const std::string& channel){
+        header = nullptr;
+        if (!region.open(ShmImageChannel::shmName(channel), true)) return false;
+        auto* h = static_cast<ShmChannelHeader*>(region.data());
+        if (region.size() < sizeof(ShmChannelHeader) || h->magic != ShmChannelHeader::MAGIC ||
+            h->version != ShmChannelHeader::VERSION || h->slotCount == 0 || h->slotBytes > h->slotStride ||
+            h->dataOffset < sizeof(ShmChannelHeader) + sizeof(ShmSlotHeader) * h->slotCount ||
+            h->dataOffset + h->slotStride * h->slotCount > region.size()) {
+            SPDLOG_WARN("Not an image channel: {}", region.getName());
+            region.reset();
+            return false;
+        }
+        header = h;
+        slots = reinterpret_cast<ShmSlotHeader*>(header + 1);
+        nextSeqno = 0;
+        return true;
+    }
+
+    bool isOpen() const { return header != nullptr; }
+
+    /**
+     * @brief True if the writer has closed or replaced the channel. open() again to follow a replacement.
+     */
+    bool isClosed() const { return header == nullptr || header->closed.load() != 0; }
+
+    /**
+     * @brief Wait for a frame newer than the last one read and copy it
+     * @return false on timeout or if the channel is closed
+     */
+    template<class Rep, class Period>
+    bool waitNext(cv::Mat& out, ShmFrameInfo& info, const std::chrono::duration<Rep, Period>& timeout){
+        cv::Mat view;
+        while (waitNextView(view, info, timeout)) {
+            view.copyTo(out);
+            if (isStillValid(info)) return true; // Otherwise overwritten while copying: take a newer one
+        }
+        return false;
+    }
+
+    /**
+     * @brief Wait for a frame newer than the last one read, without copy
+     *   The view points into the shared memory and may be overwritten by the writer once it has
+     *   published slotCount more frames: check isStillValid() after using it.
+     */
+    template<class Rep, class Period>
+    bool waitNextView(cv::Mat& view, ShmFrameInfo& info, const std::chrono::duration<Rep, Period>& timeout){
+        if (header == nullptr) return false;
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (true) {
+            uint32_t word = header->futexWord.load(std::memory_order_seq_cst);
+            uint64_t published = header->published.load(std::memory_order_acquire);
+            if (published > nextSeqno && peek(published - 1, view, info)) {
+                nextSeqno = published;
+                return true;
+            }
+            if (header->closed.load() != 0) return false;
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) return false;
+            header->waiters.fetch_add(1, std::memory_order_seq_cst);
+            ShmImageChannel::futexWait(&header->futexWord, word, deadline - now);
+            header->waiters.fetch_sub(1, std::memory_order_seq_cst);
+        }
+    }
+
+    /**
+     * @brief True if the frame has not been overwritten since it was read
+     */
+    bool isStillValid(const ShmFrameInfo& info) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slots[info.slot].seq.load(std::memory_order_relaxed) == 2 * info.seqno + 2;
+    }
+
+private:
+    bool peek(uint64_t seqno, cv::Mat& view, ShmFrameInfo& info){
+        uint32_t index = (uint32_t) (seqno % header->slotCount);
+        ShmSlotHeader& slot = slots[index];
+        if (slot.seq.load(std::memory_order_acquire) != 2 * seqno + 2) return false; // Being overwritten
+        // Copy the geometry first and use it only if the slot was not overwritten meanwhile
+        int32_t rows = slot.rows, cols = slot.cols, type = slot.type;
+        uint32_t step = slot.step;
+        info.seqno = seqno;
+        info.timestampNs = slot.timestampNs;
+        info.slot = index;
+        if (!isStillValid(info)) return false;
+        if (rows <= 0 || cols <= 0 || type != CV_MAT_TYPE(type) ||
+            step < (uint64_t) cols * CV_ELEM_SIZE(type) || (uint64_t) rows * step > header->slotBytes) {
+            SPDLOG_WARN("Invalid frame #{} in {}: {}x{} type {} step {}", seqno, region.getName(), cols, rows, type, step);
+            return false;
+        }
+        uint8_t* data = static_cast<uint8_t*>(region.data()) + header->dataOffset + header->slotStride * index;
+        view = cv::Mat(rows, cols, type, data, step);
+        return true;
+    }
+
+    SharedMemoryRegion region;
+    ShmChannelHeader* header = nullptr;
+    ShmSlotHeader* slots = nullptr;
+    uint64_t nextSeqno = 0;
+};
+
+#endif //ISLAY_SHMIMAGECHANNEL_H
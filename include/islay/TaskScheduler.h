@@ -0,0 +1,297 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_TASKSCHEDULER_H
+#define ISLAY_TASKSCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Logger.h"
+#include "PUBinder.h"
+#include "Profiler.h"
+
+/**
+ * @brief A set of tasks to wait for
+ *   The first exception thrown by its tasks is kept and rethrown by TaskScheduler::wait().
+ */
+class TaskGroup {
+    friend class TaskScheduler;
+    std::atomic<int> pending;
+    std::mutex errorMtx;
+    std::exception_ptr error; // First exception of the tasks, guarded by errorMtx
+
+    void setError(std::exception_ptr e){
+        std::lock_guard<std::mutex> lock(errorMtx);
+        if (!error) error = std::move(e);
+    }
+
+    std::exception_ptr takeError(){
+        std::lock_guard<std::mutex> lock(errorMtx);
+        return std::exchange(error, nullptr);
+    }
+
+public:
+    TaskGroup() : pending(0) {};
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+/**
+ * @brief Work-stealing task scheduler for data parallelism inside a worker
+ *   Each scheduler thread is binded to a vacant PU through PUBinder and owns a deque of tasks.
+ *   A thread pushes the tasks it spawns onto its own deque and pops them LIFO (cache-warm),
+ *   and steals FIFO from the other deques when its own is empty.
+ *   Tasks spawned from outside (i.e. from a worker thread) go to a shared injection queue.
+ *   A thread waiting for a TaskGroup runs tasks meanwhile and sleeps only when there is nothing to
+ *   run, so nested spawn/wait inside tasks is fine. A task that throws still completes its group:
+ *   wait() rethrows the first exception of the group once all its tasks are done.
+ *
+ *   Threads are started on first use and only on PUs that are vacant at that time, so they do not
+ *   oversubscribe PUs already binded to other workers. Without a vacant PU, tasks run on the waiting thread.
+ *   The PUs taken stay reserved until the scheduler is destroyed; size the reservation with maxThreads
+ *   (EngineBase takes it as taskSchedulerThreads).
+ *
+ *   Usage (in WorkerBase::run):
+ *     auto scheduler = getTaskScheduler();
+ *     scheduler->parallel_for(0, img.rows, [&](int r0, int r1){ ... process rows [r0, r1) ... });
+ *
+ *     TaskGroup group;
+ *     scheduler->spawn(group, [&]{ ... });
+ *     scheduler->spawn(group, [&]{ ... });
+ *     scheduler->wait(group);
+ */
+class TaskScheduler {
+public:
+    using Task = std::function<void()>;
+
+    /**
+     * @param _maxThreads Maximum number of scheduler threads. 0 uses half of the PUs to leave room for binded workers.
+     *   Each thread keeps its PU from the first use until the scheduler is destroyed: workers run with CPU
+     *   binding afterwards get only the other PUs.
+     */
+    explicit TaskScheduler(std::weak_ptr<PUBinder> _puBinder, unsigned int _maxThreads = 0)
+            : puBinder(std::move(_puBinder)), maxThreads(_maxThreads),
+              queuedCount(0), sleepers(0), stopRequested(false) {
+        if (maxThreads == 0) maxThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    };
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    ~TaskScheduler(){
+        {
+            std::lock_guard<std::mutex> lock(sleepMtx);
+            stopRequested.store(true);
+        }
+        sleepCv.notify_all();
+        for (auto& th: threads) {
+            if (th.joinable()) th.join();
+        }
+        if (auto binder = puBinder.lock()) {
+            for (size_t i = 0; i < threads.size(); i++) binder->unbind(threadName(i));
+        }
+    }
+
+    /**
+     * @brief Set the maximum number of scheduler threads. Effective only before the first use.
+     */
+    void setMaxThreads(unsigned int n){ maxThreads = std::max(1u, n); }
+
+    /**
+     * @brief Number of scheduler threads running (binded to PUs)
+     *   Waits on first use until every thread has tried to bind, so the count does not depend on startup timing.
+     */
+    size_t threadCount(){
+        start();
+        if (settledThreads.load(std::memory_order_acquire) < threads.size()) {
+            std::unique_lock<std::mutex> lock(sleepMtx);
+            startCv.wait(lock, [this] { return settledThreads.load(std::memory_order_acquire) == threads.size(); });
+        }
+        return activeThreads.load();
+    }
+
+    /**
+     * @brief Run a task asynchronously as a part of the group
+     */
+    void spawn(TaskGroup& group, Task task){
+        start();
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        WorkQueue& q = (current == this && currentIndex >= 0) ? *queues[currentIndex] : injection;
+        {
+            std::lock_guard<std::mutex> lock(q.mtx);
+            q.tasks.push_back(TaskItem{&group, std::move(task)});
+        }
+        queuedCount.fetch_add(1, std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_seq_cst) > 0) {
+            { std::lock_guard<std::mutex> lock(sleepMtx); }
+            sleepCv.notify_one();
+        }
+    }
+
+    /**
+     * @brief Run tasks until all the tasks of the group complete
+     *   Rethrows the first exception thrown by a task of the group.
+     */
+    void wait(TaskGroup& group){
+        int self = (current == this) ? currentIndex : -1;
+        while (!group.done()) {
+            if (runOne(self)) continue;
+            // Nothing to run: sleep until a task is queued or the last task of the group completes
+            std::unique_lock<std::mutex> lock(sleepMtx);
+            sleepers.fetch_add(1, std::memory_order_seq_cst);
+            sleepCv.wait(lock, [this, &group] {
+                return group.done() || queuedCount.load(std::memory_order_seq_cst) > 0;
+            });
+            sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+        if (auto error = group.takeError()) std::rethrow_exception(error);
+    }
+
+    /**
+     * @brief Call f(i0, i1) on subranges of [begin, end) in parallel and wait for them
+     * @param grain Size of a subrange. 0 splits the range into about four chunks per thread.
+     */
+    template<class F>
+    void parallel_for(int begin, int end, F&& f, int grain = 0){
+        if (begin >= end) return;
+        if (grain <= 0) grain = std::max(1, (end - begin) / (4 * ((int) threadCount() + 1)));
+        TaskGroup group;
+        for (int i0 = begin; i0 < end; i0 += grain) {
+            int i1 = std::min(end, i0 + grain);
+            spawn(group, [&f, i0, i1] { f(i0, i1); });
+        }
+        wait(group);
+    }
+
+private:
+    struct TaskItem {
+        TaskGroup* group;
+        Task fn;
+    };
+
+    struct WorkQueue {
+        std::mutex mtx;
+        std::deque<TaskItem> tasks;
+    };
+
+    static std::string threadName(size_t index){ return "TaskScheduler#" + std::to_string(index); }
+
+    void start(){
+        std::call_once(started, [this] {
+            for (unsigned int i = 0; i < maxThreads; i++) queues.emplace_back(new WorkQueue);
+            for (unsigned int i = 0; i < maxThreads; i++) threads.emplace_back(&TaskScheduler::loop, this, i);
+        });
+    }
+
+    bool pop(WorkQueue& q, TaskItem& item, bool back){
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (q.tasks.empty()) return false;
+        if (back) {
+            item = std::move(q.tasks.back());
+            q.tasks.pop_back();
+        } else {
+            item = std::move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+        return true;
+    }
+
+    /**
+     * Run one task: own deque (LIFO), then the injection queue, then steal from the others (FIFO).
+     */
+    bool runOne(int self){
+        if (queuedCount.load(std::memory_order_relaxed) == 0) return false;
+        TaskItem item;
+        bool found = (self >= 0 && pop(*queues[self], item, true)) || pop(injection, item, false);
+        size_t base = self >= 0 ? (size_t) self : 0;
+        for (size_t i = 0; !found && i < queues.size(); i++) {
+            size_t victim = (base + i) % queues.size();
+            if ((int) victim != self) found = pop(*queues[victim], item, false);
+        }
+        if (!found) return false;
+        queuedCount.fetch_sub(1, std::memory_order_relaxed);
+        {
+            ISLAY_PROFILE_ZONE("task");
+            try {
+                item.fn();
+            } catch (...) {
+                item.group->setError(std::current_exception());
+            }
+        }
+        if (item.group->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            // Last task of the group: wake its waiter. The group may be gone once the lock is released.
+            { std::lock_guard<std::mutex> lock(sleepMtx); }
+            sleepCv.notify_all();
+        }
+        return true;
+    }
+
+    void loop(unsigned int index){
+#if WIN32
+        std::thread::native_handle_type self = GetCurrentThread();
+#else
+        std::thread::native_handle_type self = pthread_self();
+#endif
+        auto binder = puBinder.lock();
+        int pu = binder ? binder->bindThread(threadName(index), self, std::this_thread::get_id()) : -1;
+        binder.reset();
+        if (pu != -1) activeThreads.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(sleepMtx);
+            settledThreads.fetch_add(1, std::memory_order_release);
+        }
+        startCv.notify_all();
+        if (pu == -1) {
+            // No vacant PU: do not compete with binded workers
+            SPDLOG_DEBUG("{} not started: no vacant PU", threadName(index));
+            return;
+        }
+        ISLAY_PROFILE_THREAD(threadName(index), pu);
+        current = this;
+        currentIndex = (int) index;
+
+        while (!stopRequested.load()) {
+            if (runOne((int) index)) continue;
+            std::unique_lock<std::mutex> lock(sleepMtx);
+            sleepers.fetch_add(1, std::memory_order_seq_cst);
+            sleepCv.wait(lock, [this] { return stopRequested.load() || queuedCount.load(std::memory_order_seq_cst) > 0; });
+            sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::weak_ptr<PUBinder> puBinder;
+    unsigned int maxThreads;
+
+    std::once_flag started;
+    std::vector<std::unique_ptr<WorkQueue>> queues; // One per scheduler thread
+    WorkQueue injection;                             // Tasks spawned from outside the scheduler
+    std::vector<std::thread> threads;
+    std::atomic<size_t> activeThreads{0};
+    std::atomic<size_t> settledThreads{0};           // Threads that have tried to bind, binded or not
+    std::condition_variable startCv;                 // Notified under sleepMtx as threads settle
+
+    std::atomic<long> queuedCount;
+    std::mutex sleepMtx;
+    std::condition_variable sleepCv;
+    std::atomic<int> sleepers;
+    std::atomic<bool> stopRequested;
+
+    static inline thread_local TaskScheduler* current = nullptr;
+    static inline thread_local int currentIndex = -1;
+};
+
+#endif //ISLAY_TASKSCHEDULER_H
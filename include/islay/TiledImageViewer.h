@@ -0,0 +1,396 @@
+//
+// Created by Masahiro Hirano <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_TILEDIMAGEVIEWER_H
+#define ISLAY_TILEDIMAGEVIEWER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "ImageTexture.h"
+
+/**
+ * @brief Zoom/pan viewer for images larger than a texture (GL_MAX_TEXTURE_SIZE) or than VRAM
+ *   The image is split into TILE_SIZE x TILE_SIZE tiles over a pyramid of levels, each half the size
+ *   of the previous one. Only the tiles visible at the level matching the zoom are uploaded, into
+ *   textures kept in an LRU cache of a fixed number of tiles, and at most a few tiles per frame
+ *   so that panning stays interactive. A tile not uploaded yet is drawn from a coarser cached tile.
+ *
+ *   The pyramid is built by one background thread per viewer, which takes the latest image set: an
+ *   image replaced before its build started is skipped, and a build is abandoned as soon as a newer
+ *   image is set. The levels become available one after another; until then the tiles of the previous
+ *   image of the same size stay on screen and are refreshed in place. The image is referenced, not
+ *   copied (cv::Mat refcount), so the sender must not write into it afterwards, as with any image sent
+ *   through AppMsg.
+ *
+ *   Mouse: wheel to zoom at the cursor, drag to pan, double-click to fit.
+ */
+class TiledImageViewer {
+public:
+    static constexpr int TILE_SIZE = 512;
+
+    explicit TiledImageViewer(size_t _cacheCapacity = 128, int _maxUploadsPerFrame = 4)
+            : cacheCapacity(_cacheCapacity), maxUploadsPerFrame(_maxUploadsPerFrame) {};
+
+    TiledImageViewer(const TiledImageViewer&) = delete;
+    TiledImageViewer& operator=(const TiledImageViewer&) = delete;
+
+    ~TiledImageViewer(){
+        stopBuilder();
+        for (auto& tile: lru) glDeleteTextures(1, &tile.texture);
+        if (!freeTextures.empty()) glDeleteTextures((GLsizei) freeTextures.size(), freeTextures.data());
+    }
+
+    /**
+     * @brief Show an image. Single-channel images are mapped to BGR with the mapping.
+     *   Does not wait for the builder: the image replaces any image not built yet.
+     */
+    void setImage(const cv::Mat& image, const ImageDisplayMapping& mapping = ImageDisplayMapping()){
+        if (image.empty()) return;
+        uint64_t gen = generation.fetch_add(1) + 1; // Abandons the build in progress
+
+        bool resized = image.cols != imageWidth || image.rows != imageHeight;
+        if (resized) { // Cached tiles do not match the new tile grid
+            for (auto& tile: lru) freeTextures.push_back(tile.texture);
+            lru.clear();
+            index.clear();
+            fitRequested = true;
+        }
+        imageWidth = image.cols;
+        imageHeight = image.rows;
+        levelCount = 1;
+        while ((imageWidth >> (levelCount - 1)) > TILE_SIZE || (imageHeight >> (levelCount - 1)) > TILE_SIZE) levelCount++;
+
+        bool direct = image.depth() == CV_8U && (image.channels() == 3 || image.channels() == 4);
+        {
+            std::lock_guard<std::mutex> lock(levelMtx);
+            if (direct) {
+                levels.assign(1, image);
+                levelsGeneration = gen;
+            } else if (resized) {
+                levels.clear();
+            } // Otherwise the previous levels are shown until the first level of this image is built
+        }
+        if (direct && levelCount == 1) return;
+
+        {
+            std::lock_guard<std::mutex> lock(buildMtx);
+            pending = Build{image, mapping, direct, levelCount, gen};
+            hasPending = true;
+            if (!builder.joinable()) builder = std::thread(&TiledImageViewer::buildLoop, this);
+        }
+        buildCv.notify_one();
+    }
+
+    /**
+     * @brief True while the pyramid of the last image is not complete
+     */
+    bool isBuilding(){
+        std::lock_guard<std::mutex> lock(levelMtx);
+        return levelsGeneration != generation.load() || (int) levels.size() < levelCount;
+    }
+
+    /**
+     * @brief Draw the viewer as an item of the current window and handle the mouse
+     */
+    void draw(const ImVec2& size){
+        ISLAY_PROFILE_ZONE("draw tiles");
+        frameCount++;
+        uploadsThisFrame = 0;
+        ImVec2 p0 = ImGui::GetCursorScreenPos();
+        ImGui::InvisibleButton("##tiled-image", ImVec2(std::max(size.x, 1.0f), std::max(size.y, 1.0f)));
+        if (imageWidth == 0) return;
+        handleInput(p0, size);
+
+        std::vector<cv::Mat> available;
+        uint64_t availableGeneration;
+        {
+            std::lock_guard<std::mutex> lock(levelMtx);
+            available = levels;
+            availableGeneration = levelsGeneration;
+        }
+        if (available.empty()) {
+            ImGui::GetWindowDrawList()->AddText(p0, IM_COL32(255, 255, 255, 255), "Building image pyramid...");
+            return;
+        }
+
+        // Level whose pixels are closest to the screen pixels without being magnified
+        int wanted = std::max(0, std::min(levelCount - 1, (int) std::floor(std::log2(1.0 / zoom))));
+        // Tiles of the previous image are drawn at the wanted level until the new one is built up to it
+        int level = wanted < (int) available.size() || hasTilesAt(wanted) ? wanted : (int) available.size() - 1;
+
+        // Visible part of the image
+        double x0 = std::max(0.0, panX), y0 = std::max(0.0, panY);
+        double x1 = std::min((double) imageWidth, panX + size.x / zoom);
+        double y1 = std::min((double) imageHeight, panY + size.y / zoom);
+        if (x1 <= x0 || y1 <= y0) return;
+
+        double tileExtent = (double) TILE_SIZE * (1 << level); // Tile size in image pixels
+        int tx0 = (int) (x0 / tileExtent), tx1 = (int) std::ceil(x1 / tileExtent);
+        int ty0 = (int) (y0 / tileExtent), ty1 = (int) std::ceil(y1 / tileExtent);
+        if ((size_t) (tx1 - tx0) * (ty1 - ty0) > cacheCapacity) {
+            // Only finer levels are ready and they do not fit in the cache
+            ImGui::GetWindowDrawList()->AddText(p0, IM_COL32(255, 255, 255, 255), "Building image pyramid...");
+            return;
+        }
+
+        ImDrawList* drawList = ImGui::GetWindowDrawList();
+        drawList->PushClipRect(p0, ImVec2(p0.x + size.x, p0.y + size.y), true);
+        for (int ty = ty0; ty < ty1; ty++) {
+            for (int tx = tx0; tx < tx1; tx++) {
+                // Part of the image covered by the tile
+                double ix0 = tx * tileExtent, iy0 = ty * tileExtent;
+                double ix1 = std::min((double) imageWidth, ix0 + tileExtent);
+                double iy1 = std::min((double) imageHeight, iy0 + tileExtent);
+                int tileLevel = level, ttx = tx, tty = ty;
+                GLuint texture = acquireTile(available, availableGeneration, tileLevel, ttx, tty);
+                // Fall back to the coarser tiles containing this one
+                while (texture == 0 && ++tileLevel < levelCount) {
+                    ttx >>= 1;
+                    tty >>= 1;
+                    texture = findTile(tileLevel, ttx, tty);
+                }
+                if (texture == 0) continue;
+
+                double extent = (double) TILE_SIZE * (1 << tileLevel);
+                ImVec2 uv0((float) ((ix0 - ttx * extent) / extent), (float) ((iy0 - tty * extent) / extent));
+                ImVec2 uv1((float) ((ix1 - ttx * extent) / extent), (float) ((iy1 - tty * extent) / extent));
+                ImVec2 s0((float) (p0.x + (ix0 - panX) * zoom), (float) (p0.y + (iy0 - panY) * zoom));
+                ImVec2 s1((float) (p0.x + (ix1 - panX) * zoom), (float) (p0.y + (iy1 - panY) * zoom));
+                drawList->AddImage((void*) (intptr_t) texture, s0, s1, uv0, uv1);
+            }
+        }
+        drawList->PopClipRect();
+    }
+
+    /**
+     * @brief Screen pixels per image pixel
+     */
+    double getZoom() const { return zoom; }
+
+    ImVec2 getImageSize() const { return ImVec2((float) imageWidth, (float) imageHeight); }
+
+    size_t getCachedTileCount() const { return lru.size(); }
+
+private:
+    struct Tile {
+        uint64_t key;
+        GLuint texture;
+        uint64_t lastUsedFrame;
+        uint64_t generation; // Image the texture was uploaded from
+    };
+
+    /// Image waiting for the builder
+    struct Build {
+        cv::Mat image;
+        ImageDisplayMapping mapping;
+        bool direct = false;
+        int levelCount = 0;
+        uint64_t generation = 0;
+    };
+
+    static uint64_t tileKey(int level, int tx, int ty){
+        return ((uint64_t) level << 48) | ((uint64_t) (uint32_t) ty << 24) | (uint64_t) (uint32_t) tx;
+    }
+
+    /**
+     * @brief Make the next level of an image available. False if a newer image was set meanwhile.
+     */
+    bool publish(const cv::Mat& level, uint64_t gen){
+        std::lock_guard<std::mutex> lock(levelMtx);
+        if (gen != generation.load()) return false;
+        if (levelsGeneration != gen) { // First level of this image: replaces the levels of the previous one
+            levels.clear();
+            levelsGeneration = gen;
+        }
+        levels.push_back(level);
+        return true;
+    }
+
+    void buildLoop(){
+        ISLAY_PROFILE_THREAD("TiledImageViewer");
+        std::unique_lock<std::mutex> lock(buildMtx);
+        while (true) {
+            buildCv.wait(lock, [this] { return hasPending || stopRequested; });
+            if (stopRequested) break;
+            Build job = std::move(pending);
+            pending = Build();
+            hasPending = false;
+            lock.unlock();
+            build(job);
+            job = Build(); // Release the image before waiting
+            lock.lock();
+        }
+    }
+
+    void build(const Build& job){
+        if (job.generation != generation.load()) return; // Already replaced
+        ISLAY_PROFILE_ZONE("build pyramid");
+        cv::Mat level = job.image;
+        if (!job.direct) {
+            ImageTexture::mapToBgr(job.image, job.mapping, level);
+            if (!publish(level, job.generation)) return;
+        }
+        for (int i = 1; i < job.levelCount; i++) {
+            if (job.generation != generation.load()) return;
+            cv::Mat next;
+            cv::resize(level, next, cv::Size((level.cols + 1) / 2, (level.rows + 1) / 2), 0, 0, cv::INTER_AREA);
+            if (!publish(next, job.generation)) return;
+            level = next;
+        }
+    }
+
+    void stopBuilder(){
+        {
+            std::lock_guard<std::mutex> lock(buildMtx);
+            stopRequested = true;
+        }
+        generation.fetch_add(1); // Abandons the build in progress
+        buildCv.notify_one();
+        if (builder.joinable()) builder.join();
+    }
+
+    bool hasTilesAt(int level) const {
+        for (auto& tile: lru) {
+            if ((int) (tile.key >> 48) == level) return true;
+        }
+        return false;
+    }
+
+    GLuint findTile(int level, int tx, int ty){
+        auto it = index.find(tileKey(level, tx, ty));
+        if (it == index.end()) return 0;
+        lru.splice(lru.begin(), lru, it->second); // Most recently used first
+        it->second->lastUsedFrame = frameCount;
+        return it->second->texture;
+    }
+
+    /**
+     * Cached texture of a tile, uploaded now if the budget of the frame allows. 0 if not available.
+     *   A tile of a previous image is refreshed in place once its level of the current image is built;
+     *   until then, or when the budget is spent, it is returned as is.
+     */
+    GLuint acquireTile(const std::vector<cv::Mat>& available, uint64_t availableGeneration, int level, int tx, int ty){
+        bool ready = level < (int) available.size() && uploadsThisFrame < maxUploadsPerFrame;
+        auto it = index.find(tileKey(level, tx, ty));
+        if (it != index.end()) {
+            GLuint texture = findTile(level, tx, ty);
+            if (ready && it->second->generation != availableGeneration) {
+                uploadTile(texture, available[level], tx, ty);
+                it->second->generation = availableGeneration;
+            }
+            return texture;
+        }
+        if (!ready) return 0;
+
+        GLuint texture;
+
+        if (lru.size() >= cacheCapacity) {
+            if (lru.back().lastUsedFrame == frameCount) return 0; // Every cached tile is on screen
+            texture = lru.back().texture;
+            index.erase(lru.back().key);
+            lru.pop_back();
+        } else if (!freeTextures.empty()) {
+            texture = freeTextures.back();
+            freeTextures.pop_back();
+        } else {
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST); // Pixels stay sharp when zoomed in
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TILE_SIZE, TILE_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+
+        uploadTile(texture, available[level], tx, ty);
+        lru.push_front(Tile{tileKey(level, tx, ty), texture, frameCount, availableGeneration});
+        index[lru.front().key] = lru.begin();
+        return texture;
+    }
+
+    void uploadTile(GLuint texture, const cv::Mat& src, int tx, int ty){
+        cv::Rect roi(tx * TILE_SIZE, ty * TILE_SIZE, 0, 0);
+        roi.width = std::min(TILE_SIZE, src.cols - roi.x);
+        roi.height = std::min(TILE_SIZE, src.rows - roi.y);
+        cv::Mat tile = src(roi);
+        GLenum format = src.channels() == 4 ? GL_BGRA : GL_BGR;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+#if defined(IMGUI_IMPL_OPENGL_ES2)
+        cv::Mat continuous = tile.clone(); // No GL_UNPACK_ROW_LENGTH
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, roi.width, roi.height, format, GL_UNSIGNED_BYTE, continuous.data);
+#else
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint) (src.step / src.elemSize())); // Straight from the level image
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, roi.width, roi.height, format, GL_UNSIGNED_BYTE, tile.data);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+#endif
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        uploadsThisFrame++;
+    }
+
+    void handleInput(const ImVec2& p0, const ImVec2& size){
+        if (fitRequested || (ImGui::IsItemHovered() && ImGui::IsMouseDoubleClicked(0))) {
+            zoom = std::min(size.x / imageWidth, size.y / imageHeight);
+            if (zoom <= 0) zoom = 1.0;
+            panX = (imageWidth - size.x / zoom) / 2;
+            panY = (imageHeight - size.y / zoom) / 2;
+            fitRequested = false;
+        }
+        ImGuiIO& io = ImGui::GetIO();
+        if (ImGui::IsItemHovered() && io.MouseWheel != 0) {
+            // Zoom with the image point under the cursor fixed
+            double mx = io.MousePos.x - p0.x, my = io.MousePos.y - p0.y;
+            double px = panX + mx / zoom, py = panY + my / zoom;
+            double fit = std::min(size.x / imageWidth, size.y / imageHeight);
+            zoom = std::max(fit / 4, std::min(64.0, zoom * std::pow(1.25, io.MouseWheel)));
+            panX = px - mx / zoom;
+            panY = py - my / zoom;
+        }
+        if (ImGui::IsItemActive() && ImGui::IsMouseDragging(0)) {
+            panX -= io.MouseDelta.x / zoom;
+            panY -= io.MouseDelta.y / zoom;
+        }
+    }
+
+    size_t cacheCapacity;
+    int maxUploadsPerFrame;
+    int uploadsThisFrame = 0;
+    uint64_t frameCount = 0;
+
+    int imageWidth = 0, imageHeight = 0;
+    int levelCount = 0;
+    double zoom = 1.0;        // Screen pixels per image pixel
+    double panX = 0, panY = 0; // Image coordinates at the top-left corner of the view
+    bool fitRequested = false;
+
+    std::list<Tile> lru;       // Most recently used first
+    std::unordered_map<uint64_t, std::list<Tile>::iterator> index;
+    std::vector<GLuint> freeTextures;
+
+    std::atomic<uint64_t> generation{0}; // Incremented by each image set: older builds are dropped
+
+    std::thread builder;       // Started by the first image that needs a build
+    std::mutex buildMtx;       // Guards pending, hasPending and stopRequested
+    std::condition_variable buildCv;
+    Build pending;             // Latest image not taken by the builder yet
+    bool hasPending = false;
+    bool stopRequested = false;
+
+    std::mutex levelMtx;
+    std::vector<cv::Mat> levels; // Pyramid levels built so far, finest first
+    uint64_t levelsGeneration = 0; // Image of levels
+};
+
+#endif //ISLAY_TILEDIMAGEVIEWER_H
@@ -7,6 +7,8 @@
 
 #include <iostream>
 #include <chrono>
+#include <ratio>
+#include <type_traits>
 
 #include <opencv2/opencv.hpp>
 
@@ -111,12 +113,20 @@ namespace Util {
             return std::chrono::duration_cast<TimeT>(end - begin);
         }
 
+        template<typename TimeT> inline const char* unit(){
+            if (std::is_same<typename TimeT::period, std::nano>::value) return "ns";
+            if (std::is_same<typename TimeT::period, std::micro>::value) return "us";
+            if (std::is_same<typename TimeT::period, std::milli>::value) return "ms";
+            if (std::is_same<typename TimeT::period, std::ratio<1>>::value) return "s";
+            return "?";
+        }
+
+        // Logged and returned in the unit of TimeT (microseconds are not truncated into milliseconds)
         template<typename TimeT, typename F> struct BenchDelegate {
             static long delegatedBenchFunc(F&& f){
                 const auto t = take_time<TimeT>(std::forward<F>(f));
-                std::chrono::duration<long, std::milli> t_ = t;
-                SPDLOG_INFO("{} [ms]", t_.count());
-                return t_.count();
+                SPDLOG_INFO("{} [{}]", (long) t.count(), unit<TimeT>());
+                return (long) t.count();
             }
         };
 
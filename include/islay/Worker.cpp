@@ -7,6 +7,21 @@
 bool WorkerBase::requestCpuBind(
         std::string threadName, std::thread::native_handle_type thread, std::thread::id id
 ) {
-    wm.lock()->puBinder.lock()->bindThread(threadName, thread, id);
+    auto manager = wm.lock();
+    // Binded on behalf of this worker: released when the run of the worker completes
+    manager->puBinder.lock()->bindThread(threadName, thread, id, manager->workerName);
     return true;
 };
+
+bool WorkerBase::requestCpuBindNear(
+        std::string threadName, std::thread::native_handle_type thread, std::thread::id id, std::string peer
+) {
+    auto manager = wm.lock();
+    auto binder = manager->puBinder.lock();
+    binder->setPlacement(threadName, PLACEMENT_POLICY::NEAR_PEER, peer);
+    return binder->bindThread(threadName, thread, id, manager->workerName) != -1;
+};
+
+std::shared_ptr<TaskScheduler> WorkerBase::getTaskScheduler() {
+    return wm.lock()->taskScheduler.lock();
+};
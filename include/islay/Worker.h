@@ -10,6 +10,8 @@
 #include <atomic>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <condition_variable>
 
 #include <typeinfo>
 
@@ -21,13 +23,16 @@
 #include "Logger.h"
 #include "Config.h"
 #include "PUBinder.h"
+#include "Profiler.h"
+#include "WorkerThreadPool.h"
+#include "TaskScheduler.h"
 
 /**
  * @brief Status list of worker
  *   IDLE: The worker is idle
  *   RUNNING: The worker is running
  *   TERMINATE_REQUESTED: The worker is running but termination requested
- *   JOINABLE: The worker is waiting its thread to be joined
+ *   JOINABLE: The worker has returned and its pooled thread is being parked (IDLE follows immediately)
  *
  */
 enum class WORKER_STATUS {NOT_EXIST = 0, IDLE = 1, RUNNING = 2, TERMINATE_REQUESTED = 3, JOINABLE = 4};
@@ -73,16 +78,41 @@ public:
         return false;
     };
 
+    /**
+     * @brief Sleep until termination is requested or the timeout expires
+     *   Idle workers waiting for something to do can use this instead of polling checkIfTerminateRequested().
+     * @return true if termination is requested
+     */
+    template<class Rep, class Period>
+    bool waitTerminateRequest(const std::chrono::duration<Rep, Period> &timeout){
+        auto md = workerStatusMessenger->waitReceive(timeout);
+        return md != nullptr && md->workerStatus == WORKER_STATUS::TERMINATE_REQUESTED;
+    }
+
     bool requestCpuBind(
             std::string workerName, std::thread::native_handle_type thread, std::thread::id id
     ) ;
+
+    /**
+     * @brief Bind a thread to a PU sharing the cache with a peer (e.g. the worker itself)
+     *   See PLACEMENT_POLICY::NEAR_PEER.
+     */
+    bool requestCpuBindNear(
+            std::string threadName, std::thread::native_handle_type thread, std::thread::id id, std::string peer
+    ) ;
+
+    /**
+     * @brief Task scheduler shared by the workers of the engine, for data parallelism inside run()
+     *   See TaskScheduler.
+     */
+    std::shared_ptr<TaskScheduler> getTaskScheduler();
 };
 
 /**
  * @brief Worker manager
  *   This class manages the behavior of the worker, including
  *   - hold worker instance
- *   - thread management
+ *   - dispatch to a pooled thread (see WorkerThreadPool)
  *   - status management
  *
  *   Users should use this manager to control workers.
@@ -104,13 +134,17 @@ public:
  */
 class WorkerManager: public std::enable_shared_from_this<WorkerManager>{
 public:
-    std::thread thisThread;
     std::string workerName;
     std::atomic<WORKER_STATUS> status;
     std::shared_ptr<WorkerBase> t;
     std::weak_ptr<PUBinder> puBinder;
+    std::weak_ptr<WorkerThreadPool> threadPool;
+    std::weak_ptr<TaskScheduler> taskScheduler;
 
 private:
+    std::mutex statusMtx;
+    std::condition_variable statusCv; // Notified when a run completes
+
     /**
      * @brief Constructor of WorkerManager
      * User may want to override this function to specify how to terminate the workersers
@@ -122,22 +156,28 @@ private:
     explicit WorkerManager() { };
 
     template<class T>
-    void init(std::string _workerName, std::weak_ptr<PUBinder> _puBinder, AppMsgPtr _appMsg ){
+    void init(std::string _workerName, std::weak_ptr<PUBinder> _puBinder,
+              std::weak_ptr<WorkerThreadPool> _threadPool, std::weak_ptr<TaskScheduler> _taskScheduler,
+              AppMsgPtr _appMsg ){
         workerName = std::move(_workerName);
         status = WORKER_STATUS::IDLE;
         puBinder = std::move(_puBinder);
+        threadPool = std::move(_threadPool);
+        taskScheduler = std::move(_taskScheduler);
         t = std::make_shared<T>(this->shared_from_this(), _appMsg);
     }
 
 public:
     template <class T>
     static std::shared_ptr<WorkerManager> createWorkerManager(
-            std::string _workerName, std::weak_ptr<PUBinder> _puBinder, AppMsgPtr _appMsg
+            std::string _workerName, std::weak_ptr<PUBinder> _puBinder,
+            std::weak_ptr<WorkerThreadPool> _threadPool, std::weak_ptr<TaskScheduler> _taskScheduler,
+            AppMsgPtr _appMsg
     ) {
         struct OBJ: WorkerManager{};
         auto sp = std::make_shared<OBJ>();
 //        auto sp = std::make_shared<WorkerManager>(); // private constructor can not be accessed.
-        sp->template init<T>(_workerName, _puBinder, _appMsg);
+        sp->template init<T>(_workerName, _puBinder, _threadPool, _taskScheduler, _appMsg);
         return sp;
     }
 
@@ -149,14 +189,15 @@ public:
     explicit WorkerManager(WorkerManager&& mg){
 //        SPDLOG_DEBUG("Move constructor of WorkerManager launched");
         workerName = std::move(mg.workerName);
-        thisThread = std::move(mg.thisThread);
         status.store(mg.status.load());
         t = std::move(mg.t);
         puBinder = std::move(mg.puBinder);
+        threadPool = std::move(mg.threadPool);
+        taskScheduler = std::move(mg.taskScheduler);
     }
 
     ~WorkerManager(){
-        if (thisThread.joinable()) thisThread.join();
+        reset(); // The pooled thread refers to this instance until the run completes
     };
 
     /**
@@ -178,59 +219,67 @@ public:
     WORKER_STATUS getStatus(){ return status.load(); }
 
     /**
-     * @brief Join the thread
-     * @return true if the worker is successfully reset
+     * @brief Wait for the current run to complete
+     *   The pooled thread returns the worker to IDLE by itself, so this is only needed to block until completion.
+     * @return true if the worker was running and has been waited for
      */
     bool reset(){
-        if (!thisThread.joinable()){ return false; }
-        thisThread.join();
+        std::unique_lock<std::mutex> lock(statusMtx);
+        if (status.load() == WORKER_STATUS::IDLE){ return false; }
+        statusCv.wait(lock, [this]{ return status.load() == WORKER_STATUS::IDLE; });
         SPDLOG_DEBUG("***********************RESET {}**********************", workerName);
         return true;
     };
 
     /**
-     * @brief Runs worker in the thread managed by WorkerManager
+     * @brief Runs worker in a pooled thread
      * TODO: data should be thread protected.
      */
     bool runWorker(std::shared_ptr<void> data = nullptr){
-        if (status.load() == WORKER_STATUS::IDLE) {
-            thisThread = std::thread ([this, data] {
-                SPDLOG_INFO("Worker launched: {}", workerName);
-                status.store(WORKER_STATUS::RUNNING);
-                t->run(data);
-                status.store(WORKER_STATUS::JOINABLE);
-                SPDLOG_INFO("Worker completed: {}", workerName);
-            });
-        } else {
-            SPDLOG_INFO("{} is already running", workerName);
-        }
-        return true;
+        return dispatch(std::move(data), false);
     }
 
+    /**
+     * @brief Runs worker in a pooled thread binded to a PU
+     *   The binding is kept after the run, so that following runs stay on the same PU.
+     */
     bool runWorkerCpuBinded(std::shared_ptr<void> data = nullptr){
-        if (status.load() == WORKER_STATUS::IDLE) {
-            thisThread = std::thread([this, data] {
-                unsigned int logical_id = puBinder.lock()->bindThread(
-                        workerName, thisThread.native_handle(), thisThread.get_id());
-                if(logical_id != -1){
-                    SPDLOG_DEBUG("{} binded to PU #{} (thread id:{})",
-                                 workerName, logical_id, id_to_str(thisThread.get_id()));
-                } else {
-                    SPDLOG_WARN("Failed to bind the thread to a PU. No vacant PUs.");
-                }
-                SPDLOG_INFO("Worker launched: {}", workerName);
-                status.store(WORKER_STATUS::RUNNING);
-                t->run(data);
-                status.store(WORKER_STATUS::JOINABLE);
-                SPDLOG_INFO("Worker completed: {}", workerName);
-                // Unregister the binding
-                if(puBinder.lock()->unbind(workerName))
-                    SPDLOG_DEBUG("Worker unbinded: {}", workerName);
-            });
-        } else {
+        return dispatch(std::move(data), true);
+    }
+
+private:
+    bool dispatch(std::shared_ptr<void> data, bool cpuBind){
+        WORKER_STATUS expected = WORKER_STATUS::IDLE;
+        if (!status.compare_exchange_strong(expected, WORKER_STATUS::RUNNING)) {
             SPDLOG_INFO("{} is already running", workerName);
+            return true;
         }
-        return true;
+        auto pool = threadPool.lock();
+        if (!pool) {
+            SPDLOG_WARN("Worker thread pool is gone: {}", workerName);
+            status.store(WORKER_STATUS::IDLE);
+            return false;
+        }
+        return pool->dispatch(workerName, [this, data] {
+            Logger::get_instance().setThreadName(workerName);
+            SPDLOG_INFO("Worker launched: {}", workerName);
+            {
+                auto binder = puBinder.lock();
+                ISLAY_PROFILE_THREAD(workerName, binder ? binder->getPuIfBinded(workerName) : -1);
+                ISLAY_PROFILE_ZONE("run");
+                binder.reset();
+                t->run(data);
+            }
+            if (auto binder = puBinder.lock()) binder->unbindSubThreads(workerName); // e.g. threads binded by requestCpuBind
+            status.store(WORKER_STATUS::JOINABLE);
+            SPDLOG_INFO("Worker completed: {}", workerName);
+        }, cpuBind, [this] {
+            // Back to the pool, which parked the thread first: the next run finds the thread keeping the binding.
+            // Notify under the lock, as a waiter may destroy this instance.
+            std::lock_guard<std::mutex> lock(statusMtx);
+            status.store(WORKER_STATUS::IDLE);
+            statusCv.notify_all();
+        });
     }
 };
 
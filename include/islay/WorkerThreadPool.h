@@ -0,0 +1,186 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+#ifndef ISLAY_WORKERTHREADPOOL_H
+#define ISLAY_WORKERTHREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Logger.h"
+#include "PUBinder.h"
+
+/**
+ * @brief Pool of persistent threads that run workers
+ *   Instead of creating and joining a std::thread for every run, a worker is dispatched onto a parked
+ *   thread, which parks again once the worker returns. Threads are created on demand and kept for
+ *   the lifetime of the pool (owned by EngineBase).
+ *
+ *   A thread bound to a PU on behalf of a worker keeps the binding after the run and is reserved
+ *   for that worker, so the next binded run of the worker lands on the same PU without rebinding.
+ *   The binding is released by release() (e.g. when the worker is deleted) or with the pool.
+ */
+class WorkerThreadPool {
+private:
+    struct PooledThread {
+        std::thread thread;
+        std::function<void()> job;
+        std::function<void()> done;
+        std::string boundTo; // Worker whose PU binding this thread keeps. Empty if unbound.
+        bool busy = false;
+        bool exitRequested = false;
+        std::condition_variable cv;
+    };
+
+    std::mutex mtx;
+    std::list<std::unique_ptr<PooledThread>> threads;
+    std::weak_ptr<PUBinder> puBinder;
+
+public:
+    explicit WorkerThreadPool(std::weak_ptr<PUBinder> _puBinder) : puBinder(std::move(_puBinder)) {};
+
+    WorkerThreadPool(const WorkerThreadPool&) = delete;
+    WorkerThreadPool& operator=(const WorkerThreadPool&) = delete;
+
+    ~WorkerThreadPool(){
+        std::list<std::unique_ptr<PooledThread>> stopping;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping.swap(threads);
+            for (auto& pt: stopping) {
+                pt->exitRequested = true;
+                pt->cv.notify_one();
+            }
+        }
+        for (auto& pt: stopping) stop(*pt);
+    }
+
+    /**
+     * @brief Run a job on a parked thread
+     * @param owner Name of the worker
+     * @param job Job to run
+     * @param cpuBind Run on a thread binded to a PU. The thread keeping the binding of the owner is reused if any.
+     * @param done Called once the thread is parked again (idle, and found by the next dispatch of the owner),
+     *   e.g. to report the completion of the worker
+     */
+    bool dispatch(const std::string& owner, std::function<void()> job, bool cpuBind, std::function<void()> done = nullptr){
+        std::lock_guard<std::mutex> lock(mtx);
+        PooledThread* pt = nullptr;
+        if (cpuBind) pt = findIdle(owner);
+        if (pt == nullptr) pt = findIdle("");
+        if (pt == nullptr) {
+            threads.emplace_back(new PooledThread);
+            pt = threads.back().get();
+            pt->thread = std::thread(&WorkerThreadPool::loop, this, pt);
+            SPDLOG_DEBUG("Worker thread pool grown to {} threads", threads.size());
+        }
+
+        if (cpuBind && pt->boundTo != owner) {
+            pt->job = [this, pt, owner, job = std::move(job)] {
+                bind(*pt, owner);
+                job();
+            };
+        } else {
+            pt->job = std::move(job);
+        }
+        pt->done = std::move(done);
+        pt->busy = true;
+        pt->cv.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Release the PU binding kept for a worker and retire its thread
+     *   Blocks until the thread finishes if it is still running the worker.
+     */
+    bool release(const std::string& owner){
+        std::unique_ptr<PooledThread> retired;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (auto it = threads.begin(); it != threads.end(); it++) {
+                if ((*it)->boundTo == owner) {
+                    retired = std::move(*it);
+                    threads.erase(it);
+                    break;
+                }
+            }
+            if (!retired) return false;
+            retired->exitRequested = true;
+            retired->cv.notify_one();
+        }
+        stop(*retired);
+        return true;
+    }
+
+    size_t size(){
+        std::lock_guard<std::mutex> lock(mtx);
+        return threads.size();
+    }
+
+    size_t idleCount(){
+        std::lock_guard<std::mutex> lock(mtx);
+        size_t n = 0;
+        for (auto& pt: threads) if (!pt->busy) n++;
+        return n;
+    }
+
+private:
+    PooledThread* findIdle(const std::string& boundTo){
+        for (auto& pt: threads) {
+            if (!pt->busy && pt->boundTo == boundTo) return pt.get();
+        }
+        return nullptr;
+    }
+
+    void bind(PooledThread& pt, const std::string& owner){
+        auto binder = puBinder.lock();
+        if (!binder) return;
+        int logical_id = binder->bindThread(owner, pt.thread.native_handle(), pt.thread.get_id());
+        if (logical_id != -1) {
+            SPDLOG_DEBUG("{} binded to PU #{} (thread id:{})", owner, logical_id, id_to_str(pt.thread.get_id()));
+            std::lock_guard<std::mutex> lock(mtx);
+            pt.boundTo = owner;
+        } else {
+            SPDLOG_WARN("Failed to bind the thread of {} to a PU", owner);
+        }
+    }
+
+    void stop(PooledThread& pt){
+        if (pt.thread.joinable()) pt.thread.join();
+        if (!pt.boundTo.empty()) {
+            auto binder = puBinder.lock();
+            if (binder && binder->unbind(pt.boundTo))
+                SPDLOG_DEBUG("Worker unbinded: {}", pt.boundTo);
+        }
+    }
+
+    void loop(PooledThread* pt){
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true) {
+            pt->cv.wait(lock, [pt] { return pt->job || pt->exitRequested; });
+            if (!pt->job) break; // exit requested while parked
+            auto job = std::move(pt->job);
+            auto done = std::move(pt->done);
+            pt->job = nullptr;
+            pt->done = nullptr;
+            lock.unlock();
+            job();
+            lock.lock();
+            pt->busy = false;
+            if (done) {
+                lock.unlock();
+                done();
+                lock.lock();
+            }
+            if (pt->exitRequested) break;
+        }
+    }
+};
+
+#endif //ISLAY_WORKERTHREADPOOL_H
@@ -5,23 +5,51 @@
 #ifndef ISLAY_IMGUI_APPS_H
 #define ISLAY_IMGUI_APPS_H
 
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <deque>
+#include <functional>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <rapidjson/document.h>
 #include <rapidjson/filereadstream.h>
 #include <rapidjson/filewritestream.h>
 #include <rapidjson/prettywriter.h>
 
+#include "LogStore.h"
+
 // Usage:
 //  static ExampleAppLog my_log;
 //  my_log.AddLog("Hello %d world\n", 123);
+//  my_log.AddEntry(logEntry); // With time, level and worker columns. See LogStore
 //  my_log.Draw("title");
+//
+// Keeps the latest CAPACITY lines in a ring. The lines passing the filters are indexed as they arrive,
+// so a filtered view costs the same as the full one and is clipped to the visible rows.
 struct ExampleAppLog
 {
-    ImGuiTextBuffer     Buf;
-    ImGuiTextFilter     Filter;
-    ImVector<int>       LineOffsets;        // Index to lines offset. We maintain this with AddLog() calls, allowing us to have a random access on lines
-    bool                AutoScroll;     // Keep scrolling if already at the bottom
+    static constexpr size_t CAPACITY = 1 << 17;
+    static constexpr int NO_LEVEL = -1;         // Lines of AddLog()
+
+    struct Line {
+        std::string time;                       // Empty on the continuation lines of a message
+        int level = NO_LEVEL;                   // spdlog::level::level_enum
+        std::string worker;
+        std::string text;
+    };
+
+    std::vector<Line>   Lines;                  // Ring of lines. Absolute index i is at Lines[i % CAPACITY]
+    size_t              First = 0;              // Absolute index of the oldest line kept
+    size_t              End = 0;                // Absolute index of the next line
+    ImGuiTextFilter     Filter;                 // On the message
+    int                 MinLevel = 0;           // Lowest level shown (trace)
+    std::string         Worker;                 // Worker shown. Empty: all
+    std::vector<std::string> Workers;           // Workers seen, for the worker filter
+    std::deque<size_t>  Matches;                // Absolute indexes of the lines passing the filters, up to FilteredEnd
+    size_t              FilteredEnd = 0;
+    bool                AutoScroll;             // Keep scrolling if already at the bottom
 
     ExampleAppLog()
     {
@@ -31,21 +59,36 @@ struct ExampleAppLog
 
     void    Clear()
     {
-        Buf.clear();
-        LineOffsets.clear();
-        LineOffsets.push_back(0);
+        Lines.clear();
+        First = End = FilteredEnd = 0;
+        Matches.clear();
     }
 
     void    AddLog(const char* fmt, ...) IM_FMTARGS(2)
     {
-        int old_size = Buf.size();
+        char small[512];
         va_list args;
         va_start(args, fmt);
-        Buf.appendfv(fmt, args);
+        int n = vsnprintf(small, sizeof(small), fmt, args);
         va_end(args);
-        for (int new_size = Buf.size(); old_size < new_size; old_size++)
-            if (Buf[old_size] == '\n')
-                LineOffsets.push_back(old_size + 1);
+        if (n < 0) return;
+        std::string text;
+        if ((size_t) n < sizeof(small)) {
+            text.assign(small, n);
+        } else {
+            text.resize(n + 1);
+            va_start(args, fmt);
+            vsnprintf(&text[0], text.size(), fmt, args);
+            va_end(args);
+            text.resize(n);
+        }
+        if (!text.empty() && text.back() == '\n') text.pop_back();
+        AddLines("", NO_LEVEL, "", text);
+    }
+
+    void    AddEntry(const LogEntry& e)
+    {
+        AddLines(e.timeString("%H:%M:%S"), (int) e.level, e.thread, e.text);
     }
 
     void    Draw(const char* title, bool* p_open = NULL)
@@ -71,68 +114,168 @@ struct ExampleAppLog
         ImGui::SameLine();
         bool copy = ImGui::Button("Copy");
         ImGui::SameLine();
-        Filter.Draw("Filter", -100.0f);
-
+        bool refilter = false;
+        ImGui::SetNextItemWidth(80.0f);
+        if (ImGui::BeginCombo("##level", LevelName(MinLevel)))
+        {
+            for (int level = 0; level <= (int) spdlog::level::critical; level++)
+                if (ImGui::Selectable(LevelName(level), level == MinLevel)) { MinLevel = level; refilter = true; }
+            ImGui::EndCombo();
+        }
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(120.0f);
+        if (ImGui::BeginCombo("##worker", Worker.empty() ? "All workers" : Worker.c_str()))
+        {
+            if (ImGui::Selectable("All workers", Worker.empty())) { Worker.clear(); refilter = true; }
+            for (auto& w: Workers)
+                if (ImGui::Selectable(w.c_str(), w == Worker)) { Worker = w; refilter = true; }
+            ImGui::EndCombo();
+        }
+        ImGui::SameLine();
+        refilter |= Filter.Draw("Filter", -100.0f);
         ImGui::Separator();
-        ImGui::BeginChild("scrolling", ImVec2(0,0), false, ImGuiWindowFlags_HorizontalScrollbar);
 
         if (clear)
             Clear();
+        if (refilter)
+        {
+            Matches.clear();
+            FilteredEnd = First;
+        }
+        bool filtered = IsFiltering();
+        if (filtered)
+            UpdateMatches();
+        size_t rows = filtered ? Matches.size() : End - First;
+        auto lineOfRow = [&](size_t row) -> const Line& { return Lines[(filtered ? Matches[row] : First + row) % CAPACITY]; };
         if (copy)
-            ImGui::LogToClipboard();
-
-        ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 0));
-        const char* buf = Buf.begin();
-        const char* buf_end = Buf.end();
-        if (Filter.IsActive())
         {
-            // In this example we don't use the clipper when Filter is enabled.
-            // This is because we don't have a random access on the result on our filter.
-            // A real application processing logs with ten of thousands of entries may want to store the result of search/filter.
-            // especially if the filtering function is not trivial (e.g. reg-exp).
-            for (int line_no = 0; line_no < LineOffsets.Size; line_no++)
+            std::string text;
+            for (size_t row = 0; row < rows; row++)
             {
-                const char* line_start = buf + LineOffsets[line_no];
-                const char* line_end = (line_no + 1 < LineOffsets.Size) ? (buf + LineOffsets[line_no + 1] - 1) : buf_end;
-                if (Filter.PassFilter(line_start, line_end))
-                    ImGui::TextUnformatted(line_start, line_end);
+                const Line& line = lineOfRow(row);
+                text += line.time + "\t" + LevelName(line.level) + "\t" + line.worker + "\t" + line.text + "\n";
             }
+            ImGui::SetClipboardText(text.c_str());
         }
-        else
+
+        ImGuiTableFlags flags = ImGuiTableFlags_ScrollY | ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable |
+                                ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_SizingFixedFit;
+        if (ImGui::BeginTable("lines", 4, flags))
         {
-            // The simplest and easy way to display the entire buffer:
-            //   ImGui::TextUnformatted(buf_begin, buf_end);
-            // And it'll just work. TextUnformatted() has specialization for large blob of text and will fast-forward to skip non-visible lines.
-            // Here we instead demonstrate using the clipper to only process lines that are within the visible area.
-            // If you have tens of thousands of items and their processing cost is non-negligible, coarse clipping them on your side is recommended.
-            // Using ImGuiListClipper requires A) random access into your data, and B) items all being the  same height,
-            // both of which we can handle since we an array pointing to the beginning of each line of text.
-            // When using the filter (in the block of code above) we don't have random access into the data to display anymore, which is why we don't use the clipper.
-            // Storing or skimming through the search result would make it possible (and would be recommended if you want to search through tens of thousands of entries)
+            ImGui::TableSetupScrollFreeze(0, 1);
+            ImGui::TableSetupColumn("Time");
+            ImGui::TableSetupColumn("Level");
+            ImGui::TableSetupColumn("Worker");
+            ImGui::TableSetupColumn("Message", ImGuiTableColumnFlags_WidthStretch);
+            ImGui::TableHeadersRow();
+
             ImGuiListClipper clipper;
-            clipper.Begin(LineOffsets.Size);
+            clipper.Begin((int) rows);
             while (clipper.Step())
             {
-                for (int line_no = clipper.DisplayStart; line_no < clipper.DisplayEnd; line_no++)
+                for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
                 {
-                    const char* line_start = buf + LineOffsets[line_no];
-                    const char* line_end = (line_no + 1 < LineOffsets.Size) ? (buf + LineOffsets[line_no + 1] - 1) : buf_end;
-                    ImGui::TextUnformatted(line_start, line_end);
+                    const Line& line = lineOfRow((size_t) row);
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::TextUnformatted(line.time.c_str());
+                    ImGui::TableNextColumn();
+                    if (line.level != NO_LEVEL && !line.time.empty())
+                        ImGui::TextColored(LevelColor(line.level), "%s", LevelName(line.level));
+                    ImGui::TableNextColumn();
+                    if (!line.time.empty())
+                        ImGui::TextUnformatted(line.worker.c_str());
+                    ImGui::TableNextColumn();
+                    ImGui::TextUnformatted(line.text.c_str(), line.text.c_str() + line.text.size());
                 }
             }
             clipper.End();
+
+            if (AutoScroll && ImGui::GetScrollY() >= ImGui::GetScrollMaxY())
+                ImGui::SetScrollHereY(1.0f);
+            ImGui::EndTable();
         }
-        ImGui::PopStyleVar();
+        ImGui::End();
+    }
 
-        if (AutoScroll && ImGui::GetScrollY() >= ImGui::GetScrollMaxY())
-            ImGui::SetScrollHereY(1.0f);
+private:
+    bool    IsFiltering() const
+    {
+        return Filter.IsActive() || MinLevel > 0 || !Worker.empty();
+    }
 
-        ImGui::EndChild();
-        ImGui::End();
+    bool    PassFilter(const Line& line) const
+    {
+        if (line.level != NO_LEVEL && line.level < MinLevel)
+            return false;
+        if (!Worker.empty() && line.worker != Worker)
+            return false;
+        return Filter.PassFilter(line.text.c_str(), line.text.c_str() + line.text.size());
+    }
+
+    // Filter only the lines added since the last frame, and forget the matches of discarded lines
+    void    UpdateMatches()
+    {
+        while (!Matches.empty() && Matches.front() < First)
+            Matches.pop_front();
+        for (size_t i = std::max(FilteredEnd, First); i < End; i++)
+            if (PassFilter(Lines[i % CAPACITY]))
+                Matches.push_back(i);
+        FilteredEnd = End;
+    }
+
+    // One line per row, so that the clipper can skip rows by index
+    void    AddLines(const std::string& time, int level, const std::string& worker, const std::string& text)
+    {
+        if (!worker.empty() && std::find(Workers.begin(), Workers.end(), worker) == Workers.end())
+            Workers.push_back(worker);
+        size_t begin = 0;
+        bool first = true;
+        do {
+            size_t end = text.find('\n', begin);
+            if (end == std::string::npos) end = text.size();
+            Line line;
+            line.time = first ? time : "";
+            line.level = level;
+            line.worker = worker;
+            line.text.assign(text, begin, end - begin);
+            if (Lines.size() < CAPACITY)
+                Lines.push_back(std::move(line));
+            else
+                Lines[End % CAPACITY] = std::move(line);
+            End++;
+            if (End - First > CAPACITY) First++;
+            begin = end + 1;
+            first = false;
+        } while (begin < text.size());
+    }
+
+    static const char* LevelName(int level)
+    {
+        static const char* names[] = {"trace", "debug", "info", "warning", "error", "critical"};
+        return level >= 0 && level <= (int) spdlog::level::critical ? names[level] : "";
+    }
+
+    static ImVec4 LevelColor(int level)
+    {
+        switch (level) {
+            case spdlog::level::trace: return ImVec4(0.6f, 0.6f, 0.6f, 1.0f);
+            case spdlog::level::debug: return ImVec4(0.5f, 0.8f, 1.0f, 1.0f);
+            case spdlog::level::warn: return ImVec4(1.0f, 0.8f, 0.3f, 1.0f);
+            case spdlog::level::err: return ImVec4(1.0f, 0.4f, 0.4f, 1.0f);
+            case spdlog::level::critical: return ImVec4(1.0f, 0.2f, 0.8f, 1.0f);
+            default: return ImVec4(1.0f, 1.0f, 1.0f, 1.0f);
+        }
     }
 };
 
-static void DrawJsonConfig(std::string jsonName, const rapidjson::Document &config) {
+/**
+ * @brief Window listing the members of a config document
+ * @param onEdit If given, numbers, booleans and strings are editable: onEdit(name, value) receives each edit,
+ *   e.g. to publish it with Config::setParam(). Strings are applied on Enter.
+ */
+static void DrawJsonConfig(std::string jsonName, const rapidjson::Document &config,
+                           const std::function<void(const char*, const rapidjson::Value&)> &onEdit = nullptr) {
     auto array2string = [](rapidjson::GenericValue<rapidjson::UTF8<>>::ConstArray array) -> std::string {
 
         std::string str;
@@ -169,6 +312,30 @@ static void DrawJsonConfig(std::string jsonName, const rapidjson::Document &conf
     for (rapidjson::Value::ConstMemberIterator itr = config.MemberBegin(); itr != config.MemberEnd(); itr++) {
         const rapidjson::Value &n = itr->name;
         const rapidjson::Value &v = itr->value;
+        if (onEdit && (v.IsBool() || v.IsNumber() || v.IsString())) {
+            // Widgets edit copies of the values: the document is an immutable snapshot
+            std::string id = std::string("##") + n.GetString();
+            ImGui::Text("%s:", n.GetString());
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(200);
+            if (v.IsBool()) {
+                bool b = v.GetBool();
+                if (ImGui::Checkbox(id.c_str(), &b)) onEdit(n.GetString(), rapidjson::Value(b));
+            } else if (v.IsInt()) {
+                int i = v.GetInt();
+                if (ImGui::InputInt(id.c_str(), &i)) onEdit(n.GetString(), rapidjson::Value(i));
+            } else if (v.IsNumber()) {
+                double d = v.GetDouble();
+                if (ImGui::InputDouble(id.c_str(), &d, 0.0, 0.0, "%g")) onEdit(n.GetString(), rapidjson::Value(d));
+            } else {
+                char buf[512];
+                snprintf(buf, sizeof(buf), "%s", v.GetString());
+                if (ImGui::InputText(id.c_str(), buf, sizeof(buf), ImGuiInputTextFlags_EnterReturnsTrue)) {
+                    onEdit(n.GetString(), rapidjson::Value(rapidjson::StringRef(buf)));
+                }
+            }
+            continue;
+        }
         switch (v.GetType()) {
             case rapidjson::kNullType:       //!< null
                 break;
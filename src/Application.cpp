@@ -6,6 +6,10 @@
 
 #include <islay/imgui_apps.h>
 #include <islay/ImageTexture.h>
+#include <islay/TiledImageViewer.h>
+#include <islay/FrameRecorder.h>
+#include <islay/LatencyTracer.h>
+#include <islay/Profiler.h>
 #include "AppMsg.h"
 #include <islay/Config.h>
 #include <islay/Logger.h>
@@ -136,13 +140,6 @@ bool Application::run(){
 	IM_ASSERT(font != NULL);
 #endif
 
-// Window capture and recording
-    bool requestedWindowCapture = false;
-    enum WINDOW_RECORDING_STATUS {PAUSED = 0, REQUESTED = 1, RECORDING = 2};
-    WINDOW_RECORDING_STATUS windowRecordingStatus = WINDOW_RECORDING_STATUS::PAUSED;
-    cv::VideoWriter writer;
-    std::string windowRecordingFileName;
-
 // Initialize application config
     Config::get_instance();
 
@@ -152,20 +149,48 @@ bool Application::run(){
 
     AppMsgPtr appMsg = std::make_shared<AppMsg>();
     std::shared_ptr<Engine> engine(new Engine(appMsg));
+    Logger::get_instance().startAsync(engine->getPUBinder()); // Workers log without waiting for the GUI nor the console
+    BinaryLog::get_instance().open(Config::get_instance().resultDirectory() + "/log.bin"); // ISLAY_BLOG events, see islay_binlog
+    size_t logCursor = 0; // Index of the next entry of the log store to show
+
+// Window capture and recording (read back asynchronously and encoded by a dedicated thread)
+    FrameRecorder frameRecorder(engine->getPUBinder());
+    std::string windowRecordingFileName;
     std::map<std::string, ImageTexture> texturePool;
     std::map<std::string, ImVec2> textureSizePool;
+    std::map<std::string, TiledImageViewer> tiledViewerPool; // Zoom/pan viewers, for images too large for a texture
+    struct ImageViewState {
+        bool visible = false;
+        bool tiled = false;         // Shown with TiledImageViewer instead of ImageTexture
+        float maxFps = 0;           // Upload rate limit of the channel. 0: unlimited
+        double lastUploadTime = -1;
+        unsigned long long uploadCount = 0;
+        cv::Mat lastImage;          // To show the frame again when the viewer is switched
+        ImageDisplayMapping lastMapping;
+    };
+    std::map<std::string, ImageViewState> imageViewPool;
+    static bool downsampleToWindow = true;
     auto clearTexturePool=[&](){
         texturePool.clear();
         textureSizePool.clear();
+        imageViewPool.clear();
+        tiledViewerPool.clear();
     };
+    // Frames uploaded in this frame, stamped as displayed after the buffer swap
+    std::vector<std::pair<std::string, MsgData::Timestamps>> displayedFrames;
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
 
     enum SHOW_IMAGE_MODE {IMGUI = 0, OPENCV = 1};
     static int selectedShowImageMode = SHOW_IMAGE_MODE::IMGUI;
 
 // Main loop
+    ISLAY_PROFILE_THREAD("GUI");
+    Logger::get_instance().setThreadName("GUI");
     bool done = false;
     while (!done)
     {
+        ISLAY_PROFILE_ZONE("frame");
         /// Poll and handle events (inputs, window resize, etc.)
         // You can read the io.WantCaptureMouse, io.WantCaptureKeyboard flags to tell if dear imgui wants to use your inputs.
         // - When io.WantCaptureMouse is true, do not dispatch mouse input data to your main application.
@@ -194,7 +219,7 @@ bool Application::run(){
             ImVec2 window_pos = ImVec2(DISTANCE, DISTANCE);
             ImVec2 window_pos_pivot = ImVec2(0.0f, 0.0f);
             ImGui::SetNextWindowPos(window_pos, ImGuiCond_Appearing, window_pos_pivot);
-            ImGui::SetNextWindowSize(ImVec2(300,240), ImGuiCond_Always);
+            ImGui::SetNextWindowSize(ImVec2(300,270), ImGuiCond_Always);
             ImGui::SetNextWindowBgAlpha(0.35f); // Transparent background
             if (ImGui::Begin("GUI", nullptr, ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav | ImGuiWindowFlags_NoMove))
             {
@@ -213,41 +238,49 @@ bool Application::run(){
                     ImGui::Text("Window Capture");
                     ImGui::Indent();
                     if (ImGui::Button("Capture")) {
-                        requestedWindowCapture = true;
+                        frameRecorder.requestCapture(Config::get_instance().resultDirectory() + "/capture_" + Util::now() + ".png");
                     }
                     ImGui::Unindent();
                     ImGui::Text("Window Recording");
                     ImGui::Indent();
                     if (ImGui::Button("Start")) {
-                        if (windowRecordingStatus == WINDOW_RECORDING_STATUS::PAUSED) {
-                            int fps_encode = 60;
+                        if (!frameRecorder.isRecording()) {
+                            // Frames are written at a constant rate following their render time: no slow-mo
                             windowRecordingFileName = "recording_" + Util::now() + ".mp4";
-                            SPDLOG_INFO("Video recording start: {}", windowRecordingFileName);
-                            // FIXME: Framerate doesn't concide with the refresh rate, which can result in slow-mo video.
-                            writer = cv::VideoWriter(
-                                    Config::get_instance().resultDirectory() + "/" + windowRecordingFileName,
-                                    cv::VideoWriter::fourcc('H', '2', '6', '4'), fps_encode,
-                                    cv::Size((int) io.DisplaySize.x * (int) io.DisplayFramebufferScale.x,
-                                             (int) io.DisplaySize.y * (int) io.DisplayFramebufferScale.y));
-                            windowRecordingStatus = WINDOW_RECORDING_STATUS::REQUESTED;
+                            frameRecorder.startRecording(Config::get_instance().resultDirectory() + "/" + windowRecordingFileName, 30.0);
                         }
                     }
                     ImGui::SameLine();
                     if (ImGui::Button("Stop")) {
-                        SPDLOG_INFO("Video recording end");
-                        windowRecordingStatus = WINDOW_RECORDING_STATUS::PAUSED;
-                        writer.release();
+                        frameRecorder.stopRecording();
                     }
                     ImGui::SameLine();
-                    if (windowRecordingStatus == WINDOW_RECORDING_STATUS::PAUSED) {
+                    if (!frameRecorder.isRecording()) {
                         ImGui::Text("PAUSED");
-                    } else if (windowRecordingStatus == WINDOW_RECORDING_STATUS::REQUESTED) {
-                        ImGui::Text("REQUESTED");
-                    } else if (windowRecordingStatus == WINDOW_RECORDING_STATUS::RECORDING) {
+                    } else if (frameRecorder.getDropCount() > 0) {
+                        ImGui::Text("RECORDING... (%llu dropped)", frameRecorder.getDropCount());
+                    } else {
                         ImGui::Text("%s", "RECORDING...");
                     }
                     ImGui::Unindent();
                 }
+                {
+                    // Zones of the workers, the GUI loop and the uploads on one timeline (chrome://tracing, ui.perfetto.dev)
+                    ImGui::Text("Profiler");
+                    ImGui::Indent();
+                    auto& profiler = Profiler::get_instance();
+                    if (ImGui::Button("Start##Profiler") && !profiler.isEnabled()) {
+                        profiler.start();
+                    }
+                    ImGui::SameLine();
+                    if (ImGui::Button("Stop & Export") && profiler.isEnabled()) {
+                        profiler.stop();
+                        profiler.exportChromeTrace(Config::get_instance().resultDirectory() + "/trace_" + Util::now() + ".json");
+                    }
+                    ImGui::SameLine();
+                    ImGui::Text("%s", profiler.isEnabled() ? "PROFILING..." : "");
+                    ImGui::Unindent();
+                }
                 {
                     ImGui::Text("Exit program");
                     ImGui::Indent();
@@ -303,6 +336,18 @@ bool Application::run(){
                         engine->terminateWorker("WorkerSampleWithCpuBinding");
                     }
                 }
+                {
+                    ImGui::NewLine(); ImGui::SameLine();
+                    ImGui::Text("Pipeline sample");
+                    ImGui::NewLine(); ImGui::SameLine();
+                    if (ImGui::Button("Launch##PipelineSample")) {
+                        engine->runPipelineSample();
+                    }
+                    ImGui::SameLine();
+                    if (ImGui::Button("Terminate##PipelineSample")) {
+                        engine->terminatePipeline();
+                    }
+                }
                 {// Add your worker here as above
 
                 }
@@ -320,10 +365,7 @@ bool Application::run(){
                     for (auto &name: engine->getWorkerList()) {
                         ImGui::NewLine();
                         WORKER_STATUS observedWorkerStatus;
-                        observedWorkerStatus = engine->getWorkerStatus(name);
-                        if (observedWorkerStatus == WORKER_STATUS::JOINABLE) {
-                            engine->resetWorker(name);
-                        }
+                        observedWorkerStatus = engine->getWorkerStatus(name); // Pooled threads return to IDLE by themselves
                         ImGui::SameLine();
                         if (observedWorkerStatus == WORKER_STATUS::IDLE) {
                             ImGui::Text("%s: idle", name.c_str());
@@ -336,16 +378,32 @@ bool Application::run(){
                         } else {
                             ImGui::Text("%s: unknown", name.c_str());
                         }
-                        int puIndIfBinded = engine->getPuIfBinded(name);
-                        if(puIndIfBinded != -1){
+                        auto pusIfBinded = engine->getPusIfBinded(name); // The worker and its sub-threads
+                        if(!pusIfBinded.empty()){
+                            std::string pus;
+                            for (auto pu: pusIfBinded) pus += (pus.empty() ? "" : ",") + std::to_string(pu);
                             ImGui::SameLine();
-                            ImGui::Text("(PU:%d)", puIndIfBinded) ;
+                            ImGui::Text("(PU:%s)", pus.c_str()) ;
                         }
                         ImGui::NextColumn();
                     }
                     ImGui::EndChild();
 
                 }
+                auto pipelineStats = engine->getPipelineStats();
+                if (!pipelineStats.empty()) {
+                    ImGui::Separator();
+                    ImGui::Text("Pipeline:");
+                    for (auto &[name, stats]: pipelineStats) {
+                        ImGui::NewLine(); ImGui::SameLine();
+                        ImGui::Text("%s: %.1f fps", name.c_str(), stats.throughput);
+                        ImGui::NewLine(); ImGui::SameLine();
+                        ImGui::Text("  service %.2f / queue %.2f / latency %.2f ms",
+                                    stats.avgServiceMs, stats.avgQueueMs, stats.avgLatencyMs);
+                        ImGui::NewLine(); ImGui::SameLine();
+                        ImGui::Text("  blocked %.2f ms, dropped %llu", stats.avgBlockedMs, stats.dropped);
+                    }
+                }
                 workerWindowPos = ImGui::GetWindowPos();
                 workerWindowSize = ImGui::GetWindowSize();
                 ImGui::End();
@@ -374,6 +432,9 @@ bool Application::run(){
                         cv::destroyAllWindows();
                     }
                 }
+                ImGui::NewLine();
+                ImGui::SameLine();
+                ImGui::Checkbox("Downsample to window size", &downsampleToWindow);
 
                 ImVec2 child_size = ImVec2(0, ImGui::GetFontSize() * 5.0f);
                 ImGui::BeginChild("##ScrollingRegion_image", child_size, false, ImGuiWindowFlags_HorizontalScrollbar);
@@ -381,11 +442,21 @@ bool Application::run(){
                 int id=0;
                 for (const auto &texture: texturePool)
                 {
-                    ImGui::TreeNodeEx((void *) (intptr_t) id++, node_flags, "%s", texture.first.c_str());
+                    auto &view = imageViewPool[texture.first];
+                    ImGui::TreeNodeEx((void *) (intptr_t) id++, node_flags, "%s%s (%llu uploads)", texture.first.c_str(),
+                                      view.visible ? "" : " [hidden]", view.uploadCount);
                     if (ImGui::IsItemClicked()){
                         SPDLOG_INFO("{} pressed", texture.first.c_str());
                         ImGui::SetWindowFocus(texture.first.c_str());
                     }
+                    if (ImGui::BeginPopupContextItem()) { // Right click
+                        ImGui::SliderFloat("Max FPS", &view.maxFps, 0.0f, 120.0f, view.maxFps > 0 ? "%.0f" : "unlimited");
+                        if (ImGui::Checkbox("Zoom/pan viewer", &view.tiled) && !view.lastImage.empty()) {
+                            if (view.tiled) tiledViewerPool[texture.first].setImage(view.lastImage, view.lastMapping);
+                            else texturePool[texture.first].setImage(view.lastImage, view.lastMapping);
+                        }
+                        ImGui::EndPopup();
+                    }
                 }
                 ImGui::EndChild();
                 ImGui::End();
@@ -394,66 +465,122 @@ bool Application::run(){
 
         /// Display images
         {
+            ISLAY_PROFILE_ZONE("display images");
             // Destroy OpenCV windows if exists
             if(selectedShowImageMode == SHOW_IMAGE_MODE::IMGUI) { /// Use ImGui
                 cv::destroyAllWindows();
             }
 
             // Render images in texturePool
-            for (auto &e: appMsg->ocvImageMsgCollection.pool) {
-                auto msg = e.second->receive();
+            // Frames are uploaded only to windows that are visible; frames for collapsed, hidden (e.g. behind
+            // a dock tab) or clipped windows, and frames over the max FPS of a channel, are left in the
+            // messenger, where newer frames replace them. Queue channels (ocvImageQueueCollection) are left to their
+            // worker consumers.
+            double now = ImGui::GetTime();
+            auto channels = appMsg->ocvImageMsgCollection.snapshot(); // Workers may add channels meanwhile
+            for (auto &e: *channels) {
+                const std::string &winname = e.first;
+                if (selectedShowImageMode == SHOW_IMAGE_MODE::OPENCV) {
+                    auto msg = e.second->receive();
+                    if (msg != nullptr) {
+                        cv::namedWindow(winname, cv::WINDOW_NORMAL);
+                        cv::imshow(winname, msg->img);
+                        LatencyTracer::get_instance().record(winname, msg->getTimestamps());
+                    } else {
+                        cv::waitKey(1);
+                    }
+                    continue;
+                }
+
+                auto &view = imageViewPool[winname];
+                OcvImageMsg *msg = nullptr;
+                if (textureSizePool.count(winname) == 0) {
+                    msg = e.second->receive(); // The first frame sets the initial window size
+                    if (msg == nullptr) continue;
+                    // Images beyond the texture size limit go to the zoom/pan viewer
+                    view.tiled = msg->img.cols > maxTextureSize || msg->img.rows > maxTextureSize;
+                    float fit = view.tiled ? std::min(1.0f, 1024.0f / std::max(msg->img.cols, msg->img.rows)) : 1.0f;
+                    textureSizePool[winname] = ImVec2(msg->img.cols * fit, msg->img.rows * fit);
+                }
+                ImGui::SetNextWindowSize(ImVec2(textureSizePool[winname].x, textureSizePool[winname].y));
+                bool isWindowOpen = ImGui::Begin(winname.c_str()); // false if collapsed or hidden
+                ImVec2 imageSize = ImVec2(textureSizePool[winname].x - 20, textureSizePool[winname].y - 40);
+                view.visible = isWindowOpen && ImGui::IsRectVisible(imageSize);
+                bool throttled = view.maxFps > 0 && now - view.lastUploadTime < 1.0 / view.maxFps;
+                // A zoom/pan viewer takes no new frame before the pyramid of the last one is built
+                if (view.tiled && tiledViewerPool[winname].isBuilding()) throttled = true;
+                if (msg == nullptr && view.visible && !throttled) msg = e.second->receive();
+
+                auto &texture = texturePool[winname];
                 if (msg != nullptr) {
-                    if (selectedShowImageMode == SHOW_IMAGE_MODE::IMGUI) {
-                        std::string winname = e.first;
-                        if (textureSizePool.count(winname) == 0) {
-                            ImGui::SetNextWindowSize(ImVec2(msg->img.cols, msg->img.rows));
-                            textureSizePool[winname] = ImVec2(msg->img.cols, msg->img.rows);
+                    if (view.tiled) {
+                        tiledViewerPool[winname].setImage(msg->img, msg->mapping);
+                    } else {
+                        if (downsampleToWindow) { // No more pixels than the window shows
+                            texture.setMaxUploadSize((int) (imageSize.x * io.DisplayFramebufferScale.x),
+                                                     (int) (imageSize.y * io.DisplayFramebufferScale.y));
                         } else {
-                            ImGui::SetNextWindowSize(ImVec2(textureSizePool[winname].x, textureSizePool[winname].y));
-                        }
-                        if (ImGui::Begin(winname.c_str())) {
-                            bool isWindowCollapsed = ImGui::IsWindowCollapsed();
-                            texturePool[winname].setImage(&msg->img);
-                            ImGui::Image(texturePool[winname].getOpenglTexture(),
-                                         ImVec2(textureSizePool[winname].x - 20, textureSizePool[winname].y - 40),
-                                         ImVec2(0.0f, 0.0f), ImVec2(1.0f, 1.0f)
-                            );
-                            if (!isWindowCollapsed) {
-                                float scale = std::min<float>(ImGui::GetWindowSize().x / textureSizePool[winname].x,
-                                                              ImGui::GetWindowSize().y / textureSizePool[winname].y);
-                                textureSizePool[winname] = ImVec2(textureSizePool[winname].x * scale,
-                                                                  textureSizePool[winname].y * scale);
-                            }
+                            texture.setMaxUploadSize(0, 0);
                         }
-                        ImGui::End();
-                    } else if (selectedShowImageMode == SHOW_IMAGE_MODE::OPENCV) {
-                        std::string winname = e.first;
-                        cv::namedWindow(winname, cv::WINDOW_NORMAL);
-                        cv::imshow(winname, msg->img);
+                        texture.setImage(msg->img, msg->mapping);
                     }
-                } else {
-                    if (selectedShowImageMode == SHOW_IMAGE_MODE::IMGUI) {
-                        std::string winname = e.first;
-                        ImGui::SetNextWindowSize(ImVec2(textureSizePool[winname].x, textureSizePool[winname].y));
-                        if (ImGui::Begin(winname.c_str())) {
-                            bool isWindowCollapsed = ImGui::IsWindowCollapsed();
-                            ImGui::Image(texturePool[winname].getOpenglTexture(),
-                                         ImVec2(textureSizePool[winname].x - 20, textureSizePool[winname].y - 40),
-                                         ImVec2(0.0f, 0.0f), ImVec2(1.0f, 1.0f)
-                            );
-                            if (!isWindowCollapsed) {
-                                float scale = std::min<float>(ImGui::GetWindowSize().x / textureSizePool[winname].x,
-                                                              ImGui::GetWindowSize().y / textureSizePool[winname].y);
-                                textureSizePool[winname] = ImVec2(textureSizePool[winname].x * scale,
-                                                                  textureSizePool[winname].y * scale);
-                            }
-                        };
-                        ImGui::End();
-                    } else if (selectedShowImageMode == SHOW_IMAGE_MODE::OPENCV) {
-                        cv::waitKey(1);
+                    view.lastImage = msg->img;
+                    view.lastMapping = msg->mapping;
+                    view.lastUploadTime = now;
+                    view.uploadCount++;
+                    displayedFrames.emplace_back(winname, msg->getTimestamps());
+                }
+                LatencyTracer::get_instance().setLostCount(winname, e.second->getOverwrittenCount());
+                if (isWindowOpen) {
+                    if (view.tiled) {
+                        tiledViewerPool[winname].draw(imageSize);
+                    } else {
+                        ImGui::Image(texture.getOpenglTexture(), imageSize, ImVec2(0.0f, 0.0f), ImVec2(1.0f, 1.0f));
+                    }
+                    float scale = std::min<float>(ImGui::GetWindowSize().x / textureSizePool[winname].x,
+                                                  ImGui::GetWindowSize().y / textureSizePool[winname].y);
+                    textureSizePool[winname] = ImVec2(textureSizePool[winname].x * scale,
+                                                      textureSizePool[winname].y * scale);
+                }
+                ImGui::End();
+            }
+        }
+
+        /// Latency window
+        {
+            if (ImGui::Begin("Latency")) {
+                auto& tracer = LatencyTracer::get_instance();
+                if (ImGui::Button("Reset")) tracer.reset();
+                ImGui::SameLine();
+                if (ImGui::Button("Export CSV")) {
+                    tracer.exportCsv(Config::get_instance().resultDirectory() + "/latency_" + Util::now() + ".csv");
+                }
+                if (ImGui::BeginTable("##latency", 7, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+                    ImGui::TableSetupColumn("Channel");
+                    ImGui::TableSetupColumn("Stage");
+                    ImGui::TableSetupColumn("Frames");
+                    ImGui::TableSetupColumn("p50 [us]");
+                    ImGui::TableSetupColumn("p99 [us]");
+                    ImGui::TableSetupColumn("Max [us]");
+                    ImGui::TableSetupColumn("Overwritten");
+                    ImGui::TableHeadersRow();
+                    for (auto& [name, channel]: tracer.snapshot()) {
+                        for (size_t i = 0; i < LATENCY_STAGE_COUNT; i++) {
+                            auto& h = channel.stages[i];
+                            ImGui::TableNextRow();
+                            ImGui::TableNextColumn(); ImGui::TextUnformatted(i == 0 ? name.c_str() : "");
+                            ImGui::TableNextColumn(); ImGui::TextUnformatted(latencyStageName((LATENCY_STAGE) i));
+                            ImGui::TableNextColumn(); ImGui::Text("%llu", h.getCount());
+                            ImGui::TableNextColumn(); ImGui::Text("%.1f", h.percentile(0.5) * 1e-3);
+                            ImGui::TableNextColumn(); ImGui::Text("%.1f", h.percentile(0.99) * 1e-3);
+                            ImGui::TableNextColumn(); ImGui::Text("%.1f", h.max() * 1e-3);
+                            ImGui::TableNextColumn(); if (i == 0) ImGui::Text("%llu", channel.lost);
+                        }
                     }
+                    ImGui::EndTable();
                 }
             }
+            ImGui::End();
         }
 
         /// Plot window
@@ -490,15 +617,17 @@ bool Application::run(){
             ImGui::SetNextWindowPos(window_pos, ImGuiCond_Appearing, window_pos_pivot);
             ImGui::SetNextWindowSize(ImVec2(window_size.x/2-DISTANCE,configHeight), ImGuiCond_Once);
             ImGui::SetNextWindowBgAlpha(0.35f); // Transparent background
-            DrawJsonConfig("config", Config::get_instance().getDocument());
+            auto config = Config::get_instance().snapshot(); // Kept while drawn; edits publish new snapshots
+            DrawJsonConfig("config", config->getDocument(), [](const char* name, const rapidjson::Value& value) {
+                Config::get_instance().setParam(name, value); // Workers see it from their next snapshot
+            });
         }
 
         /// Logger window
         {
-            Logger::get_instance().logger->flush();
-            my_log.AddLog( "%s", Logger::get_instance().oss.str().c_str() );
-            Logger::get_instance().oss.str("");
-            Logger::get_instance().oss.clear();
+            logCursor = Logger::get_instance().store->read(logCursor, [&](const LogEntry& e){
+                my_log.AddEntry(e);
+            });
             const float DISTANCE = 10.0f;
 			ImVec2 window_size = io.DisplaySize;
 			ImVec2 window_pos = ImVec2(window_size.x/2, DISTANCE*2+configHeight);
@@ -510,45 +639,19 @@ bool Application::run(){
         }
 
         /// Rendering
+        ISLAY_PROFILE_ZONE("render");
         ImGui::Render();
         glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
 
-        /// Screen capture and recording
-        if (requestedWindowCapture) {
-            glFinish();
-            int width = (int) io.DisplaySize.x * (int) io.DisplayFramebufferScale.x;
-            int height = (int) io.DisplaySize.y * (int) io.DisplayFramebufferScale.y;
-            int type = CV_8UC3;
-            int format = GL_BGR;
-            glReadBuffer(GL_BACK);
-            static cv::Mat out_img;
-            out_img = cv::Mat(cv::Size(width, height), type);
-            glReadPixels(0, 0, width, height, format, GL_UNSIGNED_BYTE, out_img.data);
-            cv::flip(out_img, out_img, 0);
-            cv::imwrite((Config::get_instance().resultDirectory() + "/capture_" + Util::now() + ".png").c_str(),out_img,std::vector<int>(cv::IMWRITE_PNG_COMPRESSION));
-            SPDLOG_INFO("Window captured: {}", "capture_" + Util::now() + ".png");
-            requestedWindowCapture = false;
-        }
-        if (windowRecordingStatus >= WINDOW_RECORDING_STATUS::REQUESTED) {
-            /// NOTE: For better color representation, consider using ffmpeg
-            windowRecordingStatus = WINDOW_RECORDING_STATUS::RECORDING;
-            glFinish();
-            int width = (int) io.DisplaySize.x * (int) io.DisplayFramebufferScale.x;
-            int height = (int) io.DisplaySize.y * (int) io.DisplayFramebufferScale.y;
-            int type = CV_8UC3;
-            int format = GL_BGR;
-            glReadBuffer(GL_BACK);
-            static cv::Mat out_img;
-            out_img = cv::Mat(cv::Size(width, height), type);
-            glReadPixels(0, 0, width, height, format, GL_UNSIGNED_BYTE, out_img.data);
-            cv::flip(out_img, out_img, 0);
-            writer << out_img;
-        }
-
         glClearColor(clear_color.x, clear_color.y, clear_color.z, clear_color.w);
         glClear(GL_COLOR_BUFFER_BIT);
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
+        /// Screen capture and recording of the frame just rendered
+        /// NOTE: For better color representation, consider using ffmpeg
+        frameRecorder.readFrame((int) (io.DisplaySize.x * io.DisplayFramebufferScale.x),
+                                (int) (io.DisplaySize.y * io.DisplayFramebufferScale.y));
+
         // Update and Render additional Platform Windows
         // (Platform functions may change the current OpenGL context, so we save/restore it to make it easier to paste this code elsewhere.
         //  For this specific demo app we could also call SDL_GL_MakeCurrent(window, gl_context) directly)
@@ -561,10 +664,18 @@ bool Application::run(){
             SDL_GL_MakeCurrent(backup_current_window, backup_current_context);
         }
 
-        SDL_GL_SwapWindow(window);
+        {
+            ISLAY_PROFILE_ZONE("swap");
+            SDL_GL_SwapWindow(window);
+        }
+
+        uint64_t displayTime = MsgData::clockNs();
+        for (auto& [name, timestamps]: displayedFrames) LatencyTracer::get_instance().record(name, timestamps, displayTime);
+        displayedFrames.clear();
     }
 
     engine->terminateAll(); // Request all workers to terminate
+    appMsg->close(); // Wake the workers blocked on a full queue: the GUI does not drain ocvImageQueueCollection
     engine->reset(); // Join all threads of workers
 
     SPDLOG_INFO("Program terminated successfully. See you!");
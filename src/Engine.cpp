@@ -60,4 +60,34 @@ bool Engine::runWorkerSampleWithCpuBinding() {
 
     return true;
 
+}
+
+bool Engine::runPipelineSample() {
+    /**
+     * Register stages and connect their ports ("stage.port")
+     */
+    if (!isWorkerExist("PipelineSample_source")) {
+        addStage<LenaSource>("PipelineSample_source");
+        addStage<BlurStage>("PipelineSample_blur");
+        addStage<DisplayStage>("PipelineSample_display");
+        connect("PipelineSample_source.out", "PipelineSample_blur.in", 4);
+        // The display does not need every frame: drop the oldest instead of throttling the blur
+        connect("PipelineSample_blur.out", "PipelineSample_display.in", 2, OVERFLOW_POLICY::DROP_OLDEST);
+    }
+
+    /**
+     * Run all stages concurrently. See getPipelineStats() for throughput and latency of each stage.
+     */
+    return runPipeline();
+}
+
+std::map<std::string, std::function<bool()>> Engine::getLaunchers() {
+    /**
+     * Add yours here as in the Commands window of the GUI
+     */
+    return {
+            {"WorkerSample", [this] { return runWorkerSample(); }},
+            {"WorkerSampleWithCpuBinding", [this] { return runWorkerSampleWithCpuBinding(); }},
+            {"PipelineSample", [this] { return runPipelineSample(); }},
+    };
 }
\ No newline at end of file
@@ -24,14 +24,15 @@ bool WorkerSample::run(const std::shared_ptr<void> data){
     /**
      * Main process
      * - Write your algorithm here.
-     * - You can access to config parameters via Config::get_instance().readXYZParam("PARAM"); (set functions are not thread safe for now)
+     * - You can access to config parameters via handles bound once with Config::get_instance().param<T>("PARAM")
+     *   (see the members of WorkerSample). Reading a handle is an atomic load, cheap enough for per-frame loops,
+     *   and sees the values set from the GUI. Config::get_instance().readXYZParam("PARAM") looks the name up each time.
+     * - To read several parameters of the same version (e.g. edited together from the config window), take
+     *   Config::get_instance().snapshot() or a ConfigSnapshotCache once per iteration and read them from it.
      */
-    cv::Mat lena(Config::get_instance().readIntParam("IMAGE_WIDTH"),
-                 Config::get_instance().readIntParam("IMAGE_HEIGHT"), CV_8UC3);
+    cv::Mat lena(imageWidth, imageHeight, CV_8UC3);
     lena = cv::imread(
-            Config::get_instance().resourceDirectory() + "/" +
-            Config::get_instance().readStringParam("IMG_PATH"));
-    std::string imgName = Config::get_instance().readStringParam("IMG_NAME");
+            Config::get_instance().resourceDirectory() + "/" + imgPath.get());
 
     /**
      * Be careful! You can't imshow in a worker.
@@ -49,7 +50,8 @@ bool WorkerSample::run(const std::shared_ptr<void> data){
     /**
      * Show image using AppMsg
      * - Images show up at the same location by default.
-     * - You can modify ImageTexture::setImage to show a cv::Mat whose format is not currently supported.
+     * - BGR/BGRA 8-bit and single-channel 8U/16U/32F images are shown as is. For single-channel images,
+     *   msg->mapping sets the displayed value range, a color map or a Bayer pattern (converted on the GPU).
      */
     auto msgr = appMsg->ocvImageMsgCollection.setup("lena"); // Set up a messenger with a name
     auto msg = msgr->prepareMsg(); // Prepare a message
@@ -60,14 +62,17 @@ bool WorkerSample::run(const std::shared_ptr<void> data){
      * Send processed images from a dedicated thread with cpu binding
      */
     cv::Mat blurred_lena;
-    std::atomic<bool> isShowThreadTerminateRequested(false);
+    InterThreadMessenger<OcvImageMsg, MESSENGER_MODE::TRIPLE_BUFFER> blurredLenaMsgr; // Hands blurred images over to showThread
     auto showThread = std::thread([&](){
         auto msgr = appMsg->ocvImageMsgCollection.setup("lena_blur"); // make sure to set up each time
-        while(true){
+        while(!blurredLenaMsgr.isClosed()){
+            // Sleeps until a new blurred image is sent instead of spinning on receive()
+            auto blurred = blurredLenaMsgr.waitReceive(std::chrono::milliseconds(100));
+            if(blurred == nullptr) continue;
+            if(msgr->isClosed()) msgr = appMsg->ocvImageMsgCollection.setup("lena_blur"); // Deleted from GUI
             auto msg = msgr->prepareMsg();
-            msg->img = blurred_lena;
+            msg->img = blurred->img;
             msgr->send();
-            if(isShowThreadTerminateRequested.load()) break;
         }
     });
     requestCpuBind("showThread", showThread.native_handle(), showThread.get_id());
@@ -75,10 +80,25 @@ bool WorkerSample::run(const std::shared_ptr<void> data){
     /**
      * You can measure elapsed time using Util::Bench::bench
      */
+    auto scheduler = getTaskScheduler();
     auto elapsedTimeInMs = Util::Bench::bench([&] {
         for (int i = 0; i < 3000; i++) {
+            ISLAY_PROFILE_ZONE("blur"); // See the Profiler section of the GUI
             int k = ceil(rand() % 5) * 8 + 1;
-            cv::GaussianBlur(lena, blurred_lena, cv::Size(k, k), 10);
+            ISLAY_BLOG_DEBUG("blur frame={} k={}", i, k); // Raw arguments to log.bin, formatted by islay_binlog
+            // Draw a recycled buffer for each frame: the previous one may still be on display
+            blurred_lena = appMsg->ocvImageMsgCollection.acquireFrame(lena.size(), lena.type());
+            // Blur horizontal bands in parallel. Filtering an ROI reads the neighbouring rows of
+            // the parent image, so the bands join without seams.
+            scheduler->parallel_for(0, lena.rows, [&](int r0, int r1) {
+                cv::Rect band(0, r0, lena.cols, r1 - r0);
+                cv::Mat dst = blurred_lena(band);
+                cv::GaussianBlur(lena(band), dst, cv::Size(k, k), 10);
+            });
+
+            auto blurredMsg = blurredLenaMsgr.prepareMsg();
+            blurredMsg->img = blurred_lena; // no copy
+            blurredLenaMsgr.send();
 
             if (checkIfTerminateRequested()) {
                 break;
@@ -86,7 +106,7 @@ bool WorkerSample::run(const std::shared_ptr<void> data){
         }
     });
 
-    isShowThreadTerminateRequested.store(true);
+    blurredLenaMsgr.close(); // Wakes up showThread to let it finish
     if(showThread.joinable()) showThread.join();
 
     SPDLOG_INFO("WorkerSample took {}ms", elapsedTimeInMs);
@@ -97,11 +117,9 @@ bool WorkerSample::run(const std::shared_ptr<void> data){
 bool WorkerSampleWithCpuBinding::run(const std::shared_ptr<void> data) {
 
     // Do some heavy tasks
-    cv::Mat lena(Config::get_instance().readIntParam("IMAGE_WIDTH"),
-                 Config::get_instance().readIntParam("IMAGE_HEIGHT"), CV_8UC3);
+    cv::Mat lena(imageWidth, imageHeight, CV_8UC3);
     lena = cv::imread(
-            Config::get_instance().resourceDirectory() + "/" +
-            Config::get_instance().readStringParam("IMG_PATH"));
+            Config::get_instance().resourceDirectory() + "/" + imgPath.get());
 
     cv::Mat blurred_lena;
     auto elapsedTimeInMs = Util::Bench::bench([&] {
@@ -115,5 +133,34 @@ bool WorkerSampleWithCpuBinding::run(const std::shared_ptr<void> data) {
         }
     });
 
+    return true;
+}
+
+bool LenaSource::process(){
+    if (lena.empty()) {
+        lena = cv::imread(
+                Config::get_instance().resourceDirectory() + "/" + imgPath.get());
+        if (lena.empty()) return false;
+    }
+    // Blocks while the blur stage is busy (backpressure), so the source runs at the pace of the pipeline
+    return out.send(lena);
+}
+
+bool BlurStage::process(){
+    cv::Mat img;
+    if (!in.receive(img)) return false; // Source finished or pipeline terminated
+    int k = ceil(rand() % 5) * 8 + 1;
+    cv::Mat blurred = appMsg->ocvImageMsgCollection.acquireFrame(img.size(), img.type());
+    cv::GaussianBlur(img, blurred, cv::Size(k, k), 10);
+    return out.send(blurred);
+}
+
+bool DisplayStage::process(){
+    cv::Mat img;
+    if (!in.receive(img)) return false;
+    auto msgr = appMsg->ocvImageMsgCollection.setup("pipeline_blur");
+    auto msg = msgr->prepareMsg();
+    msg->img = img;
+    msgr->send();
     return true;
 }
\ No newline at end of file
@@ -0,0 +1,336 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+/**
+ * Micro-benchmarks of the building blocks of islay. See BenchmarkRunner.
+ *
+ *   islay_bench --filter messenger
+ *
+ *   --list               List the suites
+ *   --filter S           Run only the suites whose name contains S (repeatable)
+ *   --out DIR            Directory of bench_<time>.json and .csv (default: the result directory)
+ *   --max-seconds S      Time limit of each benchmark (default: 2)
+ *   --no-pin             Do not bind the benchmarking threads to PUs
+ *   --gui                Compare the results live with ImPlot while the benchmarks run (GUI build only)
+ *
+ * Suites:
+ *   messenger   InterThreadMessenger (triple buffer and mutex) and QueueMessenger round trips
+ *   frame_pool  FramePool::acquire() against a fresh cv::Mat
+ *   workers     The blur of WorkerSample, serial and banded on TaskScheduler
+ *   upload      ImageTexture::setImage() of 1080p frames up to glFinish() (GUI build only)
+ */
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#include <opencv2/opencv.hpp>
+
+#include <islay/Benchmark.h>
+#include <islay/Config.h>
+#include <islay/FramePool.h>
+#include <islay/InterThreadMessenger.hpp>
+#include <islay/Logger.h>
+#include <islay/PUBinder.h>
+#include <islay/QueueMessenger.hpp>
+#include <islay/TaskScheduler.h>
+#include <islay/Utility.h>
+
+#if ISLAY_BENCH_GUI
+#include "imgui.h"
+#include "imgui_impl_sdl2.h"
+#include "imgui_impl_opengl3.h"
+#include <implot.h>
+#include <islay/BenchmarkView.h>
+#include <islay/ImageTexture.h>
+#endif
+
+namespace {
+struct BenchMsg : public MsgData {
+    uint64_t value = 0;
+};
+
+struct Suite {
+    std::string name;
+    std::function<void(BenchmarkRunner&)> run;
+    bool needsGl; // Runs on the main thread, which owns the GL context
+};
+
+template<MESSENGER_MODE Mode>
+void benchInterThreadMessenger(BenchmarkRunner& runner, const std::string& mode){
+    uint64_t i = 0;
+    {
+        InterThreadMessenger<BenchMsg, Mode> m;
+        runner.run("messenger: send", mode, [&] {
+            m.prepareMsg()->value = i++;
+            m.send();
+        });
+    }
+    {
+        InterThreadMessenger<BenchMsg, Mode> m;
+        runner.run("messenger: send + receive", mode, [&] {
+            m.prepareMsg()->value = i++;
+            m.send();
+            BenchmarkRunner::doNotOptimize(m.receive());
+        });
+    }
+    {
+        // The receiver polls from another thread, as the GUI does, so the buffers bounce between caches
+        InterThreadMessenger<BenchMsg, Mode> m;
+        std::atomic<bool> stop(false);
+        std::thread receiver([&] {
+            while (!stop.load(std::memory_order_relaxed)) BenchmarkRunner::doNotOptimize(m.receive());
+        });
+        runner.run("messenger: send, polled by another thread", mode, [&] {
+            m.prepareMsg()->value = i++;
+            m.send();
+        });
+        stop.store(true);
+        receiver.join();
+    }
+}
+
+void benchMessengers(BenchmarkRunner& runner){
+    benchInterThreadMessenger<MESSENGER_MODE::TRIPLE_BUFFER>(runner, "triple buffer");
+    benchInterThreadMessenger<MESSENGER_MODE::MUTEX>(runner, "mutex");
+
+    QueueMessenger<BenchMsg> q(16);
+    uint64_t i = 0;
+    runner.run("messenger: send + receive", "queue", [&] {
+        BenchMsg* msg = q.prepareMsg();
+        msg->value = i++;
+        q.send(msg);
+        msg = q.receive();
+        BenchmarkRunner::doNotOptimize(msg);
+        q.release(msg);
+    });
+}
+
+void benchFramePool(BenchmarkRunner& runner){
+    const int rows = 480, cols = 640, type = CV_8UC3;
+    runner.run("frame 640x480 8UC3", "FramePool::acquire", [&] {
+        cv::Mat m = FramePool::get_instance().acquire(rows, cols, type);
+        m.data[0] = 1;
+        BenchmarkRunner::doNotOptimize(m.data);
+    });
+    runner.run("frame 640x480 8UC3", "cv::Mat", [&] {
+        cv::Mat m(rows, cols, type);
+        m.data[0] = 1;
+        BenchmarkRunner::doNotOptimize(m.data);
+    });
+}
+
+void benchWorkers(BenchmarkRunner& runner, const std::shared_ptr<PUBinder>& puBinder){
+    cv::Mat lena = cv::imread(Config::get_instance().resourceDirectory() + "/" +
+                              Config::get_instance().readStringParam("IMG_PATH"));
+    if (lena.empty()) {
+        SPDLOG_WARN("Cannot read IMG_PATH, blurring noise instead");
+        lena = cv::Mat(512, 512, CV_8UC3);
+        cv::randu(lena, cv::Scalar::all(0), cv::Scalar::all(255));
+    }
+    const int k = 17;
+    cv::Mat blurred(lena.size(), lena.type());
+    std::string group = "blur " + std::to_string(lena.cols) + "x" + std::to_string(lena.rows) + " k=" + std::to_string(k);
+
+    // OpenCV's own threads would blur the "serial" run in parallel and compete with the scheduler
+    int cvThreads = cv::getNumThreads();
+    cv::setNumThreads(1);
+    runner.run(group, "serial", [&] {
+        cv::GaussianBlur(lena, blurred, cv::Size(k, k), 10);
+    });
+    {
+        TaskScheduler scheduler(puBinder);
+        runner.run(group, "TaskScheduler, " + std::to_string(scheduler.threadCount()) + " threads", [&] {
+            scheduler.parallel_for(0, lena.rows, [&](int r0, int r1) {
+                cv::Rect band(0, r0, lena.cols, r1 - r0);
+                cv::Mat dst = blurred(band);
+                cv::GaussianBlur(lena(band), dst, cv::Size(k, k), 10);
+            });
+        });
+    }
+    cv::setNumThreads(cvThreads);
+}
+
+#if ISLAY_BENCH_GUI
+void benchUpload(BenchmarkRunner& runner){
+    const cv::Size size(1920, 1080);
+    ImageTexture texture;
+    auto upload = [&](const std::string& name, const cv::Mat& image, const ImageDisplayMapping& mapping) {
+        runner.run("upload 1920x1080", name, [&] {
+            texture.setImage(image, mapping);
+            glFinish(); // Include the transfer, not only its submission
+        });
+    };
+
+    cv::Mat bgr(size, CV_8UC3);
+    cv::randu(bgr, cv::Scalar::all(0), cv::Scalar::all(255));
+    upload("8UC3", bgr, ImageDisplayMapping());
+
+    cv::Mat depth(size, CV_16UC1);
+    cv::randu(depth, cv::Scalar::all(0), cv::Scalar::all(4096));
+    ImageDisplayMapping autoRange;
+    autoRange.autoRange = true;
+    autoRange.colormap = COLORMAP::JET;
+    upload("16UC1 auto range, jet", depth, autoRange);
+
+    cv::Mat raw(size, CV_8UC1);
+    cv::randu(raw, cv::Scalar::all(0), cv::Scalar::all(255));
+    ImageDisplayMapping bayer;
+    bayer.bayer = BAYER_PATTERN::RGGB;
+    upload("8UC1 Bayer RGGB", raw, bayer);
+}
+#endif
+
+void usage(){
+    std::cout << "Usage: islay_bench [--list] [--filter S]... [--out DIR] [--max-seconds S] [--no-pin] [--gui]"
+              << std::endl;
+}
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> filters;
+    std::string outDirectory;
+    BenchmarkConfig benchConfig;
+    bool list = false, gui = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--list") list = true;
+        else if (arg == "--filter" && hasValue) filters.emplace_back(argv[++i]);
+        else if (arg == "--out" && hasValue) outDirectory = argv[++i];
+        else if (arg == "--max-seconds" && hasValue) benchConfig.maxSeconds = std::stod(argv[++i]);
+        else if (arg == "--no-pin") benchConfig.pin = false;
+        else if (arg == "--gui") gui = true;
+        else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+// Initialize application config and logger
+    Config::get_instance();
+    Logger::get_instance().setExportDirectory(Config::get_instance().resultDirectory());
+    if (outDirectory.empty()) outDirectory = Config::get_instance().resultDirectory();
+
+    auto puBinder = std::make_shared<PUBinder>();
+    std::vector<Suite> suites = {
+            {"messenger", benchMessengers, false},
+            {"frame_pool", benchFramePool, false},
+            {"workers", [&](BenchmarkRunner& r) { benchWorkers(r, puBinder); }, false},
+#if ISLAY_BENCH_GUI
+            {"upload", benchUpload, true},
+#endif
+    };
+    if (list) {
+        for (auto& suite: suites) std::cout << suite.name << (suite.needsGl ? " (GL)" : "") << std::endl;
+        return 0;
+    }
+    auto selected = [&](const Suite& suite) {
+        if (filters.empty()) return true;
+        for (auto& f: filters) {
+            if (suite.name.find(f) != std::string::npos) return true;
+        }
+        return false;
+    };
+
+    BenchmarkRunner runner(puBinder, benchConfig);
+    auto runCpuSuites = [&] {
+        for (auto& suite: suites) {
+            if (!suite.needsGl && selected(suite)) suite.run(runner);
+        }
+    };
+
+#if ISLAY_BENCH_GUI
+    bool needsGl = gui;
+    for (auto& suite: suites) needsGl |= suite.needsGl && selected(suite);
+    if (needsGl) {
+        if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+            SPDLOG_ERROR("SDL_Init(): {}", SDL_GetError());
+            return 1;
+        }
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, 0);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
+        SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+        auto flags = (SDL_WindowFlags) (SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI |
+                                        (gui ? 0 : SDL_WINDOW_HIDDEN));
+        SDL_Window* window = SDL_CreateWindow("islay - benchmarks", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                                              1280, 900, flags);
+        if (window == nullptr) {
+            SPDLOG_ERROR("SDL_CreateWindow(): {}", SDL_GetError());
+            return 1;
+        }
+        SDL_GLContext glContext = SDL_GL_CreateContext(window);
+        SDL_GL_MakeCurrent(window, glContext);
+        SDL_GL_SetSwapInterval(0); // Benchmarks must not wait for vsync
+
+        // Uploads first: they need the GL context of this thread and would stall the live view
+        for (auto& suite: suites) {
+            if (suite.needsGl && selected(suite)) suite.run(runner);
+        }
+
+        if (gui) {
+            IMGUI_CHECKVERSION();
+            ImGui::CreateContext();
+            ImPlot::CreateContext();
+            ImGui::StyleColorsDark();
+            ImGui_ImplSDL2_InitForOpenGL(window, glContext);
+            ImGui_ImplOpenGL3_Init("#version 130");
+            SDL_GL_SetSwapInterval(1);
+
+            std::atomic<bool> finished(false);
+            std::thread cpuThread([&] {
+                runCpuSuites();
+                finished.store(true);
+            });
+            bool done = false;
+            while (!done) {
+                SDL_Event event;
+                while (SDL_PollEvent(&event)) {
+                    ImGui_ImplSDL2_ProcessEvent(&event);
+                    if (event.type == SDL_QUIT) done = true;
+                }
+                ImGui_ImplOpenGL3_NewFrame();
+                ImGui_ImplSDL2_NewFrame();
+                ImGui::NewFrame();
+                ImGui::SetNextWindowPos(ImVec2(0, 0));
+                ImGui::SetNextWindowSize(ImGui::GetIO().DisplaySize);
+                ImGui::Begin("Benchmarks", nullptr, ImGuiWindowFlags_NoDecoration);
+                ImGui::TextUnformatted(finished.load() ? "Finished. Close the window to save the results."
+                                                       : "Running... (medians, error bars from min to p99)");
+                DrawBenchmarkResults(runner.getResults());
+                ImGui::End();
+                ImGui::Render();
+                glViewport(0, 0, (int) ImGui::GetIO().DisplaySize.x, (int) ImGui::GetIO().DisplaySize.y);
+                glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT);
+                ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+                SDL_GL_SwapWindow(window);
+            }
+            if (!finished.load()) SPDLOG_INFO("Waiting for the remaining benchmarks to finish");
+            cpuThread.join();
+
+            ImGui_ImplOpenGL3_Shutdown();
+            ImGui_ImplSDL2_Shutdown();
+            ImPlot::DestroyContext();
+            ImGui::DestroyContext();
+        }
+        SDL_GL_DeleteContext(glContext);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+    }
+    if (!gui) runCpuSuites();
+#else
+    if (gui) SPDLOG_WARN("--gui needs the GUI build (ISLAY_BUILD_GUI)");
+    runCpuSuites();
+#endif
+
+    std::string stem = outDirectory + "/bench_" + Util::now();
+    bool saved = runner.exportJson(stem + ".json");
+    saved = runner.exportCsv(stem + ".csv") && saved;
+    return saved ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+/**
+ * Converts the binary logs of BinaryLog (log.bin in the result directory) to text or CSV.
+ *
+ *   islay_binlog result/xxx/log.bin --level warn --thread WorkerSample
+ *
+ *   --csv            time_ns,level,thread,file,line,message instead of text lines
+ *   --level LEVEL    Lowest level shown: trace, debug, info, warning, error (default: trace)
+ *   --thread NAME    Only the events of the threads of this name
+ *   --grep S         Only the events whose message contains S
+ *   --stats          Count the events of each call site instead of printing them
+ */
+
+#include <algorithm>
+#include <ctime>
+#include <iostream>
+#include <map>
+
+#include <islay/BinaryLogReader.h>
+
+namespace {
+const char* levelNames[] = {"trace", "debug", "info", "warning", "error", "critical"};
+
+const char* levelName(int level){
+    return level >= 0 && level < 6 ? levelNames[level] : "?";
+}
+
+std::string timeString(int64_t ns){
+    std::time_t t = (std::time_t) (ns / 1000000000);
+    std::tm tm{};
+#if WIN32
+    localtime_s(&tm, &t);
+#else
+    localtime_r(&t, &tm);
+#endif
+    char stamp[64];
+    size_t n = std::strftime(stamp, sizeof(stamp), "%y-%m-%d %H:%M:%S", &tm);
+    snprintf(stamp + n, sizeof(stamp) - n, ".%06lld", (long long) (ns % 1000000000 / 1000));
+    return stamp;
+}
+
+std::string csvField(const std::string& s){
+    if (s.find_first_of(",\"\n") == std::string::npos) return s;
+    std::string r = "\"";
+    for (char c: s) r += c == '"' ? std::string("\"\"") : std::string(1, c);
+    return r + "\"";
+}
+
+void usage(){
+    std::cout << "Usage: islay_binlog FILE [--csv] [--level LEVEL] [--thread NAME] [--grep S] [--stats]" << std::endl;
+}
+}
+
+int main(int argc, char** argv)
+{
+    std::string path, threadFilter, grep;
+    int minLevel = 0;
+    bool csv = false, stats = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--csv") csv = true;
+        else if (arg == "--stats") stats = true;
+        else if (arg == "--level" && hasValue) {
+            std::string level = argv[++i];
+            auto it = std::find_if(std::begin(levelNames), std::end(levelNames),
+                                   [&](const char* name) { return level == name || (level == "warn" && std::string(name) == "warning"); });
+            if (it == std::end(levelNames)) {
+                usage();
+                return 1;
+            }
+            minLevel = (int) (it - std::begin(levelNames));
+        }
+        else if (arg == "--thread" && hasValue) threadFilter = argv[++i];
+        else if (arg == "--grep" && hasValue) grep = argv[++i];
+        else if (path.empty() && arg[0] != '-') path = arg;
+        else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    if (path.empty()) {
+        usage();
+        return 1;
+    }
+
+    BinaryLogReader reader;
+    if (!reader.open(path)) {
+        std::cerr << "Not a binary log: " << path << std::endl;
+        return 1;
+    }
+
+    std::ios::sync_with_stdio(false);
+    if (csv && !stats) std::cout << "time_ns,level,thread,file,line,message\n";
+    std::map<uint32_t, unsigned long long> counts;
+    unsigned long long events = 0, dropped = 0;
+    int64_t first = 0, last = 0;
+    BinaryLogReader::Event e;
+    while (reader.next(e)) {
+        const BinaryLogReader::Site* site = reader.site(e.site);
+        int level = site != nullptr ? site->level : 3; // Drops are warnings
+        if (level < minLevel) continue;
+        std::string thread = reader.threadName(e.thread);
+        if (!threadFilter.empty() && thread != threadFilter) continue;
+        std::string message = reader.format(e);
+        if (!grep.empty() && message.find(grep) == std::string::npos) continue;
+
+        if (stats) {
+            if (e.site == 0) {
+                dropped += e.dropped;
+                continue;
+            }
+            counts[e.site]++;
+            if (events++ == 0) first = e.timeNs;
+            last = e.timeNs;
+        } else if (csv) {
+            std::cout << e.timeNs << "," << levelName(level) << "," << csvField(thread) << ","
+                      << csvField(site != nullptr ? site->file : "") << "," << (site != nullptr ? site->line : 0) << ","
+                      << csvField(message) << "\n";
+        } else {
+            std::cout << "[" << timeString(e.timeNs) << "][" << levelName(level) << "][" << thread << "] " << message << "\n";
+        }
+    }
+
+    if (stats) {
+        std::vector<std::pair<unsigned long long, uint32_t>> sorted;
+        for (auto& [site, count]: counts) sorted.emplace_back(count, site);
+        std::sort(sorted.rbegin(), sorted.rend());
+        double seconds = (last - first) * 1e-9;
+        std::cout << events << " events in " << seconds << " s, " << dropped << " dropped\n";
+        for (auto& [count, id]: sorted) {
+            const BinaryLogReader::Site* site = reader.site(id);
+            std::cout << count << "\t" << (seconds > 0 ? count / seconds : 0) << "/s\t"
+                      << (site != nullptr ? site->file + ":" + std::to_string(site->line) + "\t" + site->format : "?") << "\n";
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,147 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+/**
+ * Headless entry point: runs workers of Engine without SDL, OpenGL nor ImGui.
+ *
+ *   islay_headless --run WorkerSample --sink disk --duration 10
+ *
+ *   --list               List the workers that can be run
+ *   --run NAME           Run a worker (repeatable). See Engine::getLaunchers()
+ *   --sink null|disk|shm Destination of the AppMsg images (default: null)
+ *                          null: discarded, disk: saved under --out, shm: shared memory ring "/islay_<channel>" (see islay_shm_viewer)
+ *   --out DIR            Directory of the disk sink (default: the result directory)
+ *   --ext EXT            File format of the disk sink (default: png)
+ *   --every N            Save every N-th frame of each channel with the disk sink (default: 1)
+ *   --duration SEC       Terminate the workers after SEC seconds (default: run until they finish)
+ *   --profile            Save the zones of the run as Chrome trace JSON (trace.json in the result directory)
+ *
+ * Ctrl-C terminates the workers and exits. The latency of the frames is saved as latency.csv in the result directory,
+ * the ISLAY_BLOG events as log.bin (see islay_binlog).
+ */
+
+#include <atomic>
+#include <csignal>
+#include <iostream>
+#include <stdexcept>
+
+#include <islay/Config.h>
+#include <islay/HeadlessRunner.h>
+#include <islay/Logger.h>
+#include <islay/Profiler.h>
+#include "AppMsg.h"
+#include "Engine.h"
+
+namespace {
+std::atomic<bool> interrupted(false);
+
+void onSignal(int){ interrupted.store(true); }
+
+void usage(){
+    std::cout << "Usage: islay_headless [--list] [--run NAME]... [--sink null|disk|shm] [--out DIR] [--ext EXT]"
+                 " [--every N] [--duration SEC] [--profile]" << std::endl;
+}
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> workersToRun;
+    std::string sinkType = "null", outDirectory, extension = "png";
+    unsigned int every = 1;
+    double duration = 0;
+    bool list = false, profile = false;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--list") list = true;
+            else if (arg == "--run" && hasValue) workersToRun.emplace_back(argv[++i]);
+            else if (arg == "--sink" && hasValue) sinkType = argv[++i];
+            else if (arg == "--out" && hasValue) outDirectory = argv[++i];
+            else if (arg == "--ext" && hasValue) extension = argv[++i];
+            else if (arg == "--every" && hasValue) every = (unsigned int) std::stoul(argv[++i]);
+            else if (arg == "--duration" && hasValue) duration = std::stod(argv[++i]);
+            else if (arg == "--profile") profile = true;
+            else {
+                usage();
+                return arg == "--help" ? 0 : 1;
+            }
+        }
+    } catch (const std::exception& e) { // Non-numeric or out of range --every / --duration
+        std::cerr << "Invalid argument: " << e.what() << std::endl;
+        usage();
+        return 1;
+    }
+
+// Initialize application config and logger
+    Config::get_instance();
+    Logger::get_instance().setExportDirectory(Config::get_instance().resultDirectory());
+
+    AppMsgPtr appMsg = std::make_shared<AppMsg>();
+    std::shared_ptr<Engine> engine(new Engine(appMsg));
+    auto launchers = engine->getLaunchers();
+    if (list || workersToRun.empty()) {
+        std::cout << "Workers:" << std::endl;
+        for (auto& launcher: launchers) std::cout << "  " << launcher.first << std::endl;
+        if (!list) usage();
+        return list ? 0 : 1;
+    }
+    Logger::get_instance().startAsync(engine->getPUBinder()); // Workers log without waiting for the console
+    BinaryLog::get_instance().open(Config::get_instance().resultDirectory() + "/log.bin");
+
+    std::shared_ptr<ImageSink> sink;
+    if (sinkType == "null") {
+        sink = std::make_shared<NullImageSink>();
+    } else if (sinkType == "disk") {
+        sink = std::make_shared<DiskImageSink>(outDirectory.empty() ? Config::get_instance().resultDirectory() : outDirectory,
+                                               extension, every);
+    } else if (sinkType == "shm") {
+        sink = std::make_shared<SharedMemoryImageSink>();
+    } else {
+        SPDLOG_ERROR("Unknown sink: {}", sinkType);
+        return 1;
+    }
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    if (profile) Profiler::get_instance().start();
+    for (auto& name: workersToRun) {
+        auto it = launchers.find(name);
+        if (it == launchers.end()) {
+            SPDLOG_ERROR("Unknown worker: {}. See --list", name);
+            return 1;
+        }
+        it->second();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    HeadlessRunner runner(appMsg, sink);
+    runner.run([&] {
+        if (interrupted.load()) return false;
+        if (duration > 0) return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < duration;
+        for (auto& name: engine->getWorkerList()) {
+            auto status = engine->getWorkerStatus(name);
+            if (status == WORKER_STATUS::RUNNING || status == WORKER_STATUS::TERMINATE_REQUESTED) return true;
+        }
+        return false;
+    });
+
+    engine->terminateAll(); // Request all workers to terminate
+    appMsg->close(); // Nothing drains the channels anymore: wake the workers blocked on a full queue
+    engine->reset(); // Join all threads of workers
+    if (profile) {
+        Profiler::get_instance().stop();
+        Profiler::get_instance().exportChromeTrace(Config::get_instance().resultDirectory() + "/trace.json");
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (auto& [channel, count]: runner.getFrameCounts()) {
+        SPDLOG_INFO("{}: {} frames ({:.1f} fps)", channel, count, count / elapsed);
+    }
+    LatencyTracer::get_instance().exportCsv(Config::get_instance().resultDirectory() + "/latency.csv");
+    BinaryLog::get_instance().close();
+    SPDLOG_INFO("Program terminated successfully. See you!");
+    return 0;
+}
@@ -0,0 +1,116 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+/**
+ * Attaches to a shared memory image channel published by another process
+ * (islay_headless --sink shm, or OcvImageMessengerCollection::setupSharedMemory) and shows, saves
+ * or just measures its frames. Survives restarts of the publisher.
+ *
+ *   islay_shm_viewer lena --show
+ *
+ *   --show             Show the frames in a window (needs a display)
+ *   --save DIR         Save every frame as DIR/<channel>_<seqno>.png
+ *   --count N          Exit after N frames (default: run until Ctrl-C)
+ *
+ * Prints the frame rate, the frames skipped and the latency from publish to receive every second.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <islay/Logger.h>
+#include <islay/ShmImageChannel.h>
+
+namespace {
+std::atomic<bool> interrupted(false);
+
+void onSignal(int){ interrupted.store(true); }
+
+void usage(){
+    std::cout << "Usage: islay_shm_viewer CHANNEL [--show] [--save DIR] [--count N]" << std::endl;
+}
+}
+
+int main(int argc, char** argv)
+{
+    std::string channel, saveDirectory;
+    bool show = false;
+    unsigned long long count = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--show") show = true;
+        else if (arg == "--save" && hasValue) saveDirectory = argv[++i];
+        else if (arg == "--count" && hasValue) count = std::stoull(argv[++i]);
+        else if (arg[0] != '-' && channel.empty()) channel = arg;
+        else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    if (channel.empty()) {
+        usage();
+        return 1;
+    }
+    if (!saveDirectory.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(saveDirectory, ec);
+    }
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    ShmImageReader reader;
+    cv::Mat img;
+    ShmFrameInfo info;
+    std::vector<double> latencies;
+    unsigned long long received = 0, skipped = 0, lastSeqno = 0;
+    bool first = true;
+    auto reportTime = std::chrono::steady_clock::now();
+    while (!interrupted.load() && (count == 0 || received < count)) {
+        if (reader.isClosed()) {
+            // Not published yet, or replaced by the publisher (restart, larger frames)
+            if (!reader.open(channel)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            SPDLOG_INFO("Attached to {}", ShmImageChannel::shmName(channel));
+            first = true;
+        }
+        if (reader.waitNext(img, info, std::chrono::milliseconds(100))) {
+            latencies.push_back((ShmImageChannel::nowNs() - info.timestampNs) * 1e-3);
+            if (!first && info.seqno > lastSeqno + 1) skipped += info.seqno - lastSeqno - 1;
+            lastSeqno = info.seqno;
+            first = false;
+            received++;
+            if (!saveDirectory.empty()) {
+                std::ostringstream file;
+                file << channel << "_" << std::setw(6) << std::setfill('0') << info.seqno << ".png";
+                cv::imwrite((std::filesystem::path(saveDirectory) / file.str()).string(), img);
+            }
+            if (show) {
+                cv::imshow(channel, img);
+                cv::waitKey(1);
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - reportTime).count();
+        if (elapsed >= 1.0 && !latencies.empty()) {
+            std::sort(latencies.begin(), latencies.end());
+            SPDLOG_INFO("{}: {:.1f} fps, {} skipped, latency p50 {:.1f} us, max {:.1f} us", channel,
+                        latencies.size() / elapsed, skipped, latencies[latencies.size() / 2], latencies.back());
+            latencies.clear();
+            skipped = 0;
+            reportTime = now;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+/**
+ * Tests of QueueMessenger: delivery order and the losses of the overflow policies under contention.
+ * Exits with 1 on the first failed check.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include <islay/QueueMessenger.hpp>
+
+#define CHECK(cond) do { if (!(cond)) { std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); std::exit(1); } } while (0)
+
+struct IntMsg : public MsgData {
+    long value = -1;
+};
+
+static void send(QueueMessenger<IntMsg>& queue, long value, bool expectDelivered){
+    auto msg = queue.prepareMsg();
+    CHECK((msg != nullptr) == expectDelivered);
+    if (msg != nullptr) {
+        msg->value = value;
+        queue.send(msg);
+    }
+}
+
+/// A slot held by a consumer does not stop DROP_OLDEST: the oldest message waiting is the one dropped
+static void testDropOldestWithHeldSlot(){
+    QueueMessenger<IntMsg> queue(4, OVERFLOW_POLICY::DROP_OLDEST);
+    for (long i = 0; i < 4; i++) send(queue, i, true);
+    auto held = queue.receive(); // The consumer holds the slot of 0 while 1, 2 and 3 wait
+    CHECK(held != nullptr && held->value == 0);
+
+    send(queue, 4, true); // Full: 1 is dropped
+    send(queue, 5, true); // 2 is dropped
+    CHECK(queue.getDroppedOldestCount() == 2);
+    CHECK(queue.getDroppedNewestCount() == 0);
+    CHECK(held->value == 0); // The held message is not touched
+
+    for (long expected: {3, 4, 5}) {
+        auto msg = queue.receive();
+        CHECK(msg != nullptr && msg->value == expected);
+        queue.release(msg);
+    }
+    CHECK(queue.receive() == nullptr);
+    queue.release(held);
+
+    // Every slot held by consumers: nothing waits, so the new message is dropped
+    QueueMessenger<IntMsg> small(2, OVERFLOW_POLICY::DROP_OLDEST);
+    send(small, 0, true);
+    send(small, 1, true);
+    auto a = small.receive();
+    auto b = small.receive();
+    CHECK(a != nullptr && b != nullptr);
+    send(small, 2, false);
+    CHECK(small.getDroppedNewestCount() == 1);
+    small.release(a);
+    small.release(b);
+}
+
+/**
+ * A producer sends into a small queue while a slow consumer holds each message for a while.
+ * Each prepareMsg() loses at most one message, the messages received are in order, and every
+ * message is either received or counted as dropped.
+ */
+static void testStress(OVERFLOW_POLICY policy){
+    const long COUNT = 200000;
+    QueueMessenger<IntMsg> queue(4, policy);
+    std::atomic<bool> producerDone{false};
+    long received = 0;
+    long last = -1;
+
+    std::thread consumer([&] {
+        while (true) {
+            auto msg = queue.waitReceive(std::chrono::milliseconds(10));
+            if (msg == nullptr) {
+                if (producerDone.load() && queue.size() == 0) break;
+                continue;
+            }
+            CHECK(msg->value > last);
+            last = msg->value;
+            received++;
+            if (received % 64 == 0) std::this_thread::sleep_for(std::chrono::microseconds(50)); // Holds the slot
+            queue.release(msg);
+        }
+    });
+
+    for (long i = 0; i < COUNT; i++) {
+        unsigned long long before = queue.getDropCount();
+        auto msg = queue.prepareMsg();
+        unsigned long long lost = queue.getDropCount() - before;
+        CHECK(lost <= 1);
+        CHECK(msg != nullptr || lost == 1);
+        if (msg != nullptr) {
+            msg->value = i;
+            queue.send(msg);
+        }
+    }
+    producerDone.store(true);
+    consumer.join();
+
+    CHECK(received + (long) queue.getDropCount() == COUNT);
+    if (policy == OVERFLOW_POLICY::BLOCK) CHECK(received == COUNT);
+    // With one consumer holding one slot, a message always waits when the queue is full
+    if (policy == OVERFLOW_POLICY::DROP_OLDEST) CHECK(queue.getDroppedNewestCount() == 0);
+    std::printf("policy %d: %ld received, %llu oldest dropped, %llu newest dropped\n", (int) policy, received,
+                queue.getDroppedOldestCount(), queue.getDroppedNewestCount());
+}
+
+int main(){
+    testDropOldestWithHeldSlot();
+    testStress(OVERFLOW_POLICY::DROP_OLDEST);
+    testStress(OVERFLOW_POLICY::DROP_NEWEST);
+    testStress(OVERFLOW_POLICY::BLOCK);
+    std::printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,81 @@
+//
+// Created by Hirano Masahiro <masahiro.dll@gmail.com>
+//
+
+/**
+ * Tests of TaskScheduler: completion of the groups, nested waits, and tasks that throw.
+ * Runs on a synthetic topology so that scheduler threads start whatever the machine.
+ * Exits with 1 on the first failed check.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <islay/TaskScheduler.h>
+
+#define CHECK(cond) do { if (!(cond)) { std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); std::exit(1); } } while (0)
+
+/// Every index is visited once, also with nested parallel_for inside the tasks
+static void testParallelFor(TaskScheduler& scheduler){
+    const int N = 64;
+    std::vector<std::atomic<int>> visits(N * N);
+    for (int round = 0; round < 100; round++) {
+        for (auto& v: visits) v.store(0);
+        scheduler.parallel_for(0, N, [&](int r0, int r1) {
+            for (int r = r0; r < r1; r++) {
+                scheduler.parallel_for(0, N, [&](int c0, int c1) {
+                    for (int c = c0; c < c1; c++) visits[r * N + c].fetch_add(1);
+                }, 8);
+            }
+        }, 4);
+        for (auto& v: visits) CHECK(v.load() == 1);
+    }
+}
+
+/// A throwing task completes its group: wait() returns after the other tasks and rethrows the first exception
+static void testException(TaskScheduler& scheduler){
+    for (int round = 0; round < 100; round++) {
+        std::atomic<int> ran{0};
+        TaskGroup group;
+        for (int i = 0; i < 16; i++) {
+            scheduler.spawn(group, [&ran, i] {
+                ran.fetch_add(1);
+                if (i % 4 == 1) throw std::runtime_error("task " + std::to_string(i));
+            });
+        }
+        bool caught = false;
+        try {
+            scheduler.wait(group);
+        } catch (const std::runtime_error&) {
+            caught = true;
+        }
+        CHECK(caught);
+        CHECK(group.done());
+        CHECK(ran.load() == 16);
+        scheduler.wait(group); // The exception is rethrown once
+    }
+
+    bool caught = false;
+    try {
+        scheduler.parallel_for(0, 100, [](int i0, int) {
+            if (i0 == 0) throw std::logic_error("first chunk");
+        }, 10);
+    } catch (const std::logic_error&) {
+        caught = true;
+    }
+    CHECK(caught);
+}
+
+int main(){
+    auto binder = std::make_shared<PUBinder>("pack:1 core:4 pu:1");
+    TaskScheduler scheduler(binder, 3);
+    CHECK(scheduler.threadCount() == 3); // Counted once every thread has binded, whatever the startup timing
+    testParallelFor(scheduler);
+    testException(scheduler);
+    std::printf("OK\n");
+    return 0;
+}